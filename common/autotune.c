@@ -0,0 +1,169 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "autotune.h"
+
+/* default host profile, in the home directory of the user */
+#define PROFILE_NAME ".benchmark.profile"
+
+static double now_s()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* runs the rounds of the search and returns the best configuration, with
+ * its throughput in the last round it ran in best_value
+ */
+int tune(tuner_t *tuner, double *best_value)
+{
+    int *alive, num_alive, keep, round, i, j, tmp;
+    double *score, start, round_start, round_time, estimate;
+    long resource;
+    char desc[PROFILE_LINE];
+
+    alive = (int *) malloc(tuner->num_configs * sizeof(int));
+    score = (double *) calloc(tuner->num_configs, sizeof(double));
+    for (i = 0; i < tuner->num_configs; ++i) {
+        alive[i] = i;
+    }
+    num_alive = tuner->num_configs;
+    resource = tuner->resource;
+
+    start = now_s();
+    for (round = 1; ; ++round) {
+        printf("Round %d: %d configurations, %ld %s\n", round, num_alive,
+                resource, tuner->unit);
+        fflush(stdout);
+
+        round_start = now_s();
+        for (i = 0; i < num_alive; ++i) {
+            score[alive[i]] = tuner->eval(alive[i], resource, tuner->ctx);
+            tuner->describe(alive[i], desc, sizeof(desc), tuner->ctx);
+            printf("\t%s: %lf\n", desc, score[alive[i]]);
+            fflush(stdout);
+        }
+        round_time = now_s() - round_start;
+
+        // best first, ties keep the order of the configurations //
+        for (i = 1; i < num_alive; ++i) {
+            for (j = i; j > 0 && score[alive[j]] > score[alive[j - 1]]; --j) {
+                tmp = alive[j];
+                alive[j] = alive[j - 1];
+                alive[j - 1] = tmp;
+            }
+        }
+        if (num_alive == 1) {
+            break;
+        }
+
+        // the next round runs half the configurations twice as long; the
+        // last two keep running longer until the budget is used, so the
+        // pick between close configurations is not left to noise //
+        keep = num_alive > 2 ? (num_alive + 1) / 2 : 2;
+        estimate = round_time * keep / num_alive * 2;
+        if (now_s() - start + estimate > tuner->budget) {
+            printf("Time budget of %.0lf s reached\n", tuner->budget);
+            break;
+        }
+        num_alive = keep;
+        resource *= 2;
+    }
+
+    i = alive[0];
+    *best_value = score[i];
+    free(alive);
+    free(score);
+    return i;
+}
+
+/* the host profile is the given path, or $BENCHMARK_PROFILE, or
+ * ~/.benchmark.profile
+ */
+const char *profile_path(const char *path)
+{
+    static char buf[PROFILE_LINE];
+    const char *home;
+
+    if (path != NULL) {
+        return path;
+    }
+    if (getenv("BENCHMARK_PROFILE") != NULL) {
+        return getenv("BENCHMARK_PROFILE");
+    }
+    home = getenv("HOME");
+    snprintf(buf, sizeof(buf), "%s/%s", home != NULL ? home : ".",
+            PROFILE_NAME);
+    return buf;
+}
+
+/* looks key up in the profile, a file of key=value lines; returns -1 if
+ * the file or the key does not exist
+ */
+int profile_load(const char *path, const char *key, char *value, int len)
+{
+    char line[2 * PROFILE_LINE];
+    size_t keylen;
+    FILE *f;
+
+    f = fopen(path, "r");
+    if (f == NULL) {
+        return -1;
+    }
+    keylen = strlen(key);
+    while (fgets(line, sizeof(line), f) != NULL) {
+        if (strncmp(line, key, keylen) == 0 && line[keylen] == '=') {
+            line[strcspn(line, "\n")] = '\0';
+            snprintf(value, len, "%s", line + keylen + 1);
+            fclose(f);
+            return 0;
+        }
+    }
+    fclose(f);
+    return -1;
+}
+
+/* replaces every line of the profile whose key starts with prefix by the
+ * n given keys and values, keeping the results of the other benchmarks;
+ * the new profile is written aside and renamed over the old one
+ */
+int profile_store(const char *path, const char *prefix, const char **keys,
+        const char **values, int n)
+{
+    char line[2 * PROFILE_LINE], tmp[PROFILE_LINE + 8];
+    FILE *in, *out;
+    int i;
+
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    out = fopen(tmp, "w");
+    if (out == NULL) {
+        fprintf(stderr, "Could not write the profile %s!\n", tmp);
+        return -1;
+    }
+
+    in = fopen(path, "r");
+    if (in != NULL) {
+        while (fgets(line, sizeof(line), in) != NULL) {
+            if (strncmp(line, prefix, strlen(prefix)) != 0) {
+                fputs(line, out);
+            }
+        }
+        fclose(in);
+    }
+    for (i = 0; i < n; ++i) {
+        fprintf(out, "%s%s=%s\n", prefix, keys[i], values[i]);
+    }
+
+    if (fclose(out) != 0 || rename(tmp, path) != 0) {
+        fprintf(stderr, "Could not write the profile %s!\n", path);
+        unlink(tmp);
+        return -1;
+    }
+    return 0;
+}
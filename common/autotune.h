@@ -0,0 +1,40 @@
+#ifndef AUTOTUNE_H
+#define AUTOTUNE_H
+
+/* longest key and value of a host profile line */
+#define PROFILE_LINE 256
+
+/* runs configuration config with resource units of work (repeats, seconds)
+ * and returns its throughput, higher being better
+ */
+typedef double (*tune_eval_t)(int config, long resource, void *ctx);
+
+/* writes a short description of configuration config into buf */
+typedef void (*tune_describe_t)(int config, char *buf, int len, void *ctx);
+
+/* search of the best of num_configs configurations by successive halving:
+ * every round runs the remaining configurations with the resource of the
+ * round, keeps the better half (at least two) and doubles the resource,
+ * until the next round would not fit in the budget
+ */
+typedef struct tuner_t
+{
+    int num_configs;
+    long resource;
+    const char *unit;
+    double budget;
+    tune_eval_t eval;
+    tune_describe_t describe;
+    void *ctx;
+} tuner_t;
+
+int tune(tuner_t *tuner, double *best_value);
+
+const char *profile_path(const char *path);
+
+int profile_load(const char *path, const char *key, char *value, int len);
+
+int profile_store(const char *path, const char *prefix, const char **keys,
+        const char **values, int n);
+
+#endif
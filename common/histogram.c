@@ -0,0 +1,90 @@
+#include <stdio.h>
+
+#include "histogram.h"
+
+static int hist_index(long value)
+{
+    int msb, shift;
+
+    if (value < HIST_SUB_COUNT) {
+        return value < 0 ? 0 : (int) value;
+    }
+    msb = 63 - __builtin_clzl((unsigned long) value);
+    shift = msb - HIST_SUB_BITS;
+    return ((shift + 1) << HIST_SUB_BITS)
+            + (int) ((value >> shift) & (HIST_SUB_COUNT - 1));
+}
+
+/* returns the midpoint of the values that fall into a bucket */
+static long hist_value(int index)
+{
+    int shift, sub;
+
+    if (index < HIST_SUB_COUNT) {
+        return index;
+    }
+    shift = (index >> HIST_SUB_BITS) - 1;
+    sub = index & (HIST_SUB_COUNT - 1);
+    return ((long) (HIST_SUB_COUNT + sub) << shift) + ((1L << shift) >> 1);
+}
+
+void hist_record(histogram_t *hist, long value)
+{
+    hist->count[hist_index(value)]++;
+    hist->total++;
+    hist->sum += value;
+    if (value > hist->max) {
+        hist->max = value;
+    }
+}
+
+void hist_merge(histogram_t *dst, histogram_t *src)
+{
+    int i;
+
+    for (i = 0; i < HIST_BUCKETS; ++i) {
+        dst->count[i] += src->count[i];
+    }
+    dst->total += src->total;
+    dst->sum += src->sum;
+    if (src->max > dst->max) {
+        dst->max = src->max;
+    }
+}
+
+long hist_percentile(histogram_t *hist, double pct)
+{
+    long rank, seen;
+    int i;
+
+    if (hist->total == 0) {
+        return 0;
+    }
+    rank = (long) (pct / 100.0 * hist->total);
+    if (rank >= hist->total) {
+        rank = hist->total - 1;
+    }
+    seen = 0;
+    for (i = 0; i < HIST_BUCKETS; ++i) {
+        seen += hist->count[i];
+        if (seen > rank) {
+            return hist_value(i) < hist->max ? hist_value(i) : hist->max;
+        }
+    }
+    return hist->max;
+}
+
+void hist_print(const char *label, histogram_t *hist)
+{
+    if (hist->total == 0) {
+        return;
+    }
+    printf("%s latency: avg %.1lf us, p50 %.1lf us, p90 %.1lf us, "
+            "p99 %.1lf us, p99.9 %.1lf us, max %.1lf us\n", label,
+            (double) hist->sum / hist->total / 1000.0,
+            hist_percentile(hist, 50.0) / 1000.0,
+            hist_percentile(hist, 90.0) / 1000.0,
+            hist_percentile(hist, 99.0) / 1000.0,
+            hist_percentile(hist, 99.9) / 1000.0,
+            hist->max / 1000.0);
+}
@@ -0,0 +1,31 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+/* latency histogram: 16 linear sub-buckets per power of two, in nanoseconds */
+#define HIST_SUB_BITS 4
+#define HIST_SUB_COUNT (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS (64 * HIST_SUB_COUNT)
+
+typedef struct histogram_t
+{
+    long count[HIST_BUCKETS];
+    long total;
+    long sum;
+    long max;
+} histogram_t;
+
+void hist_record(histogram_t *hist, long value);
+
+void hist_merge(histogram_t *dst, histogram_t *src);
+
+/* returns the value below which pct percent of the recorded values fall,
+ * accurate to the width of its bucket
+ */
+long hist_percentile(histogram_t *hist, double pct);
+
+/* prints the average, the percentiles and the maximum in microseconds as
+ * "<label> latency: ..."; prints nothing for an empty histogram
+ */
+void hist_print(const char *label, histogram_t *hist);
+
+#endif
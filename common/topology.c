@@ -0,0 +1,420 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+
+#include "topology.h"
+
+/* most CPUs whose core and package ids are collected */
+#define MAX_CPUS 4096
+
+/* SMBIOS memory device: structure type, size, extended size, speed and
+ * configured speed
+ */
+#define DMI_MEMORY_DEVICE 17
+#define DMI_SIZE 0x0c
+#define DMI_EXTENDED_SIZE 0x1c
+#define DMI_SPEED 0x15
+#define DMI_CONFIGURED_SPEED 0x20
+
+/* reads the first line of a file without its newline; returns -1 if the
+ * file can not be read
+ */
+static int read_line(const char *path, char *buf, int len)
+{
+    FILE *f;
+
+    f = fopen(path, "r");
+    if (f == NULL) {
+        return -1;
+    }
+    if (fgets(buf, len, f) == NULL) {
+        fclose(f);
+        return -1;
+    }
+    fclose(f);
+    buf[strcspn(buf, "\n")] = '\0';
+    return 0;
+}
+
+static long read_number(const char *path)
+{
+    char buf[64];
+
+    if (read_line(path, buf, sizeof(buf)) < 0) {
+        return -1;
+    }
+    return atol(buf);
+}
+
+/* trims the spaces around a string in place */
+static char *trim(char *str)
+{
+    char *end;
+
+    while (isspace((unsigned char) *str)) {
+        str++;
+    }
+    end = str + strlen(str);
+    while (end > str && isspace((unsigned char) end[-1])) {
+        *--end = '\0';
+    }
+    return str;
+}
+
+/* copies the value of the first "key : value" line of a /proc file */
+static void read_field(const char *path, const char *key, char *buf, int len)
+{
+    char line[512], *colon;
+    FILE *f;
+
+    f = fopen(path, "r");
+    if (f == NULL) {
+        return;
+    }
+    while (fgets(line, sizeof(line), f) != NULL) {
+        colon = strchr(line, ':');
+        if (colon != NULL && strncmp(line, key, strlen(key)) == 0) {
+            snprintf(buf, len, "%s", trim(colon + 1));
+            break;
+        }
+    }
+    fclose(f);
+}
+
+/* counts the sockets and the cores from the package and core ids of the
+ * online CPUs
+ */
+static void read_cpus(topology_t *topo)
+{
+    static long package[MAX_CPUS], core[MAX_CPUS];
+    char path[128];
+    int cpu, i, j, num, known;
+
+    topo->threads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    num = 0;
+    for (cpu = 0; cpu < MAX_CPUS && num < topo->threads; ++cpu) {
+        snprintf(path, sizeof(path),
+                "/sys/devices/system/cpu/cpu%d/topology/physical_package_id",
+                cpu);
+        package[num] = read_number(path);
+        snprintf(path, sizeof(path),
+                "/sys/devices/system/cpu/cpu%d/topology/core_id", cpu);
+        core[num] = read_number(path);
+        if (package[num] >= 0 && core[num] >= 0) {
+            num++;
+        }
+    }
+
+    for (i = 0; i < num; ++i) {
+        known = 0;
+        for (j = 0; j < i && !known; ++j) {
+            known = package[j] == package[i];
+        }
+        topo->sockets += !known;
+        known = 0;
+        for (j = 0; j < i && !known; ++j) {
+            known = package[j] == package[i] && core[j] == core[i];
+        }
+        topo->cores += !known;
+    }
+    if (topo->cores == 0) {
+        topo->sockets = 1;
+        topo->cores = topo->threads;
+    }
+}
+
+static void read_caches(topology_t *topo)
+{
+    char path[128], type[32], size[32];
+    long bytes;
+    int i, level;
+
+    for (i = 0; i < 16; ++i) {
+        snprintf(path, sizeof(path),
+                "/sys/devices/system/cpu/cpu0/cache/index%d/level", i);
+        level = (int) read_number(path);
+        if (level < 0) {
+            break;
+        }
+        snprintf(path, sizeof(path),
+                "/sys/devices/system/cpu/cpu0/cache/index%d/type", i);
+        if (read_line(path, type, sizeof(type)) < 0) {
+            continue;
+        }
+        snprintf(path, sizeof(path),
+                "/sys/devices/system/cpu/cpu0/cache/index%d/size", i);
+        if (read_line(path, size, sizeof(size)) < 0) {
+            continue;
+        }
+        bytes = atol(size);
+        if (strchr(size, 'K') != NULL) {
+            bytes *= 1024;
+        } else if (strchr(size, 'M') != NULL) {
+            bytes *= 1024 * 1024;
+        }
+
+        if (level == 1 && strcmp(type, "Instruction") == 0) {
+            topo->l1i = bytes;
+        } else if (level == 1) {
+            topo->l1d = bytes;
+        } else if (level == 2) {
+            topo->l2 = bytes;
+        } else if (level == 3) {
+            topo->l3 = bytes;
+        }
+    }
+}
+
+/* the installed memory and the fastest configured speed of the memory
+ * devices of the SMBIOS tables, which are only readable by root; without
+ * them the installed memory is MemTotal rounded up to GiB, which stays the
+ * same when a kernel update or a crash kernel reserves a few MB more
+ */
+static void read_memory(topology_t *topo)
+{
+    char field[64], path[300];
+    unsigned char raw[0x24];
+    struct dirent *entry;
+    FILE *f;
+    DIR *dir;
+    size_t len;
+    long size, installed_mb;
+    int speed;
+
+    read_field("/proc/meminfo", "MemTotal", field, sizeof(field));
+    topo->memory_kb = atol(field);
+    field[0] = '\0';
+    read_field("/proc/meminfo", "MemAvailable", field, sizeof(field));
+    topo->memory_available_kb = atol(field);
+    topo->memory_gb = (topo->memory_kb + 1048575) / 1048576;
+
+    dir = opendir("/sys/firmware/dmi/entries");
+    if (dir == NULL) {
+        return;
+    }
+    installed_mb = 0;
+    while ((entry = readdir(dir)) != NULL) {
+        if (atoi(entry->d_name) != DMI_MEMORY_DEVICE
+                || strchr(entry->d_name, '-') == NULL) {
+            continue;
+        }
+        snprintf(path, sizeof(path), "/sys/firmware/dmi/entries/%s/raw",
+                entry->d_name);
+        f = fopen(path, "rb");
+        if (f == NULL) {
+            continue;
+        }
+        len = fread(raw, 1, sizeof(raw), f);
+        fclose(f);
+
+        // the size is in KB with the top bit set, 0x7fff means extended //
+        size = 0;
+        if (len >= DMI_SIZE + 2) {
+            size = raw[DMI_SIZE] | raw[DMI_SIZE + 1] << 8;
+        }
+        if (size == 0x7fff && len >= DMI_EXTENDED_SIZE + 4) {
+            size = (long) (raw[DMI_EXTENDED_SIZE]
+                    | raw[DMI_EXTENDED_SIZE + 1] << 8
+                    | raw[DMI_EXTENDED_SIZE + 2] << 16
+                    | (unsigned long) raw[DMI_EXTENDED_SIZE + 3] << 24);
+        } else if (size == 0xffff) {
+            size = 0;
+        } else if (size & 0x8000) {
+            size = (size & 0x7fff) / 1024;
+        }
+        installed_mb += size;
+
+        speed = 0;
+        if (len >= DMI_CONFIGURED_SPEED + 2) {
+            speed = raw[DMI_CONFIGURED_SPEED]
+                    | raw[DMI_CONFIGURED_SPEED + 1] << 8;
+        }
+        if (speed == 0 && len >= DMI_SPEED + 2) {
+            speed = raw[DMI_SPEED] | raw[DMI_SPEED + 1] << 8;
+        }
+        if (speed > topo->memory_speed && speed != 0xffff) {
+            topo->memory_speed = speed;
+        }
+    }
+    closedir(dir);
+    if (installed_mb > 0) {
+        topo->memory_gb = (installed_mb + 1023) / 1024;
+    }
+}
+
+/* the disk holding path: the whole device of its partition, its model and
+ * the scheduler selected in brackets
+ */
+static void read_disk(topology_t *topo, const char *path)
+{
+    char sys[600], dev[512], model[TOPO_NAME], sched[256], *name, *start;
+    char *end;
+    struct stat st;
+    ssize_t len;
+
+    if (stat(path != NULL ? path : ".", &st) < 0) {
+        return;
+    }
+    snprintf(sys, sizeof(sys), "/sys/dev/block/%u:%u", major(st.st_dev),
+            minor(st.st_dev));
+    len = readlink(sys, dev, sizeof(dev) - 1);
+    if (len < 0) {
+        return;
+    }
+    dev[len] = '\0';
+
+    // a partition is a directory of its disk //
+    snprintf(sys, sizeof(sys), "/sys/dev/block/%u:%u/partition",
+            major(st.st_dev), minor(st.st_dev));
+    if (access(sys, F_OK) == 0) {
+        *strrchr(dev, '/') = '\0';
+    }
+    name = strrchr(dev, '/') != NULL ? strrchr(dev, '/') + 1 : dev;
+
+    strcpy(model, "unknown");
+    snprintf(sys, sizeof(sys), "/sys/block/%s/device/model", name);
+    if (read_line(sys, model, sizeof(model)) == 0) {
+        memmove(model, trim(model), strlen(trim(model)) + 1);
+    }
+    strcpy(sched, "none");
+    snprintf(sys, sizeof(sys), "/sys/block/%s/queue/scheduler", name);
+    if (read_line(sys, sched, sizeof(sched)) == 0
+            && (start = strchr(sched, '[')) != NULL
+            && (end = strchr(start, ']')) != NULL) {
+        *end = '\0';
+        memmove(sched, start + 1, strlen(start + 1) + 1);
+    }
+    snprintf(topo->disk, sizeof(topo->disk), "%.200s:%.120s:%.120s",
+            name, model, sched);
+    for (start = topo->disk; *start != '\0'; ++start) {
+        if (*start == ' ') {
+            *start = '_';
+        }
+    }
+}
+
+/* every interface but the loopback, with its driver and link speed */
+static void read_nics(topology_t *topo)
+{
+    char path[300], link[256], *driver;
+    struct dirent *entry;
+    size_t used;
+    ssize_t len;
+    long speed;
+    DIR *dir;
+
+    dir = opendir("/sys/class/net");
+    if (dir == NULL) {
+        return;
+    }
+    used = 0;
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] == '.' || strcmp(entry->d_name, "lo") == 0) {
+            continue;
+        }
+        snprintf(path, sizeof(path), "/sys/class/net/%s/device/driver",
+                entry->d_name);
+        len = readlink(path, link, sizeof(link) - 1);
+        driver = "virtual";
+        if (len > 0) {
+            link[len] = '\0';
+            driver = strrchr(link, '/') != NULL ? strrchr(link, '/') + 1
+                    : link;
+        }
+        snprintf(path, sizeof(path), "/sys/class/net/%s/speed",
+                entry->d_name);
+        speed = read_number(path);
+
+        if (used + strlen(entry->d_name) + 64 >= sizeof(topo->nic)) {
+            break;
+        }
+        used += snprintf(topo->nic + used, sizeof(topo->nic) - used,
+                "%s%s:%s:%ldMb/s", used > 0 ? "," : "", entry->d_name,
+                driver, speed > 0 ? speed : 0);
+    }
+    closedir(dir);
+}
+
+/* FNV-1a hash of the hardware, printed as 16 hex digits; results.py
+ * computes the same hash for the commands that print no host line
+ */
+static void fingerprint(topology_t *topo)
+{
+    char buf[1024];
+    unsigned long hash;
+    int i, len;
+
+    len = snprintf(buf, sizeof(buf), "%s|%s|%d|%d|%d|%d|%ld|%ld|%ld|%ld",
+            topo->hostname, topo->cpu_model, topo->sockets, topo->cores,
+            topo->threads, topo->numa_nodes, topo->l1d, topo->l2, topo->l3,
+            topo->memory_gb);
+    hash = 14695981039346656037UL;
+    for (i = 0; i < len && i < (int) sizeof(buf); ++i) {
+        hash ^= (unsigned char) buf[i];
+        hash *= 1099511628211UL;
+    }
+    snprintf(topo->fingerprint, sizeof(topo->fingerprint), "%016lx", hash);
+}
+
+/* reads the topology of the machine, with the disk holding path (the
+ * current directory if path is NULL)
+ */
+void topology_read(topology_t *topo, const char *path)
+{
+    char node[64];
+    int i;
+
+    memset(topo, 0, sizeof(*topo));
+    gethostname(topo->hostname, sizeof(topo->hostname) - 1);
+    read_field("/proc/cpuinfo", "model name", topo->cpu_model,
+            sizeof(topo->cpu_model));
+    read_field("/proc/cpuinfo", "microcode", topo->microcode,
+            sizeof(topo->microcode));
+    read_cpus(topo);
+
+    for (i = 0; i < 1024; ++i) {
+        snprintf(node, sizeof(node), "/sys/devices/system/node/node%d", i);
+        if (access(node, F_OK) == 0) {
+            topo->numa_nodes++;
+        }
+    }
+    if (topo->numa_nodes == 0) {
+        topo->numa_nodes = 1;
+    }
+
+    read_caches(topo);
+    read_memory(topo);
+    read_disk(topo, path);
+    read_nics(topo);
+    fingerprint(topo);
+}
+
+/* size of the last level cache in bytes, 0 if unknown */
+long topology_llc(const topology_t *topo)
+{
+    return topo->l3 > 0 ? topo->l3 : topo->l2 > 0 ? topo->l2 : topo->l1d;
+}
+
+/* prints the topology as a single line of key=value pairs, which the
+ * results store keeps with every result
+ */
+void topology_print(const topology_t *topo)
+{
+    printf("Host: fingerprint=%s hostname=%s cpu=\"%s\" microcode=%s "
+            "sockets=%d cores=%d threads=%d numa=%d l1d=%ldK l1i=%ldK "
+            "l2=%ldK l3=%ldK memory=%ldGB memory_speed=%dMT/s disk=%s "
+            "nic=%s\n", topo->fingerprint, topo->hostname, topo->cpu_model,
+            topo->microcode[0] != '\0' ? topo->microcode : "unknown",
+            topo->sockets, topo->cores, topo->threads, topo->numa_nodes,
+            topo->l1d / 1024, topo->l1i / 1024, topo->l2 / 1024,
+            topo->l3 / 1024, topo->memory_gb, topo->memory_speed,
+            topo->disk[0] != '\0' ? topo->disk : "unknown",
+            topo->nic[0] != '\0' ? topo->nic : "none");
+    fflush(stdout);
+}
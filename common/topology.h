@@ -0,0 +1,49 @@
+#ifndef TOPOLOGY_H
+#define TOPOLOGY_H
+
+#define TOPO_NAME 128
+#define TOPO_LIST 512
+
+/* the machine a benchmark runs on, read from /sys and /proc; the values
+ * that can not be read are left at 0 or empty
+ */
+typedef struct topology_t
+{
+    char hostname[TOPO_NAME];
+    char cpu_model[TOPO_NAME];
+    char microcode[32];
+    int sockets;
+    int cores;
+    int threads;
+    int numa_nodes;
+
+    /* size of one instance of every cache level in bytes */
+    long l1d;
+    long l1i;
+    long l2;
+    long l3;
+
+    long memory_kb;
+    long memory_available_kb;
+
+    /* installed memory, the same across kernel updates */
+    long memory_gb;
+    int memory_speed;
+
+    /* disk holding the data of the benchmark: name, model and scheduler */
+    char disk[TOPO_LIST];
+
+    /* network interfaces: name, driver and link speed */
+    char nic[TOPO_LIST];
+
+    /* hash of the hardware, the same on every run on the same machine */
+    char fingerprint[17];
+} topology_t;
+
+void topology_read(topology_t *topo, const char *path);
+
+void topology_print(const topology_t *topo);
+
+long topology_llc(const topology_t *topo);
+
+#endif
@@ -0,0 +1,45 @@
+#include <stdlib.h>
+#include <time.h>
+
+#include "util.h"
+
+long now_ns()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long) ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+unsigned long mix64(unsigned long x)
+{
+    x += 0x9E3779B97F4A7C15UL;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9UL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBUL;
+    return x ^ (x >> 31);
+}
+
+long parse_size(const char *str, char **end)
+{
+    long value;
+
+    value = strtol(str, end, 10);
+    switch (**end) {
+        case 'k':
+        case 'K':
+            value *= 1024;
+            (*end)++;
+            break;
+        case 'm':
+        case 'M':
+            value *= 1024 * 1024;
+            (*end)++;
+            break;
+        case 'g':
+        case 'G':
+            value *= 1024L * 1024 * 1024;
+            (*end)++;
+            break;
+    }
+    return value;
+}
@@ -0,0 +1,15 @@
+#ifndef UTIL_H
+#define UTIL_H
+
+/* monotonic clock in nanoseconds */
+long now_ns();
+
+/* splitmix64 finalizer, used to derive seeds and as a hash function */
+unsigned long mix64(unsigned long x);
+
+/* parses sizes such as 512, 8k, 64K, 1m or 2g (binary multiples); end
+ * points past the parsed characters
+ */
+long parse_size(const char *str, char **end);
+
+#endif
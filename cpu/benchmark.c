@@ -2,210 +2,1036 @@
 // Written by David Ghiurco
 //
 
+#define _GNU_SOURCE
+
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <unistd.h>
 #include <pthread.h>
 #include <sys/time.h>
+#include <sys/mman.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#include "monitor.h"
+#include "autotune.h"
+#include "topology.h"
 
 // the length of the vector
-// default, but can be changed by command-line input
+// default, but can be changed by command-line input; without it the
+// vectors are sized from the L2 cache of the host
 long N = 512000; // 51,200
 
+// the host the benchmark runs on, printed with every result
+topology_t topo;
+
 #define NUM_EXPERIMENT_REPEATS 100000
 
+// the repeats of a run; the autotune mode shortens them
+long repeats = NUM_EXPERIMENT_REPEATS;
+
+// the alignment of the vectors and of the thread slices in bytes: a cache
+// line by default, a huge page, or 0 for the unaligned malloc'd vectors
+// split at any element
+#define CACHE_LINE 64
+#define HUGE_PAGE (2 * 1024 * 1024)
+long alignment = CACHE_LINE;
+
+// keeps the compiler from merging the repeats of a kernel whose result
+// does not depend on the previous repeat
+#define KEEP(p) __asm__ volatile("" : : "r"(p) : "memory")
+
+// parameters of a vector thread, for every element type; each one fills
+// its own cache lines, so the result a thread writes doesn't share a line
+// with the parameters of its neighbours
+struct vector_block {
+    void *C;
+    void *B;
+    void *Y;
+    long result;
+    long unit;
+    int tid;
+    int num_threads;
+} __attribute__((aligned(CACHE_LINE)));
+
+// an operation of the benchmark: its storage size, how its vectors are
+// initialized, the thread function running its kernel, the operations per
+// element and, for the functions writing Y = f(C, B), the exact reference
+// the result is checked against
+struct kernel {
+    const char *name;
+    const char *unit;
+    size_t size;
+    int inputs;
+    void (*init)(void *C, long n);
+    void *(*thread)(void *param);
+    int ops;
+    long double (*reference)(double x, double b);
+};
+
+// strong scaling keeps N fixed, weak scaling gives every thread N elements
+#define SCALING_STRONG 0
+#define SCALING_WEAK 1
+
+// the largest number of threads of a sweep
+#define MAX_SWEEP 64
+
+// the alignments searched by the autotune mode
+#define NUM_ALIGNS 3
+const char *align_names[NUM_ALIGNS] = {"none", "line", "huge"};
+const long align_values[NUM_ALIGNS] = {0, CACHE_LINE, HUGE_PAGE};
+
+// default time budget of the autotune mode in seconds
+#define TUNE_BUDGET 60
+
+// the search space of the autotune mode: every thread count of a sweep
+// with every alignment
+struct cpu_tune {
+    const struct kernel *k;
+    long n;
+    int scaling;
+    int threads[MAX_SWEEP];
+    int points;
+};
+
 // prototypes
-long flops(int num_threads);
+double run_point(const struct kernel *k, int num_threads, long n, int scaling);
+
+void print_fits(const int *threads, const double *speedup, int points);
+
+void diagnose_alignment(const struct kernel *k, int num_threads, long n, int scaling);
+
+int sweep_threads(int *threads);
+
+long default_n(const struct kernel *k, int scaling);
+
+void autotune(const struct kernel *k, long n, int scaling, double budget, const char *profile);
+
+int load_profile(const struct kernel *k, const char *profile);
 
-long iops(int num_threads);
+long run_kernel(const struct kernel *k, int num_threads, double *ulp, struct monitor *mon);
+
+void *alloc_vector(size_t bytes);
 
 void *float_matrix_thread(void *param);
 
 void *int_matrix_thread(void *param);
 
-// parameters of the float vector thread
-struct float_vector_block {
-    double *C;
-    int tid;
-    int num_threads;
-};
+/*
+ * Computes the slice [start, end) of the vector processed by a thread; the
+ * vector is split in units of arg->unit elements (the elements of one
+ * aligned cache line or huge page, 1 when unaligned), so that no two
+ * threads write the same line, and the remaining units go one each to the
+ * first threads, so no element is left out
+ */
+static inline void partition(const struct vector_block *arg, long *start, long *end) {
+    long units = (N + arg->unit - 1) / arg->unit;
+    long chunk = units / arg->num_threads;
+    long rest = units % arg->num_threads;
+    long first = arg->tid * chunk + (arg->tid < rest ? arg->tid : rest);
+    long last = first + chunk + (arg->tid < rest ? 1 : 0);
+    *start = first * arg->unit < N ? first * arg->unit : N;
+    *end = last * arg->unit < N ? last * arg->unit : N;
+}
 
-// parameters of the int matrix thread
-struct int_vector_block {
-    int *C;
-    int tid;
-    int num_threads;
+/*
+ * Generates the thread function of the C = C * C + C kernel for one element
+ * type; the arithmetic is done in ctype, so that the narrow unsigned types
+ * wrap around instead of overflowing int
+ */
+#define DEFINE_VECTOR_KERNEL(name, type, ctype) \
+void *name(void *param) { \
+    struct vector_block *arg = param; \
+    type *C = arg->C; \
+    long start, end; \
+    partition(arg, &start, &end); \
+    for (int j = 0; j < repeats; j++) { \
+        for (long i = start; i < end; i++) { \
+            C[i] = (type) ((ctype) C[i] * C[i] + C[i]); \
+        } \
+    } \
+    pthread_exit(0); \
+}
+
+/*
+ * Generates the thread function of the same kernel for a 16-bit floating
+ * point format stored as uint16_t and computed in single precision
+ */
+#define DEFINE_CONVERT_KERNEL(name, to_float, from_float) \
+void *name(void *param) { \
+    struct vector_block *arg = param; \
+    uint16_t *C = arg->C; \
+    long start, end; \
+    partition(arg, &start, &end); \
+    for (int j = 0; j < repeats; j++) { \
+        for (long i = start; i < end; i++) { \
+            float c = to_float(C[i]); \
+            C[i] = from_float(c * c + c); \
+        } \
+    } \
+    pthread_exit(0); \
+}
+
+/*
+ * Generates the initialization of a vector: values in [0, 1) for the
+ * floating point types and rand() + 1 for the integer types
+ */
+#define DEFINE_INIT(name, type, value) \
+void name(void *vec, long n) { \
+    type *C = vec; \
+    for (long i = 0; i < n; i++) { \
+        C[i] = (value); \
+    } \
+}
+
+/*
+ * bfloat16 is the upper half of a float; the conversion from float rounds
+ * to the nearest even value, and both directions are plain integer
+ * operations that the compiler vectorizes
+ */
+static inline float bf16_to_float(uint16_t h) {
+    uint32_t bits = (uint32_t) h << 16;
+    float f;
+    memcpy(&f, &bits, sizeof(f));
+    return f;
+}
+
+static inline uint16_t float_to_bf16(float f) {
+    uint32_t bits;
+    memcpy(&bits, &f, sizeof(bits));
+    return (uint16_t) ((bits + 0x7fff + ((bits >> 16) & 1)) >> 16);
+}
+
+/*
+ * IEEE half precision conversions: with F16C a single instruction, the
+ * portable fallback handles normal, subnormal and infinite values
+ */
+static inline float fp16_to_float(uint16_t h) {
+#ifdef __F16C__
+    return _cvtsh_ss(h);
+#else
+    uint32_t sign = (uint32_t) (h & 0x8000) << 16;
+    uint32_t exp = (h >> 10) & 0x1f;
+    uint32_t man = h & 0x3ff;
+    uint32_t bits;
+    float f;
+
+    if (exp == 0x1f) {
+        bits = sign | 0x7f800000 | (man << 13);
+    } else if (exp == 0) {
+        f = man / 16777216.0f;
+        return sign ? -f : f;
+    } else {
+        bits = sign | ((exp + 112) << 23) | (man << 13);
+    }
+    memcpy(&f, &bits, sizeof(f));
+    return f;
+#endif
+}
+
+static inline uint16_t float_to_fp16(float f) {
+#ifdef __F16C__
+    return _cvtss_sh(f, _MM_FROUND_TO_NEAREST_INT);
+#else
+    uint32_t bits;
+    memcpy(&bits, &f, sizeof(bits));
+    uint16_t sign = (bits >> 16) & 0x8000;
+    int exp = (int) ((bits >> 23) & 0xff) - 112;
+    uint32_t man = bits & 0x7fffff;
+
+    if (exp >= 0x1f) {
+        return sign | 0x7c00 | (((bits >> 23) & 0xff) == 0xff && man ? 0x200 : 0);
+    } else if (exp <= 0) {
+        return sign | (uint16_t) ((f < 0 ? -f : f) * 16777216.0f);
+    }
+    // the rounding carry may move into the exponent, and past it to inf
+    uint32_t h = ((uint32_t) exp << 10) + ((man + 0x1000) >> 13);
+    return sign | (h >= 0x7c00 ? 0x7c00 : h);
+#endif
+}
+
+// the fp64 and int32 kernels are the original flops and iops kernels
+DEFINE_VECTOR_KERNEL(float_matrix_thread, double, double)
+DEFINE_VECTOR_KERNEL(fp32_thread, float, float)
+DEFINE_VECTOR_KERNEL(int16_thread, uint16_t, uint32_t)
+DEFINE_VECTOR_KERNEL(int_matrix_thread, uint32_t, uint32_t)
+DEFINE_VECTOR_KERNEL(int64_thread, uint64_t, uint64_t)
+DEFINE_CONVERT_KERNEL(bf16_thread, bf16_to_float, float_to_bf16)
+
+#ifdef __F16C__
+/*
+ * The fp16 kernel converts whole vectors with F16C (AVX-512 where present)
+ * and finishes the partition with the scalar conversions
+ */
+void *fp16_thread(void *param) {
+    struct vector_block *arg = param;
+    uint16_t *C = arg->C;
+    long start, end;
+    partition(arg, &start, &end);
+
+    for (int j = 0; j < repeats; j++) {
+        long i = start;
+#ifdef __AVX512F__
+        for (; i + 16 <= end; i += 16) {
+            __m512 c = _mm512_cvtph_ps(_mm256_loadu_si256((__m256i *) &C[i]));
+            c = _mm512_add_ps(_mm512_mul_ps(c, c), c);
+            _mm256_storeu_si256((__m256i *) &C[i],
+                    _mm512_cvtps_ph(c, _MM_FROUND_TO_NEAREST_INT));
+        }
+#endif
+        for (; i + 8 <= end; i += 8) {
+            __m256 c = _mm256_cvtph_ps(_mm_loadu_si128((__m128i *) &C[i]));
+            c = _mm256_add_ps(_mm256_mul_ps(c, c), c);
+            _mm_storeu_si128((__m128i *) &C[i],
+                    _mm256_cvtps_ph(c, _MM_FROUND_TO_NEAREST_INT));
+        }
+        for (; i < end; i++) {
+            float c = fp16_to_float(C[i]);
+            C[i] = float_to_fp16(c * c + c);
+        }
+    }
+    pthread_exit(0);
+}
+#else
+DEFINE_CONVERT_KERNEL(fp16_thread, fp16_to_float, float_to_fp16)
+#endif
+
+/*
+ * The int8 kernel is a dot product of an unsigned and a signed int8 vector
+ * accumulated in 32 bits, the operation of quantized inference; with VNNI
+ * every instruction multiplies and adds 4 pairs per 32-bit lane
+ */
+void *int8_thread(void *param) {
+    struct vector_block *arg = param;
+    uint8_t *A = arg->C;
+    int8_t *B = arg->B;
+    long start, end;
+    partition(arg, &start, &end);
+    int32_t acc = 0;
+
+    for (int j = 0; j < repeats; j++) {
+        long i = start;
+        KEEP(A);
+#if defined(__AVX512VNNI__) && defined(__AVX512BW__)
+        __m512i sum = _mm512_setzero_si512();
+        for (; i + 64 <= end; i += 64) {
+            sum = _mm512_dpbusd_epi32(sum,
+                    _mm512_loadu_si512((void *) &A[i]),
+                    _mm512_loadu_si512((void *) &B[i]));
+        }
+        acc += _mm512_reduce_add_epi32(sum);
+#elif defined(__AVXVNNI__)
+        __m256i sum = _mm256_setzero_si256();
+        int32_t lanes[8];
+        for (; i + 32 <= end; i += 32) {
+            sum = _mm256_dpbusd_avx_epi32(sum,
+                    _mm256_loadu_si256((__m256i *) &A[i]),
+                    _mm256_loadu_si256((__m256i *) &B[i]));
+        }
+        _mm256_storeu_si256((__m256i *) lanes, sum);
+        for (int l = 0; l < 8; l++) {
+            acc += lanes[l];
+        }
+#endif
+        for (; i < end; i++) {
+            acc += (int32_t) A[i] * B[i];
+        }
+    }
+    arg->result = acc;
+    pthread_exit(0);
+}
+
+/*
+ * Generates the thread function of Y = f(C, B) for the division and the
+ * transcendental functions; the results do not feed the next repeat, so
+ * every repeat is kept from being merged with the previous one
+ */
+#define DEFINE_MAP_KERNEL(name, f) \
+void *name(void *param) { \
+    struct vector_block *arg = param; \
+    double *X = arg->C; \
+    double *B = arg->B != NULL ? arg->B : arg->C; \
+    double *Y = arg->Y; \
+    long start, end; \
+    partition(arg, &start, &end); \
+    for (int j = 0; j < repeats; j++) { \
+        KEEP(Y); \
+        for (long i = start; i < end; i++) { \
+            Y[i] = f(X[i], B[i]); \
+        } \
+    } \
+    pthread_exit(0); \
+}
+
+static inline uint64_t as_bits(double x) {
+    uint64_t bits;
+    memcpy(&bits, &x, sizeof(bits));
+    return bits;
+}
+
+static inline double as_double(uint64_t bits) {
+    double x;
+    memcpy(&x, &bits, sizeof(x));
+    return x;
+}
+
+// the libm versions: the IEEE division and square root, which the compiler
+// turns into instructions, and the scalar libm calls
+static inline double libm_div(double x, double b) { return x / b; }
+static inline double libm_sqrt(double x, double b) { (void) b; return sqrt(x); }
+static inline double libm_rcp(double x, double b) { (void) b; return 1.0 / x; }
+static inline double libm_exp(double x, double b) { (void) b; return exp(x); }
+static inline double libm_log(double x, double b) { (void) b; return log(x); }
+static inline double libm_sin(double x, double b) { (void) b; return sin(x); }
+
+/*
+ * The polynomial versions are branch-free sequences of multiplies, adds and
+ * bit operations, so the compiler vectorizes them to the widest vector of
+ * the host
+ *
+ * The reciprocal starts from the bit-level estimate of 1 / x and refines it
+ * with 5 Newton-Raphson steps, each doubling the correct bits
+ */
+static inline double recip(double x) {
+    double y = as_double(0x7fde623822fc16e6ULL - as_bits(x));
+    for (int i = 0; i < 5; i++) {
+        y = y * (2.0 - x * y);
+    }
+    return y;
+}
+
+static inline double poly_rcp(double x, double b) {
+    (void) b;
+    return recip(x);
+}
+
+// the quotient is x times the reciprocal, corrected once with the residual
+static inline double poly_div(double x, double b) {
+    double y = recip(b);
+    double q = x * y;
+    return q + y * (x - q * b);
+}
+
+// the square root is x times the refined reciprocal square root, corrected
+// once with Heron's step
+static inline double poly_sqrt(double x, double b) {
+    (void) b;
+    double y = as_double(0x5fe6eb50c7b537a9ULL - (as_bits(x) >> 1));
+    for (int i = 0; i < 4; i++) {
+        y = y * (1.5 - 0.5 * x * y * y);
+    }
+    double s = x * y;
+    return s + 0.5 * y * (x - s * s);
+}
+
+// exp(x) = 2^k * exp(r) with |r| <= ln(2) / 2 and a degree 12 Taylor
+// polynomial of exp(r); the inputs stay in the range of normal doubles
+static inline double poly_exp(double x, double b) {
+    (void) b;
+    const double shift = 0x1.8p52;
+    double kd = x * 0x1.71547652b82fep0 + shift;
+    int64_t k = (int64_t) as_bits(kd) - (int64_t) as_bits(shift);
+    kd -= shift;
+    double r = x - kd * 0x1.62e42fefa3800p-1 - kd * 0x1.ef35793c76730p-45;
+    double p = 1.0 / 479001600;
+    p = p * r + 1.0 / 39916800;
+    p = p * r + 1.0 / 3628800;
+    p = p * r + 1.0 / 362880;
+    p = p * r + 1.0 / 40320;
+    p = p * r + 1.0 / 5040;
+    p = p * r + 1.0 / 720;
+    p = p * r + 1.0 / 120;
+    p = p * r + 1.0 / 24;
+    p = p * r + 1.0 / 6;
+    p = p * r + 0.5;
+    p = p * r + 1.0;
+    p = p * r + 1.0;
+    return p * as_double((uint64_t) (k + 1023) << 52);
+}
+
+// log(x) = e * ln(2) + log(m) with m in [sqrt(2) / 2, sqrt(2)), and
+// log(m) = 2 * atanh(s) with s = (m - 1) / (m + 1) as an odd polynomial
+static inline double poly_log(double x, double b) {
+    (void) b;
+    uint64_t bits = as_bits(x);
+    int64_t e = (int64_t) (bits >> 52) - 1023;
+    double m = as_double((bits & 0x000fffffffffffffULL) | 0x3ff0000000000000ULL);
+    int64_t big = m > 0x1.6a09e667f3bcdp0;
+    m = big ? m * 0.5 : m;
+    e += big;
+    double s = (m - 1.0) / (m + 1.0);
+    double s2 = s * s;
+    double p = 2.0 / 21;
+    p = p * s2 + 2.0 / 19;
+    p = p * s2 + 2.0 / 17;
+    p = p * s2 + 2.0 / 15;
+    p = p * s2 + 2.0 / 13;
+    p = p * s2 + 2.0 / 11;
+    p = p * s2 + 2.0 / 9;
+    p = p * s2 + 2.0 / 7;
+    p = p * s2 + 2.0 / 5;
+    p = p * s2 + 2.0 / 3;
+    p = p * s2 + 2.0;
+    double ed = (double) e;
+    return ed * 0x1.62e42fefa3800p-1 + (s * p + ed * 0x1.ef35793c76730p-45);
+}
+
+// sin(x) = (-1)^k * sin(r) with x = k * pi + r, |r| <= pi / 2, and the
+// Taylor polynomial of sin(r) up to r^23
+static inline double poly_sin(double x, double b) {
+    (void) b;
+    const double shift = 0x1.8p52;
+    double kd = x * 0x1.45f306dc9c883p-2 + shift;
+    int64_t k = (int64_t) as_bits(kd) - (int64_t) as_bits(shift);
+    kd -= shift;
+    double r = x - kd * 0x1.921fb54442d18p1 - kd * 0x1.1a62633145c07p-53;
+    double r2 = r * r;
+    double p = -1.0 / 25852016738884976640000.0;
+    p = p * r2 + 1.0 / 51090942171709440000.0;
+    p = p * r2 - 1.0 / 121645100408832000.0;
+    p = p * r2 + 1.0 / 355687428096000.0;
+    p = p * r2 - 1.0 / 1307674368000.0;
+    p = p * r2 + 1.0 / 6227020800.0;
+    p = p * r2 - 1.0 / 39916800.0;
+    p = p * r2 + 1.0 / 362880.0;
+    p = p * r2 - 1.0 / 5040.0;
+    p = p * r2 + 1.0 / 120.0;
+    p = p * r2 - 1.0 / 6.0;
+    p = p * r2 + 1.0;
+    return (double) (1 - 2 * (k & 1)) * (r * p);
+}
+
+// the references, in extended precision
+long double ref_div(double x, double b) { return (long double) x / b; }
+long double ref_sqrt(double x, double b) { (void) b; return sqrtl(x); }
+long double ref_rcp(double x, double b) { (void) b; return 1.0L / x; }
+long double ref_exp(double x, double b) { (void) b; return expl(x); }
+long double ref_log(double x, double b) { (void) b; return logl(x); }
+long double ref_sin(double x, double b) { (void) b; return sinl(x); }
+
+DEFINE_MAP_KERNEL(div_thread, libm_div)
+DEFINE_MAP_KERNEL(sqrt_thread, libm_sqrt)
+DEFINE_MAP_KERNEL(rcp_thread, libm_rcp)
+DEFINE_MAP_KERNEL(exp_thread, libm_exp)
+DEFINE_MAP_KERNEL(log_thread, libm_log)
+DEFINE_MAP_KERNEL(sin_thread, libm_sin)
+DEFINE_MAP_KERNEL(div_poly_thread, poly_div)
+DEFINE_MAP_KERNEL(sqrt_poly_thread, poly_sqrt)
+DEFINE_MAP_KERNEL(rcp_poly_thread, poly_rcp)
+DEFINE_MAP_KERNEL(exp_poly_thread, poly_exp)
+DEFINE_MAP_KERNEL(log_poly_thread, poly_log)
+DEFINE_MAP_KERNEL(sin_poly_thread, poly_sin)
+
+/*
+ * Returns the distance between a result and the exact value in units in
+ * the last place of the exact value rounded to double
+ */
+double ulp_error(double y, long double exact) {
+    double r = fabs((double) exact);
+    double ulp = nextafter(r, INFINITY) - r;
+    return (double) (fabsl((long double) y - exact) / ulp);
+}
+
+static inline double uniform(double lo, double hi) {
+    return lo + (hi - lo) * ((double) rand() / (double) RAND_MAX);
+}
+
+DEFINE_INIT(init_fp64, double, ((double) rand()) / ((double) RAND_MAX))
+DEFINE_INIT(init_fp32, float, ((float) rand()) / ((float) RAND_MAX))
+DEFINE_INIT(init_fp16, uint16_t,
+        float_to_fp16(((float) rand()) / ((float) RAND_MAX)))
+DEFINE_INIT(init_bf16, uint16_t,
+        float_to_bf16(((float) rand()) / ((float) RAND_MAX)))
+DEFINE_INIT(init_int8, uint8_t, rand() + 1)
+DEFINE_INIT(init_int16, uint16_t, rand() + 1)
+DEFINE_INIT(init_int32, uint32_t, rand() + 1)
+DEFINE_INIT(init_int64, uint64_t, rand() + 1)
+
+// the input domains of the functions
+DEFINE_INIT(init_div, double, uniform(1.0, 1000.0))
+DEFINE_INIT(init_sqrt, double, uniform(0.0, 1000.0))
+DEFINE_INIT(init_exp, double, uniform(-10.0, 10.0))
+DEFINE_INIT(init_log, double, uniform(1e-3, 1000.0))
+DEFINE_INIT(init_sin, double, uniform(-10.0, 10.0))
+
+// the operations of the benchmark; flops and iops keep their original names
+static const struct kernel kernels[] = {
+    {"flops", "GFlops", sizeof(double), 1, init_fp64, float_matrix_thread, 2, NULL},
+    {"iops", "GIops", sizeof(uint32_t), 1, init_int32, int_matrix_thread, 2, NULL},
+    {"fp64", "GFlops", sizeof(double), 1, init_fp64, float_matrix_thread, 2, NULL},
+    {"fp32", "GFlops", sizeof(float), 1, init_fp32, fp32_thread, 2, NULL},
+    {"fp16", "GFlops", sizeof(uint16_t), 1, init_fp16, fp16_thread, 2, NULL},
+    {"bf16", "GFlops", sizeof(uint16_t), 1, init_bf16, bf16_thread, 2, NULL},
+    {"int8", "GIops", sizeof(uint8_t), 2, init_int8, int8_thread, 2, NULL},
+    {"int16", "GIops", sizeof(uint16_t), 1, init_int16, int16_thread, 2, NULL},
+    {"int32", "GIops", sizeof(uint32_t), 1, init_int32, int_matrix_thread, 2, NULL},
+    {"int64", "GIops", sizeof(uint64_t), 1, init_int64, int64_thread, 2, NULL},
+    {"div", "GOps", sizeof(double), 2, init_div, div_thread, 1, ref_div},
+    {"sqrt", "GOps", sizeof(double), 1, init_sqrt, sqrt_thread, 1, ref_sqrt},
+    {"rcp", "GOps", sizeof(double), 1, init_div, rcp_thread, 1, ref_rcp},
+    {"exp", "GOps", sizeof(double), 1, init_exp, exp_thread, 1, ref_exp},
+    {"log", "GOps", sizeof(double), 1, init_log, log_thread, 1, ref_log},
+    {"sin", "GOps", sizeof(double), 1, init_sin, sin_thread, 1, ref_sin},
+    {"div-poly", "GOps", sizeof(double), 2, init_div, div_poly_thread, 1, ref_div},
+    {"sqrt-poly", "GOps", sizeof(double), 1, init_sqrt, sqrt_poly_thread, 1, ref_sqrt},
+    {"rcp-poly", "GOps", sizeof(double), 1, init_div, rcp_poly_thread, 1, ref_rcp},
+    {"exp-poly", "GOps", sizeof(double), 1, init_exp, exp_poly_thread, 1, ref_exp},
+    {"log-poly", "GOps", sizeof(double), 1, init_log, log_poly_thread, 1, ref_log},
+    {"sin-poly", "GOps", sizeof(double), 1, init_sin, sin_poly_thread, 1, ref_sin},
 };
 
+#define NUM_KERNELS (sizeof(kernels) / sizeof(kernels[0]))
+
 /*
  * This benchmark performs modified vector multiplication
  */
 int main(int argc, char *argv[]) {
     /*
      * Usage:
-     * $ benchmark <type> <num_threads> <N>
-     * type: 'flops' or 'iops'
-     * num_threads: 1, 2, 4, 8
+     * $ benchmark <type> [num_threads] [N] [--scaling=strong|weak]
+     *             [--align=none|line|huge] [--align-diagnostics]
+     *             [--budget=<sec>] [--profile=<file>]
+     * type: 'flops' or 'iops', or one of the element types
+     *       fp64, fp32, fp16, bf16, int8, int16, int32, int64,
+     *       or one of the functions div, sqrt, rcp, exp, log, sin
+     *       (libm) and div-poly, sqrt-poly, ... (polynomial)
+     * num_threads: 1, 2, 4, 8 (default: all hardware threads),
+     *              or 'all' to sweep 1, 2, 4, ... up to all
+     *              hardware threads, or 'autotune' to search the threads
+     *              and alignment with the best throughput within --budget
+     *              seconds (default 60) and store them in the host profile,
+     *              or 'profile' to run with the stored configuration
+     * N: the vector length; by default half the L2 cache of every core the
+     *    threads run on
+     * --scaling: strong (default) splits the N elements between the
+     *            threads, weak gives N elements to every thread
+     * --align: aligns the vectors and the thread slices to a cache line
+     *          (default) or a 2 MB huge page; none splits malloc'd vectors
+     *          at any element
+     * --align-diagnostics: runs unaligned, then aligned, and compares
      */
 
-    if (argc != 3 && argc != 4) {
-        printf("Error: 2 parameters required");
+    if (argc < 2) {
+        printf("Error: at least 1 parameter required");
         exit(1);
     }
 
+    topology_read(&topo, NULL);
+    topology_print(&topo);
+
     // Seed the random number generator for deterministic-ish results
     srand(50);
 
     // if N was provided as commandline parameter, use that instead of the top-level defined N dimension
-    if (argv[3] != NULL) {
-        N = atoi(argv[3]);
+    long n = 0;
+    int scaling = SCALING_STRONG;
+    int diagnostics = 0;
+    double budget = TUNE_BUDGET;
+    const char *profile = NULL;
+    for (int i = 3; i < argc; i++) {
+        if (strcmp(argv[i], "--scaling=strong") == 0) {
+            scaling = SCALING_STRONG;
+        } else if (strcmp(argv[i], "--scaling=weak") == 0) {
+            scaling = SCALING_WEAK;
+        } else if (strcmp(argv[i], "--align=none") == 0) {
+            alignment = 0;
+        } else if (strcmp(argv[i], "--align=line") == 0) {
+            alignment = CACHE_LINE;
+        } else if (strcmp(argv[i], "--align=huge") == 0) {
+            alignment = HUGE_PAGE;
+        } else if (strcmp(argv[i], "--align-diagnostics") == 0) {
+            diagnostics = 1;
+        } else if (strncmp(argv[i], "--budget=", 9) == 0) {
+            budget = atof(argv[i] + 9);
+        } else if (strncmp(argv[i], "--profile=", 10) == 0) {
+            profile = argv[i] + 10;
+        } else if (i == 3 && strncmp(argv[i], "--", 2) != 0) {
+            n = atol(argv[i]);
+        } else {
+            printf("Usage error: unknown option %s\n", argv[i]);
+            exit(1);
+        }
+    }
+
+    const struct kernel *k = NULL;
+    for (size_t i = 0; i < NUM_KERNELS; i++) {
+        if (strcmp(argv[1], kernels[i].name) == 0) {
+            k = &kernels[i];
+        }
+    }
+    if (k == NULL) {
+        printf("Usage error\n");
+        exit(1);
+    }
+
+    if (n <= 0) {
+        n = default_n(k, scaling);
+    }
+
+    const char *mode = argc > 2 ? argv[2] : "default";
+    profile = profile_path(profile);
+    if (strcmp(mode, "autotune") == 0) {
+        autotune(k, n, scaling, budget, profile);
+        return 0;
     }
 
-    // each thread makes 2 operations over each element of the N-vector, NUM_EXPERIMENT_REPEATS times
-    long NUM_OPS = 2 * N * NUM_EXPERIMENT_REPEATS;
+    int num_threads = topo.threads;
+    if (strcmp(mode, "profile") == 0) {
+        num_threads = load_profile(k, profile);
+    } else if (argc > 2) {
+        num_threads = atoi(argv[2]);
+    }
 
-    int num_threads = atoi(argv[2]);
+    if (diagnostics) {
+        if (strcmp(mode, "all") == 0) {
+            printf("Usage error: --align-diagnostics needs a number of threads\n");
+            exit(1);
+        }
+        diagnose_alignment(k, num_threads, n, scaling);
+        return 0;
+    }
 
-    // stores the total runtime for each experiment iteration in microseconds
-    long aggregate_runtime_us = 0;
+    if (strcmp(mode, "all") != 0) {
+        run_point(k, num_threads, n, scaling);
+        return 0;
+    }
 
-    if (strcmp(argv[1], "flops") == 0) {
-        aggregate_runtime_us += flops(num_threads);
+    int threads[MAX_SWEEP];
+    double speedup[MAX_SWEEP];
+    double runtime_1 = 0;
+    int points = sweep_threads(threads);
 
-        // Convert microseconds to seconds
-        double aggregate_runtime_s = (double) aggregate_runtime_us / 1000000;
-        double gflops = (double) NUM_OPS / aggregate_runtime_s / 1000000000;
-        printf("GFlops: %lf\n", gflops);
+    for (int p = 0; p < points; p++) {
+        printf("Threads: %d\n", threads[p]);
+        double runtime = run_point(k, threads[p], n, scaling);
+        if (p == 0) {
+            runtime_1 = runtime;
+        }
 
-    } else if (strcmp(argv[1], "iops") == 0) {
-        aggregate_runtime_us += iops(num_threads);
+        // strong scaling speeds up the same work, weak scaling does p times the work in the same time
+        speedup[p] = runtime_1 / runtime;
+        if (scaling == SCALING_WEAK) {
+            speedup[p] *= threads[p];
+        }
+        printf("Speedup: %.3lf\n", speedup[p]);
+        printf("Parallel efficiency: %.3lf\n", speedup[p] / threads[p]);
+    }
+    print_fits(threads, speedup, points);
+}
 
-        // Convert microseconds to seconds
-        double aggregate_runtime_s = (double) aggregate_runtime_us / 1000000;
-        double giops = (double) NUM_OPS / aggregate_runtime_s / 1000000000;
-        printf("GIops: %f\n", giops);
-    } else {
-        printf("Usage error\n");
+/*
+ * Runs the kernel once with num_threads threads over n elements (n per
+ * thread with weak scaling) and prints its throughput
+ *
+ * Returns the runtime in seconds
+ */
+double run_point(const struct kernel *k, int num_threads, long n, int scaling) {
+    if (num_threads <= 0) {
+        printf("Usage error: the number of threads must be positive\n");
         exit(1);
     }
+    N = scaling == SCALING_WEAK ? n * num_threads : n;
+
+    // each thread makes 2 operations (1 for the functions) over each element of the N-vector, NUM_EXPERIMENT_REPEATS times
+    long NUM_OPS = k->ops * N * repeats;
 
+    double ulp[2];
+    struct monitor mon;
+    long aggregate_runtime_us = run_kernel(k, num_threads, ulp, &mon);
+
+    // Convert microseconds to seconds
+    double aggregate_runtime_s = (double) aggregate_runtime_us / 1000000;
+    double gops = (double) NUM_OPS / aggregate_runtime_s / 1000000000;
+    printf("%s: %lf\n", k->unit, gops);
+    if (k->reference != NULL) {
+        printf("Max ULP error: %.2lf\n", ulp[0]);
+        printf("Mean ULP error: %.3lf\n", ulp[1]);
+    }
+    monitor_print(&mon, gops, k->unit);
+    return aggregate_runtime_s;
 }
 
 /*
- * Allocates needed resources for the vector multiplication problem (a vector of doubles),
- * spawns the specified number of threads
- * and waits for them to complete
+ * Fills threads with the powers of two up to the hardware threads, and the
+ * hardware threads
  *
- * Returns the runtime in microseconds
+ * Returns the number of thread counts
  */
-long flops(int num_threads) {
-    double *C;
-    C = malloc(N * sizeof(double));
+int sweep_threads(int *threads) {
+    int hw_threads = topo.threads;
+    int points = 0;
+    for (int t = 1; points < MAX_SWEEP; t *= 2) {
+        threads[points++] = t < hw_threads ? t : hw_threads;
+        if (t >= hw_threads) {
+            break;
+        }
+    }
+    return points;
+}
 
-    // initialize the vector with double-precision floats
-    for (int i = 0; i < N; i++) {
-        C[i] = ((double) rand()) / ((double) RAND_MAX);
+/*
+ * Sizes the vectors of the kernel to half the L2 cache of every core, all
+ * of them with strong scaling and one per thread with weak scaling, so the
+ * kernels run from the cache; falls back to N when the cache is unknown
+ *
+ * Returns the number of elements
+ */
+long default_n(const struct kernel *k, int scaling) {
+    if (topo.l2 <= 0) {
+        return N;
     }
+    long vectors = k->inputs + (k->reference != NULL ? 1 : 0);
+    long per_core = topo.l2 / 2 / (vectors * (long) k->size);
+    per_core -= per_core % (CACHE_LINE / (long) k->size > 0 ? CACHE_LINE / (long) k->size : 1);
+    return scaling == SCALING_WEAK ? per_core : per_core * topo.cores;
+}
 
-    // build the parameter data structure for each thread and start the threads
-    pthread_t thread[num_threads];
-    struct float_vector_block args[num_threads];
+/*
+ * Runs configuration config of the autotune search with the given repeats
+ *
+ * Returns the throughput in G(Fl/I)ops
+ */
+double tune_eval(int config, long resource, void *ctx) {
+    struct cpu_tune *space = ctx;
+    int num_threads = space->threads[config / NUM_ALIGNS];
+    double ulp[2];
+    struct monitor mon;
 
-    struct timeval start;
-    struct timeval end;
-    gettimeofday(&start, NULL);
-    for (int num = 0; num < num_threads; num++) {
-        args[num].C = C;
-        args[num].tid = num;
-        args[num].num_threads = num_threads;
+    alignment = align_values[config % NUM_ALIGNS];
+    repeats = resource;
+    N = space->scaling == SCALING_WEAK ? space->n * num_threads : space->n;
+    long runtime_us = run_kernel(space->k, num_threads, ulp, &mon);
+    if (runtime_us <= 0) {
+        runtime_us = 1;
+    }
+    return (double) space->k->ops * N * repeats / runtime_us / 1000;
+}
 
-        pthread_attr_t attr;
-        pthread_attr_init(&attr);
-        pthread_create(&(thread[num]), &attr, float_matrix_thread, &args[num]);
+void tune_describe(int config, char *buf, int len, void *ctx) {
+    struct cpu_tune *space = ctx;
+    snprintf(buf, len, "threads=%d align=%s", space->threads[config / NUM_ALIGNS], align_names[config % NUM_ALIGNS]);
+}
+
+/*
+ * Searches the thread count and alignment with the best throughput by
+ * successive halving over the repeats, within budget seconds, and stores
+ * the best configuration in the host profile as cpu.<type>.threads and
+ * cpu.<type>.align
+ */
+void autotune(const struct kernel *k, long n, int scaling, double budget, const char *profile) {
+    struct cpu_tune space = {.k = k, .n = n, .scaling = scaling};
+    space.points = sweep_threads(space.threads);
+    int configs = space.points * NUM_ALIGNS;
+
+    // the first round takes about a quarter of the budget, measured on the kernel-only runtime of one
+    // thread, without the allocation and initialization of the vectors, doubling the repeats until it
+    // takes at least 10 ms
+    double ulp[2];
+    struct monitor mon;
+    alignment = align_values[1];
+    N = space.n;
+    long runtime_us;
+    for (repeats = 100; ; repeats *= 2) {
+        runtime_us = run_kernel(k, 1, ulp, &mon);
+        if (runtime_us >= 10000 || repeats >= NUM_EXPERIMENT_REPEATS) {
+            break;
+        }
     }
-    for (int num = 0; num < num_threads; num++) {
-        pthread_join(thread[num], NULL);;
+    double repeat_s = (double) runtime_us / 1e6 / repeats;
+    long first = (long) (budget / 4 / configs / (repeat_s > 0 ? repeat_s : 1e-9));
+    first = first < 1 ? 1 : first > NUM_EXPERIMENT_REPEATS ? NUM_EXPERIMENT_REPEATS : first;
+
+    tuner_t tuner = {configs, first, "repeats", budget, tune_eval, tune_describe, &space};
+    double best_gops;
+    int best = tune(&tuner, &best_gops);
+
+    char threads[16], align[16], gops[32], prefix[64];
+    snprintf(threads, sizeof(threads), "%d", space.threads[best / NUM_ALIGNS]);
+    snprintf(align, sizeof(align), "%s", align_names[best % NUM_ALIGNS]);
+    snprintf(gops, sizeof(gops), "%lf", best_gops);
+    snprintf(prefix, sizeof(prefix), "cpu.%s.", k->name);
+    const char *keys[] = {"threads", "align", "throughput"};
+    const char *values[] = {threads, align, gops};
+
+    printf("Best configuration: threads=%s align=%s\n", threads, align);
+    printf("%s: %lf\n", k->unit, best_gops);
+    if (profile_store(profile, prefix, keys, values, 3) == 0) {
+        printf("Stored in %s\n", profile);
     }
-    gettimeofday(&end, NULL);
+}
 
-    free(C);
+/*
+ * Sets the alignment stored for the operation in the host profile
+ *
+ * Returns the stored number of threads
+ */
+int load_profile(const struct kernel *k, const char *profile) {
+    char key[64], value[PROFILE_LINE];
 
-    return ((long) (end.tv_sec - start.tv_sec) * 1000000 + (long) (end.tv_usec - start.tv_usec));
+    snprintf(key, sizeof(key), "cpu.%s.align", k->name);
+    if (profile_load(profile, key, value, sizeof(value)) == 0) {
+        for (int i = 0; i < NUM_ALIGNS; i++) {
+            if (strcmp(value, align_names[i]) == 0) {
+                alignment = align_values[i];
+            }
+        }
+    }
+    snprintf(key, sizeof(key), "cpu.%s.threads", k->name);
+    if (profile_load(profile, key, value, sizeof(value)) < 0) {
+        printf("Error: no configuration of %s in %s, run autotune first\n", k->name, profile);
+        exit(1);
+    }
+    printf("Profile: threads=%s align=%s\n", value, alignment == 0 ? "none" : alignment == HUGE_PAGE ? "huge" : "line");
+    return atoi(value);
+}
+
+/*
+ * Runs the kernel with unaligned vectors and slices, the layout before
+ * the slices were aligned, then with the requested alignment (a cache line
+ * if none was requested), and prints the speedup of the aligned layout
+ */
+void diagnose_alignment(const struct kernel *k, int num_threads, long n, int scaling) {
+    long aligned = alignment != 0 ? alignment : CACHE_LINE;
+
+    alignment = 0;
+    printf("Alignment: none\n");
+    double unaligned_s = run_point(k, num_threads, n, scaling);
+
+    alignment = aligned;
+    printf("Alignment: %s\n", aligned == HUGE_PAGE ? "huge" : "line");
+    double aligned_s = run_point(k, num_threads, n, scaling);
+
+    printf("Aligned speedup over unaligned: %.3lf\n", unaligned_s / aligned_s);
+}
 
+/*
+ * Fits the serial fraction s of the sweep by least squares:
+ * Amdahl's law for a fixed problem, S(p) = 1 / (s + (1 - s) / p), is linear
+ * in x = 1 / p as 1 / S - x = s (1 - x); Gustafson's law for a scaled
+ * problem, S(p) = p - s (p - 1), is linear as p - S = s (p - 1)
+ */
+void print_fits(const int *threads, const double *speedup, int points) {
+    double amdahl_num = 0, amdahl_den = 0, gustafson_num = 0, gustafson_den = 0;
+
+    for (int p = 0; p < points; p++) {
+        double x = 1.0 / threads[p];
+        amdahl_num += (1 - x) * (1 / speedup[p] - x);
+        amdahl_den += (1 - x) * (1 - x);
+        gustafson_num += (threads[p] - 1) * (threads[p] - speedup[p]);
+        gustafson_den += (double) (threads[p] - 1) * (threads[p] - 1);
+    }
+    if (amdahl_den == 0) {
+        printf("Amdahl and Gustafson fits: need more than 1 thread\n");
+        return;
+    }
+
+    double amdahl = amdahl_num / amdahl_den;
+    double gustafson = gustafson_num / gustafson_den;
+    printf("Amdahl serial fraction: %.4lf\n", amdahl);
+    if (amdahl > 0) {
+        printf("Amdahl maximum speedup: %.1lf\n", 1 / amdahl);
+    }
+    printf("Gustafson serial fraction: %.4lf\n", gustafson);
 }
 
 /*
- * Allocates needed resources for the vector multiplication problem (a vector of integers),
+ * Allocates needed resources for the vector multiplication problem (one
+ * vector of the element type of the kernel, two for the dot product and the
+ * division, plus the result vector of the functions),
  * spawns the specified number of threads
  * and waits for them to complete
  *
+ * For the functions, stores the maximum and mean ULP error in ulp[0] and
+ * ulp[1]; the clocks and the temperature of the run are kept in mon
+ *
  * Returns the runtime in microseconds
  */
-long iops(int num_threads) {
-    int *C;
-    C = malloc(N * sizeof(int));
-
-    for (int i = 0; i < N; i++) {
-        C[i] = rand() + 1;
+long run_kernel(const struct kernel *k, int num_threads, double *ulp, struct monitor *mon) {
+    void *C, *B = NULL, *Y = NULL;
+    C = alloc_vector(N * k->size);
+    k->init(C, N);
+    if (k->inputs == 2) {
+        B = alloc_vector(N * k->size);
+        k->init(B, N);
+    }
+    if (k->reference != NULL) {
+        Y = alloc_vector(N * k->size);
+        memset(Y, 0, N * k->size);
     }
+    long unit = alignment > (long) k->size ? alignment / (long) k->size : 1;
 
+    // build the parameter data structure for each thread and start the threads
     pthread_t thread[num_threads];
-    struct int_vector_block args[num_threads];
-
+    struct vector_block args[num_threads];
 
     struct timeval start;
     struct timeval end;
+    monitor_start(mon);
     gettimeofday(&start, NULL);
     for (int num = 0; num < num_threads; num++) {
         args[num].C = C;
+        args[num].B = B;
+        args[num].Y = Y;
+        args[num].unit = unit;
         args[num].tid = num;
         args[num].num_threads = num_threads;
 
         pthread_attr_t attr;
         pthread_attr_init(&attr);
-        pthread_create(&(thread[num]), &attr, int_matrix_thread, &args[num]);
+        pthread_create(&(thread[num]), &attr, k->thread, &args[num]);
     }
     for (int num = 0; num < num_threads; num++) {
         pthread_join(thread[num], NULL);;
     }
     gettimeofday(&end, NULL);
+    monitor_stop(mon);
+
+    // compare the elements the threads computed against the exact values
+    if (k->reference != NULL) {
+        double *X = C, *D = B != NULL ? B : C, *R = Y;
+        ulp[0] = 0;
+        ulp[1] = 0;
+        for (long i = 0; i < N; i++) {
+            double err = ulp_error(R[i], k->reference(X[i], D[i]));
+            ulp[0] = err > ulp[0] ? err : ulp[0];
+            ulp[1] += err;
+        }
+        ulp[1] /= N > 0 ? N : 1;
+    }
 
     free(C);
+    free(B);
+    free(Y);
 
     // calculate the elapsed time in microseconds and return
     return ((long) (end.tv_sec - start.tv_sec) * 1000000 + (long) (end.tv_usec - start.tv_usec));
 }
 
 /*
- * The thread function for floating point operations
- * For each pass of the loop, 2 floating point operations are performed on the vector
+ * Allocates a vector aligned to the alignment of the run; huge pages are
+ * requested from the kernel with madvise, which needs transparent huge
+ * pages in 'madvise' or 'always' mode
  */
-void *float_matrix_thread(void *param) {
-    struct float_vector_block *arg = param; // the structure that holds the parameters of the thread
-    long thread_partition = N / (long) arg->num_threads;
-
-    for (int j = 0; j < NUM_EXPERIMENT_REPEATS; j++) {
-        for (long i = (arg->tid) * thread_partition; i < thread_partition * (arg->tid + 1); i++) {
-            arg->C[i] = arg->C[i] * arg->C[i] + arg->C[i];
+void *alloc_vector(size_t bytes) {
+    void *vec;
+    if (alignment == 0) {
+        vec = malloc(bytes);
+    } else {
+        size_t rounded = (bytes + alignment - 1) / alignment * alignment;
+        if (posix_memalign(&vec, alignment, rounded) != 0) {
+            vec = NULL;
         }
-    }
-    pthread_exit(0);
-}
-
-
-/*
- * The thread function for integer operations
- * For each pass of the loop, 2 floating point operationsare performed on the vector
- */
-void *int_matrix_thread(void *param) {
-    struct int_vector_block *arg = param; // the structure that holds the parameters of the thread
-    long thread_partition = N / (long) arg->num_threads;
-
-    long next_block = thread_partition * (arg->tid + 1);
-    for (int j = 0; j < NUM_EXPERIMENT_REPEATS; j++) {
-        for (long i = (arg->tid) * thread_partition; i < next_block; i++) {
-            arg->C[i] = arg->C[i] * arg->C[i] + arg->C[i];
+        if (vec != NULL && alignment == HUGE_PAGE) {
+            madvise(vec, rounded, MADV_HUGEPAGE);
         }
     }
-    pthread_exit(0);
-}
\ No newline at end of file
+    if (vec == NULL) {
+        printf("Out of memory!\n");
+        exit(1);
+    }
+    return vec;
+}
@@ -0,0 +1,303 @@
+//
+// Frequency and thermal monitoring of the timed region of the benchmark
+//
+// The effective frequency comes, in order of preference, from the perf
+// cycles and task-clock counters of the process, from the APERF / MPERF
+// registers of every CPU (which need the msr module and root), or from the
+// clocks cpufreq reports during the run. The package temperature is sampled
+// from sysfs every MONITOR_INTERVAL_US.
+//
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+
+#include "monitor.h"
+
+#define MSR_MPERF 0xe7
+#define MSR_APERF 0xe8
+
+// the sysfs file of the package temperature, found once
+static char temp_path[128];
+
+/*
+ * Reads the first number of a sysfs or procfs file
+ *
+ * Returns -1 if the file can't be read
+ */
+static long read_long(const char *path) {
+    FILE *f = fopen(path, "r");
+    long value = -1;
+
+    if (f == NULL) {
+        return -1;
+    }
+    if (fscanf(f, "%ld", &value) != 1) {
+        value = -1;
+    }
+    fclose(f);
+    return value;
+}
+
+/*
+ * Finds the package temperature: the x86_pkg_temp thermal zone, the first
+ * sensor of coretemp or k10temp, or the first thermal zone
+ */
+static void find_temp_path(void) {
+    char path[128], type[32];
+
+    for (int i = 0; i < 64; i++) {
+        snprintf(path, sizeof(path), "/sys/class/thermal/thermal_zone%d/type", i);
+        FILE *f = fopen(path, "r");
+        if (f == NULL) {
+            break;
+        }
+        if (fscanf(f, "%31s", type) == 1 && strcmp(type, "x86_pkg_temp") == 0) {
+            snprintf(temp_path, sizeof(temp_path), "/sys/class/thermal/thermal_zone%d/temp", i);
+            fclose(f);
+            return;
+        }
+        fclose(f);
+    }
+    for (int i = 0; i < 64; i++) {
+        snprintf(path, sizeof(path), "/sys/class/hwmon/hwmon%d/name", i);
+        FILE *f = fopen(path, "r");
+        if (f == NULL) {
+            break;
+        }
+        if (fscanf(f, "%31s", type) == 1 && (strcmp(type, "coretemp") == 0 || strcmp(type, "k10temp") == 0)) {
+            snprintf(temp_path, sizeof(temp_path), "/sys/class/hwmon/hwmon%d/temp1_input", i);
+            fclose(f);
+            return;
+        }
+        fclose(f);
+    }
+    if (read_long("/sys/class/thermal/thermal_zone0/temp") >= 0) {
+        snprintf(temp_path, sizeof(temp_path), "/sys/class/thermal/thermal_zone0/temp");
+    }
+}
+
+/*
+ * Opens a counter of the calling process and the threads it creates from
+ * now on; the counter runs from the moment it's opened
+ *
+ * Returns -1 if the kernel or the hypervisor doesn't provide it
+ */
+static int perf_open(int type, long config) {
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.inherit = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return (int) syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static long perf_read(int fd) {
+    long long value;
+
+    if (fd < 0 || read(fd, &value, sizeof(value)) != sizeof(value)) {
+        return -1;
+    }
+    return (long) value;
+}
+
+/*
+ * Reads APERF and MPERF of every CPU; returns -1 if any can't be read
+ */
+static int read_aperf_mperf(int num_cpus, unsigned long long *aperf, unsigned long long *mperf) {
+    char path[64];
+
+    for (int cpu = 0; cpu < num_cpus; cpu++) {
+        snprintf(path, sizeof(path), "/dev/cpu/%d/msr", cpu);
+        int fd = open(path, O_RDONLY);
+        if (fd < 0) {
+            return -1;
+        }
+        int ok = pread(fd, &aperf[cpu], 8, MSR_APERF) == 8 && pread(fd, &mperf[cpu], 8, MSR_MPERF) == 8;
+        close(fd);
+        if (!ok) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Returns the mean clock cpufreq reports over all CPUs in GHz, or -1
+ */
+static double sample_cpufreq(int num_cpus) {
+    char path[96];
+    double sum = 0;
+    int count = 0;
+
+    for (int cpu = 0; cpu < num_cpus; cpu++) {
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cpufreq/scaling_cur_freq", cpu);
+        long khz = read_long(path);
+        if (khz > 0) {
+            sum += khz / 1e6;
+            count++;
+        }
+    }
+    return count > 0 ? sum / count : -1;
+}
+
+/*
+ * The sampling thread: reads the package temperature and the cpufreq
+ * clocks until the timed region ends
+ */
+static void *sampler_thread(void *param) {
+    struct monitor *m = param;
+
+    while (m->running) {
+        if (temp_path[0] != '\0') {
+            long millideg = read_long(temp_path);
+            if (millideg >= 0) {
+                double deg = millideg / 1000.0;
+                m->temp_sum += deg;
+                m->temp_max = deg > m->temp_max ? deg : m->temp_max;
+                m->temp_samples++;
+            }
+        }
+        double ghz = sample_cpufreq(m->num_cpus);
+        if (ghz > 0) {
+            m->freq_sum += ghz;
+            m->freq_samples++;
+        }
+        usleep(MONITOR_INTERVAL_US);
+    }
+    return NULL;
+}
+
+/*
+ * Starts the counters and the sampling thread; call right before the
+ * threads of the benchmark are created
+ */
+void monitor_start(struct monitor *m) {
+    memset(m, 0, sizeof(*m));
+    m->num_cpus = (int) sysconf(_SC_NPROCESSORS_CONF);
+    m->throttle_count = read_long("/sys/devices/system/cpu/cpu0/thermal_throttle/package_throttle_count");
+
+    if (temp_path[0] == '\0') {
+        find_temp_path();
+    }
+
+    m->fd_cycles = perf_open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+    m->fd_ref_cycles = perf_open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_REF_CPU_CYCLES);
+    m->fd_task_clock = perf_open(PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK);
+
+    if (m->fd_cycles < 0 || m->fd_task_clock < 0) {
+        m->aperf = malloc(2 * m->num_cpus * sizeof(unsigned long long));
+        m->mperf = malloc(2 * m->num_cpus * sizeof(unsigned long long));
+        if (read_aperf_mperf(m->num_cpus, m->aperf, m->mperf) < 0) {
+            free(m->aperf);
+            free(m->mperf);
+            m->aperf = NULL;
+            m->mperf = NULL;
+        }
+    }
+
+    m->running = 1;
+    m->sampling = pthread_create(&m->sampler, NULL, sampler_thread, m) == 0;
+}
+
+/*
+ * Stops the counters and the sampling thread and computes the effective
+ * frequency; call right after the threads of the benchmark are joined
+ */
+void monitor_stop(struct monitor *m) {
+    long cycles = perf_read(m->fd_cycles);
+    long ref_cycles = perf_read(m->fd_ref_cycles);
+    long task_clock = perf_read(m->fd_task_clock);
+
+    m->running = 0;
+    if (m->sampling) {
+        pthread_join(m->sampler, NULL);
+    }
+
+    m->ghz = -1;
+    m->turbo_ratio = -1;
+    if (cycles > 0 && task_clock > 0) {
+        // cycles per nanosecond the threads were running
+        m->ghz = (double) cycles / task_clock;
+        m->source = "perf cycles";
+        if (ref_cycles > 0) {
+            m->turbo_ratio = (double) cycles / ref_cycles;
+        }
+    } else if (m->aperf != NULL) {
+        unsigned long long *aperf = m->aperf + m->num_cpus;
+        unsigned long long *mperf = m->mperf + m->num_cpus;
+        long base_khz = read_long("/sys/devices/system/cpu/cpu0/cpufreq/base_frequency");
+        if (base_khz <= 0) {
+            base_khz = read_long("/sys/devices/system/cpu/cpu0/cpufreq/cpuinfo_max_freq");
+        }
+        if (read_aperf_mperf(m->num_cpus, aperf, mperf) == 0) {
+            double delta_aperf = 0, delta_mperf = 0;
+            for (int cpu = 0; cpu < m->num_cpus; cpu++) {
+                delta_aperf += aperf[cpu] - m->aperf[cpu];
+                delta_mperf += mperf[cpu] - m->mperf[cpu];
+            }
+            if (delta_mperf > 0) {
+                m->turbo_ratio = delta_aperf / delta_mperf;
+                if (base_khz > 0) {
+                    m->ghz = m->turbo_ratio * base_khz / 1e6;
+                    m->source = "APERF/MPERF";
+                }
+            }
+        }
+    }
+    if (m->ghz < 0 && m->freq_samples > 0) {
+        m->ghz = m->freq_sum / m->freq_samples;
+        m->source = "cpufreq";
+    }
+
+    long throttle_count = read_long("/sys/devices/system/cpu/cpu0/thermal_throttle/package_throttle_count");
+    m->throttle_events = m->throttle_count >= 0 && throttle_count >= 0 ? throttle_count - m->throttle_count : -1;
+
+    if (m->fd_cycles >= 0) {
+        close(m->fd_cycles);
+    }
+    if (m->fd_ref_cycles >= 0) {
+        close(m->fd_ref_cycles);
+    }
+    if (m->fd_task_clock >= 0) {
+        close(m->fd_task_clock);
+    }
+    free(m->aperf);
+    free(m->mperf);
+    m->aperf = NULL;
+    m->mperf = NULL;
+}
+
+/*
+ * Prints the effective frequency, the throughput per GHz and the package
+ * temperature of the timed region
+ */
+void monitor_print(struct monitor *m, double gops, const char *unit) {
+    if (m->ghz > 0) {
+        printf("Effective frequency: %.3lf GHz (%s)\n", m->ghz, m->source);
+        printf("%s/GHz: %lf\n", unit, gops / m->ghz);
+    } else {
+        printf("Effective frequency: unavailable\n");
+    }
+    if (m->turbo_ratio > 0) {
+        printf("Turbo ratio: %.3lf\n", m->turbo_ratio);
+    }
+    if (m->temp_samples > 0) {
+        printf("Package temperature: mean %.1lf C, max %.1lf C\n", m->temp_sum / m->temp_samples, m->temp_max);
+    } else {
+        printf("Package temperature: unavailable\n");
+    }
+    if (m->throttle_events >= 0) {
+        printf("Throttle events: %ld\n", m->throttle_events);
+    }
+}
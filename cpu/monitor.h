@@ -0,0 +1,50 @@
+//
+// Frequency and thermal monitoring of the timed region of the benchmark
+//
+
+#ifndef MONITOR_H
+#define MONITOR_H
+
+#include <pthread.h>
+
+// interval between two samples of the temperature and the clocks
+#define MONITOR_INTERVAL_US 100000
+
+// the counters and samples of one timed region
+struct monitor {
+    // perf_event counters of the process and the threads it creates
+    int fd_cycles;
+    int fd_ref_cycles;
+    int fd_task_clock;
+
+    // APERF / MPERF of every CPU, when perf is not available
+    int num_cpus;
+    unsigned long long *aperf;
+    unsigned long long *mperf;
+
+    long throttle_count;
+
+    // the sampling thread
+    pthread_t sampler;
+    volatile int running;
+    int sampling;
+    int temp_samples;
+    double temp_sum;
+    double temp_max;
+    int freq_samples;
+    double freq_sum;
+
+    // results
+    const char *source;
+    double ghz;
+    double turbo_ratio;
+    long throttle_events;
+};
+
+void monitor_start(struct monitor *m);
+
+void monitor_stop(struct monitor *m);
+
+void monitor_print(struct monitor *m, double gops, const char *unit);
+
+#endif
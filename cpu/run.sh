@@ -3,11 +3,15 @@
 cd "$(dirname "$0")"
 
 # This script can be called with an optional command-line parameter $1
-# to pass in the desired dimension of the square matrix to benchmark. Default is 1024
+# to pass in the desired length of the vectors to benchmark. Default is half
+# the L2 cache of every core, from the topology of the host
+# and an optional $2, strong (default) or weak, choosing the scaling mode
 
 # Arrays of input
-benchmark_type=(flops iops)
-num_threads=(1 2 4 8)
+benchmark_type=(flops iops fp32 fp16 bf16 int8 int16 int64
+	div sqrt rcp exp log sin
+	div-poly sqrt-poly rcp-poly exp-poly log-poly sin-poly)
+scaling=${2:-strong}
 
 if [ -d "log/" ]; then
 	rm -rf log/
@@ -16,15 +20,18 @@ else
 	mkdir log
 fi
 
+# the all mode sweeps the powers of two up to all hardware threads, and all
+# hardware threads, and ends with the parallel efficiency and the Amdahl and
+# Gustafson fits
 for type in "${benchmark_type[@]}"
 do
-	touch log/${type}.log
-	for threads in "${num_threads[@]}"
-	do
-		echo "Benchmarking $type with $threads thread(s)"
-		RESULT="$(./benchmark.bin ${type} ${threads} $1)"
-		echo ${RESULT}
-		echo ${RESULT} >> log/${type}.log
-		echo ""
-	done
-done
\ No newline at end of file
+	log=log/${type}.log
+	if [ "$scaling" = "weak" ]; then
+		log=log/${type}-weak.log
+	fi
+	echo "Benchmarking $type with 1 to $(nproc) threads"
+	RESULT="$(./benchmark.bin ${type} all ${1:+$1} --scaling=${scaling})"
+	echo "${RESULT}"
+	echo "${RESULT}" > $log
+	echo ""
+done
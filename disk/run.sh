@@ -48,3 +48,54 @@ do
         done
     done
 done
+
+# latency under load: sweep the IOPS cap of a 70/30 random 8KB workload to
+# trace the throughput/latency curve of the disk (0 means uncapped)
+logfile="mixed.log"
+echo -n "" > $logfile
+for iops in 500 1000 2000 4000 8000 16000 0
+do
+    clear_cache
+    ./bin/benchmark-lowlevel.exe 8 1 3 --read=70 --random=100 \
+        --iops=$iops --runtime=30 >> $logfile
+done
+
+# commit latency of a write-ahead log under each durability mode
+logfile="wal.log"
+echo -n "" > $logfile
+for sync in fsync fdatasync dsync group
+do
+    for threads in 1 2 4 8
+    do
+        ./bin/benchmark-lowlevel.exe $threads 1 4 --sync=$sync \
+            --record=4k --runtime=30 >> $logfile
+    done
+done
+rm -f file.wal
+
+# metadata operations over a directory tree of small files
+logfile="metadata.log"
+echo -n "" > $logfile
+for threads in 1 2 4 8
+do
+    clear_cache
+    ./bin/benchmark-metadata.exe $threads 1000000 --depth=2 --fanout=32 \
+        --size=4k:64k >> $logfile
+done
+
+# syscall batching: sequential and sorted random reads of small blocks with
+# one preadv per batch of adjacent blocks
+logfile="batch.log"
+echo -n "" > $logfile
+for size in 0 1
+do
+    for batch in 1 4 16 64 256
+    do
+        echo "Running block size $size batch $batch experiment" >> $logfile
+        clear_cache
+        ./bin/benchmark-lowlevel.exe 8 $size 1 --batch=$batch >> $logfile
+        clear_cache
+        ./bin/benchmark-lowlevel.exe 8 $size 2 --batch=$batch --sort \
+            >> $logfile
+    done
+done
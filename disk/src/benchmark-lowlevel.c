@@ -1,9 +1,18 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <math.h>
 #include <pthread.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <time.h>
 #include <sys/time.h>
+#include <sys/uio.h>
+
+#include "autotune.h"
+#include "histogram.h"
+#include "topology.h"
+#include "util.h"
 
 #define SIZE8B 0
 #define SIZE8KB 1
@@ -13,96 +22,646 @@
 #define READWRITE 0
 #define SEQUENTIAL 1
 #define RANDOM 2
+#define MIXED 3
+#define WAL 4
+#define AUTOTUNE 5
+
+#define SYNC_FSYNC 0
+#define SYNC_FDATASYNC 1
+#define SYNC_DSYNC 2
+#define SYNC_GROUP 3
+
+#define DIST_UNIFORM 0
+#define DIST_ZIPF 1
+#define DIST_HOTSPOT 2
 
 #define SETSIZE 10 * 128 * 1024 * 1024
 #define SMALLSETSIZE 10 * 128 * 1024
+#define FILESIZE (8L * SETSIZE)
 #define DEBUG 0
 
+/* maximum number of entries in the block size distribution of a workload */
+#define MAX_BS_CLASSES 8
+
+#define DEFAULT_RUNTIME 30
+#define DEFAULT_RECORD_SIZE 4096
+#define DEFAULT_SEED 1
+#define DEFAULT_THETA 0.99
+#define DEFAULT_HOT_PCT 10
+#define DEFAULT_HOT_ACCESS_PCT 90
+
+/* largest number of blocks submitted by one preadv/pwritev */
+#define MAX_BATCH 1024
+
+/* terms of the zipf normalization summed one by one, the tail after them
+ * being approximated
+ */
+#define ZETA_TERMS 1000000
+
+
+/* description of a fio-style mixed workload or of a write-ahead-log
+ * workload, shared by all the threads
+ */
+typedef struct workload_t
+{
+    int read_pct;
+    int random_pct;
+    int num_bs;
+    long bs[MAX_BS_CLASSES];
+    int bs_weight[MAX_BS_CLASSES];
+    int bs_weight_total;
+    long max_bs;
+    double iops_cap;
+    double bw_cap;
+    long runtime;
+    int sync_mode;
+    long record_size;
+    int dist;
+    double theta;
+    int hot_pct;
+    int hot_access_pct;
+    unsigned long seed;
+    int batch;
+    int sort;
+} workload_t;
+
+/* access distribution over the n blocks of a file, built once from the
+ * workload and shared read-only by the threads; every thread draws from it
+ * with its own seeded generator, so no position array is needed
+ */
+typedef struct dist_t
+{
+    int type;
+    long n;
+    unsigned long key;
+    int half_bits;
+    double theta;
+    double alpha;
+    double zetan;
+    double eta;
+    double half_pow_theta;
+    long hot_blocks;
+    double hot_access;
+} dist_t;
+
+/* the shared log of the WAL mode; appends are serialized so that the log
+ * has no holes, and in group commit mode a single leader syncs on behalf
+ * of every thread whose record was appended before the sync started
+ */
+typedef struct wal_t
+{
+    int fd;
+    pthread_mutex_t lock;
+    pthread_cond_t synced;
+    long written;
+    long durable;
+    int syncing;
+    long syncs;
+} wal_t;
+
+/* per-thread token bucket; a negative token count is a debt that the
+ * thread pays off by sleeping before issuing the next operation
+ */
+typedef struct token_bucket_t
+{
+    double rate;
+    double burst;
+    double tokens;
+    long last;
+} token_bucket_t;
+
 typedef struct thread_arg_t
 {
     int mode;
     int fd_in;
     int fd_out;
-    long *pos_vec;
+    dist_t *dist;
     int pos_start;
     int pos_length;
     int block_size;
     long runtime;
+    int tid;
+    int num_threads;
+    workload_t *workload;
+    wal_t *wal;
+    long read_ops;
+    long write_ops;
+    long bytes;
+    long syscalls;
+    histogram_t read_hist;
+    histogram_t write_hist;
 } thread_arg_t;
 
-void shuffle(long *vec, int n)
+/* the search space of the autotune mode: the powers of two up to
+ * <num_threads> threads and these block sizes, each run for 1 s in the
+ * first round
+ */
+#define TUNE_BUDGET 120
+#define TUNE_MAX_THREADS 64
+#define TUNE_NUM_BS 5
+const long tune_bs[TUNE_NUM_BS] = { 4096, 16384, 65536, 262144, 1048576 };
+
+typedef struct disk_tune_t
+{
+    workload_t *workload;
+    int fd_in;
+    int fd_out;
+    int threads[TUNE_MAX_THREADS];
+    int num_threads;
+} disk_tune_t;
+
+void sleep_ns(long ns)
+{
+    struct timespec ts;
+
+    ts.tv_sec = ns / 1000000000L;
+    ts.tv_nsec = ns % 1000000000L;
+    while (nanosleep(&ts, &ts) < 0) {
+        ;
+    }
+}
+
+/* returns the initial generator state of a thread, so that every thread
+ * gets an independent stream that is reproducible from the run's seed
+ */
+unsigned long rng_seed(unsigned long seed, int tid)
+{
+    unsigned long state = mix64(seed ^ mix64((unsigned long) tid + 1));
+
+    return state != 0 ? state : 1;
+}
+
+/* xorshift64* generator, each thread owns its own state */
+unsigned long rng_next(unsigned long *state)
+{
+    unsigned long x = *state;
+
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return x * 0x2545F4914F6CDD1DUL;
+}
+
+/* returns a uniformly distributed value in [0, n), rejecting the values
+ * that would bias a plain modulo towards the low end of the range
+ */
+unsigned long rng_bounded(unsigned long *state, unsigned long n)
+{
+    unsigned long threshold = -n % n;
+    unsigned long x;
+
+    do {
+        x = rng_next(state);
+    } while (x < threshold);
+    return x % n;
+}
+
+/* returns a uniformly distributed double in [0, 1) */
+double rng_double(unsigned long *state)
+{
+    return (rng_next(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+void bucket_init(token_bucket_t *tb, double rate, long now)
+{
+    tb->rate = rate;
+    // allow at most 10ms worth of burst after an idle period //
+    tb->burst = rate / 100.0;
+    tb->tokens = 0;
+    tb->last = now;
+}
+
+/* takes the given amount of tokens from the bucket and returns the number of
+ * nanoseconds the caller has to wait before the operation is allowed
+ */
+long bucket_take(token_bucket_t *tb, double amount, long now)
+{
+    if (tb->rate <= 0) {
+        return 0;
+    }
+    tb->tokens += (now - tb->last) * tb->rate / 1e9;
+    if (tb->tokens > tb->burst) {
+        tb->tokens = tb->burst;
+    }
+    tb->last = now;
+    tb->tokens -= amount;
+    if (tb->tokens >= 0) {
+        return 0;
+    }
+    return (long) (-tb->tokens / tb->rate * 1e9);
+}
+
+/* parses a block size distribution of the form <size>[:<weight>],... */
+int parse_bs(workload_t *wl, const char *str)
+{
+    char *end;
+    long weight;
+
+    wl->num_bs = 0;
+    wl->bs_weight_total = 0;
+    wl->max_bs = 0;
+    while (*str != '\0') {
+        if (wl->num_bs == MAX_BS_CLASSES) {
+            return -1;
+        }
+        wl->bs[wl->num_bs] = parse_size(str, &end);
+        if (end == str || wl->bs[wl->num_bs] <= 0) {
+            return -1;
+        }
+        weight = 1;
+        if (*end == ':') {
+            str = end + 1;
+            weight = strtol(str, &end, 10);
+            if (end == str || weight <= 0) {
+                return -1;
+            }
+        }
+        wl->bs_weight[wl->num_bs] = (int) weight;
+        wl->bs_weight_total += (int) weight;
+        if (wl->bs[wl->num_bs] > wl->max_bs) {
+            wl->max_bs = wl->bs[wl->num_bs];
+        }
+        wl->num_bs++;
+        if (*end == ',') {
+            end++;
+        } else if (*end != '\0') {
+            return -1;
+        }
+        str = end;
+    }
+    return wl->num_bs > 0 ? 0 : -1;
+}
+
+/* parses uniform, zipf[:<theta>] or hotspot[:<hot pct>:<access pct>] */
+int parse_dist(workload_t *wl, const char *str)
+{
+    if (strcmp(str, "uniform") == 0) {
+        wl->dist = DIST_UNIFORM;
+    } else if (strncmp(str, "zipf", 4) == 0) {
+        wl->dist = DIST_ZIPF;
+        if (str[4] == ':') {
+            wl->theta = atof(str + 5);
+        } else if (str[4] != '\0') {
+            return -1;
+        }
+        // the generator below only handles 0 < theta < 1 //
+        if (wl->theta <= 0 || wl->theta >= 1) {
+            return -1;
+        }
+    } else if (strncmp(str, "hotspot", 7) == 0) {
+        wl->dist = DIST_HOTSPOT;
+        if (str[7] == ':') {
+            if (sscanf(str + 8, "%d:%d", &wl->hot_pct,
+                    &wl->hot_access_pct) != 2) {
+                return -1;
+            }
+        } else if (str[7] != '\0') {
+            return -1;
+        }
+        if (wl->hot_pct <= 0 || wl->hot_pct >= 100
+                || wl->hot_access_pct < 0 || wl->hot_access_pct > 100) {
+            return -1;
+        }
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+int parse_option(workload_t *wl, const char *opt)
+{
+    if (strncmp(opt, "--read=", 7) == 0) {
+        wl->read_pct = atoi(opt + 7);
+        return (wl->read_pct < 0 || wl->read_pct > 100) ? -1 : 0;
+    } else if (strncmp(opt, "--random=", 9) == 0) {
+        wl->random_pct = atoi(opt + 9);
+        return (wl->random_pct < 0 || wl->random_pct > 100) ? -1 : 0;
+    } else if (strncmp(opt, "--bs=", 5) == 0) {
+        return parse_bs(wl, opt + 5);
+    } else if (strncmp(opt, "--iops=", 7) == 0) {
+        wl->iops_cap = atof(opt + 7);
+        return wl->iops_cap < 0 ? -1 : 0;
+    } else if (strncmp(opt, "--bw=", 5) == 0) {
+        // bandwidth cap is given in MB/s, kept internally in bytes/s //
+        wl->bw_cap = atof(opt + 5) * 1000000;
+        return wl->bw_cap < 0 ? -1 : 0;
+    } else if (strncmp(opt, "--runtime=", 10) == 0) {
+        wl->runtime = atol(opt + 10);
+        return wl->runtime <= 0 ? -1 : 0;
+    } else if (strcmp(opt, "--sync=fsync") == 0) {
+        wl->sync_mode = SYNC_FSYNC;
+        return 0;
+    } else if (strcmp(opt, "--sync=fdatasync") == 0) {
+        wl->sync_mode = SYNC_FDATASYNC;
+        return 0;
+    } else if (strcmp(opt, "--sync=dsync") == 0) {
+        wl->sync_mode = SYNC_DSYNC;
+        return 0;
+    } else if (strcmp(opt, "--sync=group") == 0) {
+        wl->sync_mode = SYNC_GROUP;
+        return 0;
+    } else if (strncmp(opt, "--dist=", 7) == 0) {
+        return parse_dist(wl, opt + 7);
+    } else if (strncmp(opt, "--batch=", 8) == 0) {
+        wl->batch = atoi(opt + 8);
+        return (wl->batch <= 0 || wl->batch > MAX_BATCH) ? -1 : 0;
+    } else if (strcmp(opt, "--sort") == 0) {
+        wl->sort = 1;
+        return 0;
+    } else if (strncmp(opt, "--seed=", 7) == 0) {
+        wl->seed = strtoul(opt + 7, NULL, 10);
+        return 0;
+    } else if (strncmp(opt, "--record=", 9) == 0) {
+        char *end;
+
+        wl->record_size = parse_size(opt + 9, &end);
+        return (*end != '\0' || wl->record_size <= 0) ? -1 : 0;
+    }
+    return -1;
+}
+
+/* reads or writes a whole block, retrying on short transfers */
+int transfer_block(int fd, char *buffer, long size, long offset, int write)
+{
+    long rc, rd;
+
+    rc = 0;
+    while (rc < size) {
+        if (write) {
+            rd = pwrite(fd, &buffer[rc], size - rc, offset + rc);
+        } else {
+            rd = pread(fd, &buffer[rc], size - rc, offset + rc);
+        }
+        if (rd <= 0) {
+            if (DEBUG) {
+                printf("Error at position %ld\n", offset + rc);
+            }
+            return -1;
+        }
+        rc += rd;
+    }
+    return 0;
+}
+
+/* reads or writes a run of adjacent blocks with a single preadv/pwritev,
+ * retrying on short transfers; the iovec array is consumed in the process
+ */
+int transfer_vec(int fd, struct iovec *iov, int iovcnt, long offset,
+        int write)
+{
+    long rd;
+
+    while (iovcnt > 0) {
+        if (write) {
+            rd = pwritev(fd, iov, iovcnt, offset);
+        } else {
+            rd = preadv(fd, iov, iovcnt, offset);
+        }
+        if (rd <= 0) {
+            if (DEBUG) {
+                printf("Error at position %ld\n", offset);
+            }
+            return -1;
+        }
+        offset += rd;
+        while (iovcnt > 0 && rd >= (long) iov->iov_len) {
+            rd -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = (char *) iov->iov_base + rd;
+            iov->iov_len -= rd;
+        }
+    }
+    return 0;
+}
+
+int compare_offsets(const void *a, const void *b)
 {
-    int i, j;
-    long temp;
+    long x = *(const long *) a;
+    long y = *(const long *) b;
 
-    for (i = 0; i < n; ++i) {
-        j = rand() % n;
-        temp = vec[i];
-        vec[i] = vec[j];
-        vec[j] = temp;
+    return (x > y) - (x < y);
+}
+
+/* returns the sum of 1/i^theta for i in [1, n]; past ZETA_TERMS the tail
+ * is the Euler-Maclaurin approximation, exact to well below 1e-12 there
+ */
+double zeta(long n, double theta)
+{
+    double sum, m, tail;
+    long i, terms;
+
+    terms = n < ZETA_TERMS ? n : ZETA_TERMS;
+    sum = 0;
+    for (i = 1; i <= terms; ++i) {
+        sum += 1.0 / pow((double) i, theta);
+    }
+    if (n > terms) {
+        // integral, trapezoid correction and first derivative term of the
+        // sum over (terms, n] //
+        m = (double) terms;
+        tail = (pow((double) n, 1.0 - theta) - pow(m, 1.0 - theta))
+                / (1.0 - theta);
+        tail += (pow((double) n, -theta) - pow(m, -theta)) / 2.0;
+        tail += theta * (pow(m, -theta - 1.0)
+                - pow((double) n, -theta - 1.0)) / 12.0;
+        sum += tail;
     }
+    return sum;
 }
 
-void init_pos(long *vec, int n, int block_size)
+void dist_init(dist_t *dist, workload_t *wl, long n)
 {
-    int i;
+    double zeta2;
+
+    memset(dist, 0, sizeof(dist_t));
+    dist->type = wl->dist;
+    dist->n = n;
+    dist->key = mix64(wl->seed);
 
-    for (i = 0; i < n; ++i) {
-        vec[i] = (long) i * (long) block_size;
+    // the permutation works on the smallest even power of two above n //
+    while ((1L << (2 * dist->half_bits)) < n) {
+        dist->half_bits++;
+    }
+
+    if (dist->type == DIST_ZIPF) {
+        // Gray et al., "Quickly generating billion-record synthetic
+        // databases", the same generator YCSB uses //
+        dist->theta = wl->theta;
+        dist->zetan = zeta(n, wl->theta);
+        zeta2 = 1.0 + 1.0 / pow(2.0, wl->theta);
+        dist->alpha = 1.0 / (1.0 - wl->theta);
+        dist->eta = (1.0 - pow(2.0 / n, 1.0 - wl->theta))
+                / (1.0 - zeta2 / dist->zetan);
+        dist->half_pow_theta = 1.0 + pow(0.5, wl->theta);
+    } else if (dist->type == DIST_HOTSPOT) {
+        dist->hot_blocks = n * wl->hot_pct / 100;
+        if (dist->hot_blocks < 1) {
+            dist->hot_blocks = 1;
+        }
+        dist->hot_access = wl->hot_access_pct / 100.0;
     }
 }
 
+/* keyed bijection of [0, n): a four round Feistel network over the
+ * enclosing power of two, cycle-walking until the result falls inside
+ */
+long dist_permute(dist_t *dist, long index)
+{
+    unsigned long mask = (1UL << dist->half_bits) - 1;
+    unsigned long left, right, temp, x;
+    int round;
+
+    x = (unsigned long) index;
+    do {
+        left = x >> dist->half_bits;
+        right = x & mask;
+        for (round = 0; round < 4; ++round) {
+            temp = right;
+            right = left ^ (mix64(right ^ (dist->key + round)) & mask);
+            left = temp;
+        }
+        x = (left << dist->half_bits) | right;
+    } while (x >= (unsigned long) dist->n);
+
+    return (long) x;
+}
+
+/* draws one block index from the distribution */
+long dist_next(dist_t *dist, unsigned long *rng)
+{
+    double u, uz;
+    long rank;
+
+    switch (dist->type) {
+        case DIST_ZIPF:
+            u = rng_double(rng);
+            uz = u * dist->zetan;
+            if (uz < 1.0) {
+                rank = 0;
+            } else if (uz < dist->half_pow_theta) {
+                rank = 1;
+            } else {
+                rank = (long) (dist->n
+                        * pow(dist->eta * u - dist->eta + 1.0, dist->alpha));
+                if (rank >= dist->n) {
+                    rank = dist->n - 1;
+                }
+            }
+            // scatter the popular ranks across the file instead of packing
+            // them at its start //
+            return dist_permute(dist, rank);
+        case DIST_HOTSPOT:
+            if (rng_double(rng) < dist->hot_access) {
+                return (long) rng_bounded(rng, dist->hot_blocks);
+            }
+            return dist->hot_blocks
+                    + (long) rng_bounded(rng, dist->n - dist->hot_blocks);
+        default:
+            return (long) rng_bounded(rng, dist->n);
+    }
+}
+
+/* returns the index of the i-th block visited by a thread: sequential
+ * modes walk the thread's slice, a uniform random read visits the same
+ * slice of a seeded permutation of all the blocks (every block is read
+ * exactly once, as with a shuffled position array) and the skewed
+ * distributions sample with replacement
+ */
+long next_block(thread_arg_t *arg, long i, unsigned long *rng)
+{
+    if (arg->mode != RANDOM) {
+        return arg->pos_start + i;
+    }
+    if (arg->dist->type == DIST_UNIFORM) {
+        return dist_permute(arg->dist, arg->pos_start + i);
+    }
+    return dist_next(arg->dist, rng);
+}
+
+/* fills the iovec array of a run of blocks that starts at the given block
+ * of the batch, each block getting its own slice of the buffer
+ */
+void fill_iov(struct iovec *iov, char *buffer, int first, int count,
+        int block_size)
+{
+    int j;
+
+    for (j = 0; j < count; ++j) {
+        iov[j].iov_base = &buffer[(long) (first + j) * block_size];
+        iov[j].iov_len = block_size;
+    }
+}
+
+/* thread function of the READ+WRITE, SEQUENTIAL and RANDOM modes: the
+ * blocks are taken in batches of --batch blocks (1 by default, one
+ * syscall per block), optionally sorted by offset, and every run of
+ * adjacent blocks in a batch is transferred with one preadv/pwritev
+ */
 void *work(void *argv)
 {
     thread_arg_t *arg = (thread_arg_t *) argv;
+    workload_t *wl = arg->workload;
+    struct iovec *iov;
     char *buffer;
-    int i;
-    long rc, rd;
+    int i, j, n, run;
+    long *offsets;
+    unsigned long rng;
     struct timeval start, end;
 
-    buffer = (char *) malloc(arg->block_size * sizeof(char));
+    buffer = (char *) malloc((long) wl->batch * arg->block_size
+            * sizeof(char));
+    offsets = (long *) malloc(wl->batch * sizeof(long));
+    iov = (struct iovec *) malloc(wl->batch * sizeof(struct iovec));
+    rng = rng_seed(wl->seed, arg->tid);
 
     gettimeofday(&start, NULL);
-    for (i = 0; i < arg->pos_length; ++i) {
-        rc = 0;
-        do {
-            rd = pread(arg->fd_in, &buffer[rc], arg->block_size - rc,
-                    arg->pos_vec[arg->pos_start + i] + rc);
-            if (rd < 0) {
+    for (i = 0; i < arg->pos_length; i += n) {
+        n = arg->pos_length - i < wl->batch ? arg->pos_length - i : wl->batch;
+        for (j = 0; j < n; ++j) {
+            offsets[j] = next_block(arg, i + j, &rng) * arg->block_size;
+        }
+        if (wl->sort && n > 1) {
+            qsort(offsets, n, sizeof(long), compare_offsets);
+        }
+
+        for (j = 0; j < n; j += run) {
+            run = 1;
+            while (j + run < n
+                    && offsets[j + run] == offsets[j + run - 1]
+                    + arg->block_size) {
+                run++;
+            }
+
+            fill_iov(iov, buffer, j, run, arg->block_size);
+            if (transfer_vec(arg->fd_in, iov, run, offsets[j], 0) < 0) {
                 printf("Error reading from file\n");
                 if (DEBUG) {
-                    printf("Error at position: %ld\n", 
-                            arg->pos_vec[arg->pos_start + i] + rc);
-                    printf("Block index: %d\n", i);
-                    printf("Block start: %ld\n", 
-                            arg->pos_vec[arg->pos_start + i]);
+                    printf("Block index: %d\n", i + j);
+                    printf("Block start: %ld\n", offsets[j]);
                     printf("Number of blocks: %d\n", arg->pos_length);
-                    printf("Number of bytes read: %ld", rc);
                 }
                 free(buffer);
+                free(offsets);
+                free(iov);
                 pthread_exit(NULL);
             }
-            
-            rc += rd;
-        } while (rc < arg->block_size);
-        
-        if (arg->mode == READWRITE) {
-            rc = 0;
-            do {
-                rd = pwrite(arg->fd_out, &buffer[rc], arg->block_size - rc,
-                        arg->pos_vec[arg->pos_start + i] + rc);
-                if (rd < 0) {
+            arg->syscalls++;
+
+            if (arg->mode == READWRITE) {
+                fill_iov(iov, buffer, j, run, arg->block_size);
+                if (transfer_vec(arg->fd_out, iov, run, offsets[j], 1) < 0) {
                     printf("Error writing to file\n");
-                    if (DEBUG) {
-                        printf("Error at position %ld\n", 
-                                arg->pos_vec[arg->pos_start + i] + rc);
-                    }
                     free(buffer);
+                    free(offsets);
+                    free(iov);
                     pthread_exit(NULL);
                 }
-                
-                rc += rd;
-            } while (rc < arg->block_size);
+                arg->syscalls++;
+            }
         }
     }
     gettimeofday(&end, NULL);
@@ -111,23 +670,557 @@ void *work(void *argv)
             * 1000000 + (end.tv_usec - start.tv_usec);
 
     free(buffer);
+    free(offsets);
+    free(iov);
+
+    pthread_exit(NULL);
+}
+
+long pick_bs(workload_t *wl, unsigned long *rng)
+{
+    int i, w;
+
+    if (wl->num_bs == 1) {
+        return wl->bs[0];
+    }
+    w = (int) rng_bounded(rng, (unsigned long) wl->bs_weight_total);
+    for (i = 0; i < wl->num_bs - 1; ++i) {
+        if (w < wl->bs_weight[i]) {
+            break;
+        }
+        w -= wl->bs_weight[i];
+    }
+    return wl->bs[i];
+}
+
+/* thread function of the mixed workload: every operation picks a direction,
+ * a block size and either the next sequential or a random offset, waits for
+ * the per-thread token buckets and records its own latency
+ */
+void *work_mixed(void *argv)
+{
+    thread_arg_t *arg = (thread_arg_t *) argv;
+    workload_t *wl = arg->workload;
+    dist_t *dist = arg->dist;
+    token_bucket_t iops_bucket, bw_bucket;
+    unsigned long rng;
+    char *buffer;
+    long size, offset, seq_offset, slice, slot, begin, start, end, deadline;
+    long slice_start, slice_end, wait, wait_bw;
+    int write;
+
+    buffer = (char *) malloc(wl->max_bs * sizeof(char));
+    memset(buffer, 'a', wl->max_bs);
+    rng = rng_seed(wl->seed, arg->tid);
+
+    // the sequential accesses of a thread stay in its own slice, the last
+    // one also taking the remainder of the file //
+    slice = FILESIZE / arg->num_threads;
+    slice_start = slice * arg->tid;
+    slice_end = arg->tid == arg->num_threads - 1 ? FILESIZE
+            : slice_start + slice;
+    seq_offset = slice_start;
+
+    begin = now_ns();
+    deadline = begin + wl->runtime * 1000000000L;
+    bucket_init(&iops_bucket, wl->iops_cap / arg->num_threads, begin);
+    bucket_init(&bw_bucket, wl->bw_cap / arg->num_threads, begin);
+
+    end = begin;
+    while (end < deadline) {
+        size = pick_bs(wl, &rng);
+        write = (int) rng_bounded(&rng, 100) >= wl->read_pct;
+        if ((int) rng_bounded(&rng, 100) < wl->random_pct) {
+            // the distribution is over slots of the smallest block size //
+            slot = dist_next(dist, &rng) * (FILESIZE / dist->n);
+            offset = slot - slot % size;
+            if (offset + size > FILESIZE) {
+                offset = FILESIZE - size - (FILESIZE - size) % size;
+            }
+        } else {
+            if (seq_offset + size > slice_end) {
+                seq_offset = slice_start;
+            }
+            // a block larger than the slice runs over into the next one //
+            offset = seq_offset + size > FILESIZE ? FILESIZE - size
+                    : seq_offset;
+            seq_offset += size;
+        }
+
+        wait = bucket_take(&iops_bucket, 1, end);
+        wait_bw = bucket_take(&bw_bucket, size, end);
+        if (wait_bw > wait) {
+            wait = wait_bw;
+        }
+        if (wait > 0) {
+            sleep_ns(wait);
+        }
+
+        start = now_ns();
+        if (transfer_block(write ? arg->fd_out : arg->fd_in, buffer, size,
+                offset, write) < 0) {
+            printf("Error %s file\n", write ? "writing to" : "reading from");
+            free(buffer);
+            pthread_exit(NULL);
+        }
+        end = now_ns();
+
+        if (write) {
+            arg->write_ops++;
+            hist_record(&arg->write_hist, end - start);
+        } else {
+            arg->read_ops++;
+            hist_record(&arg->read_hist, end - start);
+        }
+        arg->bytes += size;
+    }
+
+    arg->runtime = (end - begin) / 1000;
+
+    free(buffer);
+
+    pthread_exit(NULL);
+}
+
+/* appends one record to the log and returns the offset right after it */
+long wal_append(wal_t *wal, char *record, long size)
+{
+    long offset;
+
+    pthread_mutex_lock(&wal->lock);
+    offset = wal->written;
+    if (transfer_block(wal->fd, record, size, offset, 1) < 0) {
+        pthread_mutex_unlock(&wal->lock);
+        return -1;
+    }
+    wal->written = offset + size;
+    pthread_mutex_unlock(&wal->lock);
+
+    return offset + size;
+}
+
+/* group commit: the first thread to find no sync in flight becomes the
+ * leader and makes everything appended so far durable with one fdatasync,
+ * the others wait until the durable end of the log covers their record
+ */
+int wal_group_commit(wal_t *wal, long end)
+{
+    long target;
+    int rc;
+
+    rc = 0;
+    pthread_mutex_lock(&wal->lock);
+    while (wal->durable < end && rc == 0) {
+        if (wal->syncing) {
+            pthread_cond_wait(&wal->synced, &wal->lock);
+            continue;
+        }
+        wal->syncing = 1;
+        target = wal->written;
+        pthread_mutex_unlock(&wal->lock);
+
+        rc = fdatasync(wal->fd);
+
+        pthread_mutex_lock(&wal->lock);
+        wal->syncing = 0;
+        if (rc == 0) {
+            wal->durable = target;
+            wal->syncs++;
+        }
+        pthread_cond_broadcast(&wal->synced);
+    }
+    pthread_mutex_unlock(&wal->lock);
+
+    return rc;
+}
+
+/* thread function of the WAL mode: every commit appends one record to the
+ * log and returns only once the record is durable
+ */
+void *work_wal(void *argv)
+{
+    thread_arg_t *arg = (thread_arg_t *) argv;
+    workload_t *wl = arg->workload;
+    wal_t *wal = arg->wal;
+    char *record;
+    long begin, start, end, deadline, offset;
+    int rc;
+
+    record = (char *) malloc(wl->record_size * sizeof(char));
+    memset(record, 'a' + arg->tid % 26, wl->record_size);
+
+    begin = now_ns();
+    deadline = begin + wl->runtime * 1000000000L;
+
+    end = begin;
+    while (end < deadline) {
+        start = now_ns();
+        offset = wal_append(wal, record, wl->record_size);
+        if (offset < 0) {
+            printf("Error writing to file\n");
+            free(record);
+            pthread_exit(NULL);
+        }
+
+        switch (wl->sync_mode) {
+            case SYNC_FSYNC:
+                rc = fsync(wal->fd);
+                break;
+            case SYNC_FDATASYNC:
+                rc = fdatasync(wal->fd);
+                break;
+            case SYNC_GROUP:
+                rc = wal_group_commit(wal, offset);
+                break;
+            default:
+                // O_DSYNC: the write itself returned after reaching disk //
+                rc = 0;
+                break;
+        }
+        if (rc < 0) {
+            printf("Error syncing file\n");
+            free(record);
+            pthread_exit(NULL);
+        }
+        end = now_ns();
+
+        arg->write_ops++;
+        arg->bytes += wl->record_size;
+        hist_record(&arg->write_hist, end - start);
+    }
+
+    arg->runtime = (end - begin) / 1000;
+
+    free(record);
 
     pthread_exit(NULL);
 }
 
+/* runs the WAL mode against a fresh file.wal and reports the commit rate and
+ * the commit latency distribution
+ */
+int run_wal(int num_threads, workload_t *wl)
+{
+    static const char *sync_names[] = {"fsync", "fdatasync", "O_DSYNC",
+            "group commit"};
+    pthread_t *threads;
+    thread_arg_t *args;
+    histogram_t *hist;
+    wal_t wal;
+    long max_runtime, commits, syncs;
+    int i, rc, flags;
+
+    flags = O_WRONLY | O_CREAT | O_TRUNC;
+    if (wl->sync_mode == SYNC_DSYNC) {
+        flags |= O_DSYNC;
+    }
+    wal.fd = open("file.wal", flags, 0644);
+    if (wal.fd < 0) {
+        printf("Could not open log file file.wal\n");
+        exit(-2);
+    }
+    pthread_mutex_init(&wal.lock, NULL);
+    pthread_cond_init(&wal.synced, NULL);
+    wal.written = 0;
+    wal.durable = 0;
+    wal.syncing = 0;
+    wal.syncs = 0;
+
+    threads = (pthread_t *) malloc(num_threads * sizeof(pthread_t));
+    args = (thread_arg_t *) calloc(num_threads, sizeof(thread_arg_t));
+
+    for (i = 0; i < num_threads; ++i) {
+        args[i].mode = WAL;
+        args[i].tid = i;
+        args[i].num_threads = num_threads;
+        args[i].workload = wl;
+        args[i].wal = &wal;
+        rc = pthread_create(&threads[i], NULL, work_wal, &args[i]);
+
+        if (rc) {
+            printf("Could not create thread %d!\n", i);
+            exit(-3);
+        }
+    }
+
+    hist = (histogram_t *) calloc(1, sizeof(histogram_t));
+    max_runtime = 0;
+    commits = 0;
+    for (i = 0; i < num_threads; ++i) {
+        rc = pthread_join(threads[i], NULL);
+
+        if (rc) {
+            printf("Could not terminate thread %d!\n", i);
+            exit(-3);
+        }
+
+        if (max_runtime < args[i].runtime) {
+            max_runtime = args[i].runtime;
+        }
+        commits += args[i].write_ops;
+        hist_merge(hist, &args[i].write_hist);
+    }
+
+    if (max_runtime <= 0) {
+        max_runtime = 1;
+    }
+    syncs = wl->sync_mode == SYNC_GROUP ? wal.syncs : commits;
+
+    printf("WAL: %s, %ld B records\n", sync_names[wl->sync_mode],
+            wl->record_size);
+    printf("Elapsed time: %ld ms\n", max_runtime / 1000);
+    printf("Commits: %.0lf/s\n", commits * 1e6 / max_runtime);
+    printf("Syncs: %.0lf/s (%.2lf records per sync)\n",
+            syncs * 1e6 / max_runtime,
+            syncs > 0 ? (double) commits / syncs : 0.0);
+    printf("Throughput: %lf MB/s\n",
+            (double) commits * wl->record_size / max_runtime);
+    hist_print("Commit", hist);
+
+    pthread_mutex_destroy(&wal.lock);
+    pthread_cond_destroy(&wal.synced);
+    free(hist);
+    free(threads);
+    free(args);
+
+    close(wal.fd);
+
+    return 0;
+}
+
+/* runs the mixed workload once and returns its throughput in MB/s; the
+ * report prints the achieved rates and the latency percentiles
+ */
+double mixed_pass(int num_threads, workload_t *wl, int fd_in, int fd_out,
+        int report)
+{
+    pthread_t *threads;
+    thread_arg_t *args;
+    histogram_t *read_hist, *write_hist;
+    dist_t dist;
+    long max_runtime, read_ops, write_ops, bytes, min_bs;
+    int i, rc;
+
+    threads = (pthread_t *) malloc(num_threads * sizeof(pthread_t));
+    args = (thread_arg_t *) calloc(num_threads, sizeof(thread_arg_t));
+
+    min_bs = wl->max_bs;
+    for (i = 0; i < wl->num_bs; ++i) {
+        if (wl->bs[i] < min_bs) {
+            min_bs = wl->bs[i];
+        }
+    }
+    dist_init(&dist, wl, FILESIZE / min_bs);
+
+    for (i = 0; i < num_threads; ++i) {
+        args[i].mode = MIXED;
+        args[i].fd_in = dup(fd_in);
+        args[i].fd_out = fd_out >= 0 ? dup(fd_out) : -1;
+        args[i].tid = i;
+        args[i].num_threads = num_threads;
+        args[i].workload = wl;
+        args[i].dist = &dist;
+        rc = pthread_create(&threads[i], NULL, work_mixed, &args[i]);
+
+        if (rc) {
+            printf("Could not create thread %d!\n", i);
+            exit(-3);
+        }
+    }
+
+    read_hist = (histogram_t *) calloc(1, sizeof(histogram_t));
+    write_hist = (histogram_t *) calloc(1, sizeof(histogram_t));
+    max_runtime = 0;
+    read_ops = 0;
+    write_ops = 0;
+    bytes = 0;
+    for (i = 0; i < num_threads; ++i) {
+        rc = pthread_join(threads[i], NULL);
+
+        if (rc) {
+            printf("Could not terminate thread %d!\n", i);
+            exit(-3);
+        }
+
+        close(args[i].fd_in);
+        if (args[i].fd_out >= 0) {
+            close(args[i].fd_out);
+        }
+
+        if (max_runtime < args[i].runtime) {
+            max_runtime = args[i].runtime;
+        }
+        read_ops += args[i].read_ops;
+        write_ops += args[i].write_ops;
+        bytes += args[i].bytes;
+        hist_merge(read_hist, &args[i].read_hist);
+        hist_merge(write_hist, &args[i].write_hist);
+    }
+
+    if (max_runtime <= 0) {
+        max_runtime = 1;
+    }
+
+    if (report) {
+        printf("Workload: read %d%%, random %d%%, IOPS cap %.0lf, "
+                "bandwidth cap %.1lf MB/s\n", wl->read_pct, wl->random_pct,
+                wl->iops_cap, wl->bw_cap / 1000000);
+        printf("Elapsed time: %ld ms\n", max_runtime / 1000);
+        printf("IOPS: %.0lf (read %.0lf, write %.0lf)\n",
+                (read_ops + write_ops) * 1e6 / max_runtime,
+                read_ops * 1e6 / max_runtime, write_ops * 1e6 / max_runtime);
+        printf("Throughput: %lf MB/s\n", (double) bytes / max_runtime);
+        hist_print("Read", read_hist);
+        hist_print("Write", write_hist);
+    }
+
+    free(read_hist);
+    free(write_hist);
+    free(threads);
+    free(args);
+
+    return (double) bytes / max_runtime;
+}
+
+int run_mixed(int num_threads, workload_t *wl, int fd_in, int fd_out)
+{
+    mixed_pass(num_threads, wl, fd_in, fd_out, 1);
+
+    close(fd_in);
+    if (fd_out >= 0) {
+        close(fd_out);
+    }
+
+    return 0;
+}
+
+/* sets the single block size of a workload */
+void set_bs(workload_t *wl, long bs)
+{
+    wl->num_bs = 1;
+    wl->bs[0] = bs;
+    wl->bs_weight[0] = 1;
+    wl->bs_weight_total = 1;
+    wl->max_bs = bs;
+}
+
+/* runs configuration config of the autotune search for resource seconds
+ * and returns its throughput in MB/s
+ */
+double tune_eval(int config, long resource, void *ctx)
+{
+    disk_tune_t *space = (disk_tune_t *) ctx;
+    workload_t wl;
+
+    wl = *space->workload;
+    set_bs(&wl, tune_bs[config % TUNE_NUM_BS]);
+    wl.runtime = resource;
+    return mixed_pass(space->threads[config / TUNE_NUM_BS], &wl,
+            space->fd_in, space->fd_out, 0);
+}
+
+void tune_describe(int config, char *buf, int len, void *ctx)
+{
+    disk_tune_t *space = (disk_tune_t *) ctx;
+
+    snprintf(buf, len, "threads=%d bs=%ld",
+            space->threads[config / TUNE_NUM_BS], tune_bs[config % TUNE_NUM_BS]);
+}
+
+/* searches the thread count and block size of the mixed workload with the
+ * best throughput by successive halving over the runtime, within budget
+ * seconds, and stores them in the host profile as disk.mixed.threads and
+ * disk.mixed.bs
+ */
+int run_autotune(int max_threads, workload_t *wl, int fd_in, int fd_out,
+        double budget, const char *profile)
+{
+    disk_tune_t space;
+    tuner_t tuner;
+    double best_mbps;
+    int best, t;
+    char threads[16], bs[32], read[16], random[16], mbps[32];
+    const char *keys[] = { "threads", "bs", "read", "random", "throughput" };
+    const char *values[] = { threads, bs, read, random, mbps };
+
+    space.workload = wl;
+    space.fd_in = fd_in;
+    space.fd_out = fd_out;
+    space.num_threads = 0;
+    for (t = 1; space.num_threads < TUNE_MAX_THREADS; t *= 2) {
+        space.threads[space.num_threads++] = t < max_threads ? t : max_threads;
+        if (t >= max_threads) {
+            break;
+        }
+    }
+
+    tuner.num_configs = space.num_threads * TUNE_NUM_BS;
+    tuner.resource = 1;
+    tuner.unit = "s";
+    tuner.budget = budget;
+    tuner.eval = tune_eval;
+    tuner.describe = tune_describe;
+    tuner.ctx = &space;
+    best = tune(&tuner, &best_mbps);
+
+    snprintf(threads, sizeof(threads), "%d", space.threads[best / TUNE_NUM_BS]);
+    snprintf(bs, sizeof(bs), "%ld", tune_bs[best % TUNE_NUM_BS]);
+    snprintf(read, sizeof(read), "%d", wl->read_pct);
+    snprintf(random, sizeof(random), "%d", wl->random_pct);
+    snprintf(mbps, sizeof(mbps), "%lf", best_mbps);
+
+    printf("Best configuration: threads=%s bs=%s\n", threads, bs);
+    printf("Throughput: %lf MB/s\n", best_mbps);
+    if (profile_store(profile, "disk.mixed.", keys, values, 5) == 0) {
+        printf("Stored in %s\n", profile);
+    }
+
+    close(fd_in);
+    if (fd_out >= 0) {
+        close(fd_out);
+    }
+
+    return 0;
+}
+
+/* replaces the thread count and block size of the mixed workload by the
+ * ones stored in the host profile
+ */
+void load_profile(const char *profile, int *num_threads, workload_t *wl)
+{
+    char threads[PROFILE_LINE], bs[PROFILE_LINE];
+
+    if (profile_load(profile, "disk.mixed.threads", threads,
+                sizeof(threads)) < 0
+            || profile_load(profile, "disk.mixed.bs", bs, sizeof(bs)) < 0) {
+        printf("No configuration of the mixed workload in %s, run the "
+                "autotune mode first\n", profile);
+        exit(-1);
+    }
+    *num_threads = atoi(threads);
+    set_bs(wl, atol(bs));
+    printf("Profile: threads=%d bs=%ld\n", *num_threads, wl->bs[0]);
+}
+
 int main(int argc, char **argv)
 {
     pthread_t *threads;
     thread_arg_t *args;
     int fd_in, fd_out, rc, i;
-    long *pos_vec, max_runtime, latency;
+    long max_runtime, latency, syscalls, blocks;
     double throughput;
-    int num_threads, block_size, num_blocks, mode;
+    int num_threads, block_size, num_blocks, mode, tuned;
+    double budget;
+    const char *profile;
+    workload_t workload;
+    dist_t dist;
+    topology_t topo;
 
     // initialized arguments //
-    if (argc <= 3 || argc >= 5) {
+    if (argc <= 3) {
         printf("program usage: ./benchmark-lowlevel.exe "
-                "<num_threads> <block_size> <mode>\n"
+                "<num_threads> <block_size> <mode> [options]\n"
+                "<num_threads> 0 -> the hardware threads of the host\n"
                 "<block_size> accepts the following values:\n"
                 "\t 0 -> 8B block size\n"
                 "\t 1 -> 8KB block size\n"
@@ -136,7 +1229,47 @@ int main(int argc, char **argv)
                 "<mode> accepts the following values:\n"
                 "\t 0 -> READ+WRITE operations\n"
                 "\t 1 -> SEQUENTIAL read\n"
-                "\t 2 -> RANDOM read\n");
+                "\t 2 -> RANDOM read\n"
+                "\t 3 -> MIXED workload\n"
+                "\t 4 -> WAL commits\n"
+                "\t 5 -> AUTOTUNE of the MIXED workload\n"
+                "[options] of the READ+WRITE, SEQUENTIAL and RANDOM modes:\n"
+                "\t --batch=<n>         blocks per batch, adjacent blocks of "
+                "a batch share\n"
+                "\t                     one preadv/pwritev (default 1)\n"
+                "\t --sort              sort the offsets of every batch\n"
+                "\t --dist=<dist>       uniform, zipf[:<theta>] or "
+                "hotspot[:<hot>:<access>]\n"
+                "\t                     distribution of RANDOM reads "
+                "(default uniform)\n"
+                "\t --seed=<n>          seed of the random offsets "
+                "(default 1)\n"
+                "[options] of the MIXED workload:\n"
+                "\t --read=<pct>        percentage of reads (default 70)\n"
+                "\t --random=<pct>      percentage of random offsets "
+                "(default 100)\n"
+                "\t --bs=<size>[:<weight>],...  block size distribution "
+                "(default <block_size>)\n"
+                "\t --iops=<ops>        total IOPS cap (default unlimited)\n"
+                "\t --bw=<MB/s>         total bandwidth cap "
+                "(default unlimited)\n"
+                "\t --runtime=<sec>     duration (default 30)\n"
+                "\t --dist=<dist>       distribution of the random offsets\n"
+                "\t --seed=<n>          seed of the random offsets "
+                "(default 1)\n"
+                "\t --tuned             use the threads and block size of "
+                "the host profile\n"
+                "[options] of the AUTOTUNE mode, with those of the MIXED "
+                "workload:\n"
+                "\t --budget=<sec>      time budget of the search "
+                "(default 120)\n"
+                "\t --profile=<file>    host profile (default "
+                "~/.benchmark.profile)\n"
+                "[options] of the WAL mode:\n"
+                "\t --sync=<how>        fsync, fdatasync, dsync or group "
+                "(default fdatasync)\n"
+                "\t --record=<size>     record size (default 4k)\n"
+                "\t --runtime=<sec>     duration (default 30)\n");
         exit(-1);
     } else {
         num_threads = atoi(argv[1]);
@@ -171,10 +1304,68 @@ int main(int argc, char **argv)
             case RANDOM:
                 mode = RANDOM;
                 break;
+            case MIXED:
+                mode = MIXED;
+                break;
+            case WAL:
+                mode = WAL;
+                break;
+            case AUTOTUNE:
+                mode = AUTOTUNE;
+                break;
             default:
                 printf("Unsupported value for mode\n");
                 exit(-1);
         }
+
+        memset(&workload, 0, sizeof(workload));
+        workload.read_pct = 70;
+        workload.random_pct = 100;
+        workload.num_bs = 1;
+        workload.bs[0] = block_size;
+        workload.bs_weight[0] = 1;
+        workload.bs_weight_total = 1;
+        workload.max_bs = block_size;
+        workload.runtime = DEFAULT_RUNTIME;
+        workload.sync_mode = SYNC_FDATASYNC;
+        workload.record_size = DEFAULT_RECORD_SIZE;
+        workload.dist = DIST_UNIFORM;
+        workload.theta = DEFAULT_THETA;
+        workload.hot_pct = DEFAULT_HOT_PCT;
+        workload.hot_access_pct = DEFAULT_HOT_ACCESS_PCT;
+        workload.seed = DEFAULT_SEED;
+        workload.batch = 1;
+        tuned = 0;
+        budget = TUNE_BUDGET;
+        profile = NULL;
+        for (i = 4; i < argc; ++i) {
+            if (strcmp(argv[i], "--tuned") == 0) {
+                tuned = 1;
+            } else if (strncmp(argv[i], "--budget=", 9) == 0) {
+                budget = atof(argv[i] + 9);
+            } else if (strncmp(argv[i], "--profile=", 10) == 0) {
+                profile = argv[i] + 10;
+            } else if (parse_option(&workload, argv[i]) < 0) {
+                printf("Unsupported option %s\n", argv[i]);
+                exit(-1);
+            }
+        }
+    }
+
+    // describing the host, with the disk holding the input file //
+    topology_read(&topo, "file.in");
+    topology_print(&topo);
+    if (num_threads <= 0) {
+        num_threads = topo.threads;
+    }
+
+    if (mode == WAL) {
+        return run_wal(num_threads, &workload);
+    }
+
+    profile = profile_path(profile);
+    if (tuned && mode == MIXED) {
+        load_profile(profile, &num_threads, &workload);
     }
 
     // opening input and output files //
@@ -184,7 +1375,8 @@ int main(int argc, char **argv)
         exit (-2);
     }
 
-    if (mode == READWRITE) {
+    if (mode == READWRITE
+            || ((mode == MIXED || mode == AUTOTUNE) && workload.read_pct < 100)) {
         fd_out = open("file.out", O_WRONLY);
         if (fd_out < 0) {
             printf("Could not open output file file.out\n");
@@ -195,15 +1387,18 @@ int main(int argc, char **argv)
         fd_out = -1;
     }
 
+    if (mode == MIXED) {
+        return run_mixed(num_threads, &workload, fd_in, fd_out);
+    } else if (mode == AUTOTUNE) {
+        return run_autotune(num_threads, &workload, fd_in, fd_out, budget,
+                profile);
+    }
+
     threads = (pthread_t *) malloc(num_threads * sizeof(pthread_t));
-    args = (thread_arg_t *) malloc(num_threads * sizeof(thread_arg_t));
+    args = (thread_arg_t *) calloc(num_threads, sizeof(thread_arg_t));
 
-    // initializing position vector for sequential or random file access //
-    pos_vec = (long *) malloc(num_blocks * sizeof(long));
-    init_pos(pos_vec, num_blocks, block_size);
-    if (mode == RANDOM) {
-        shuffle(pos_vec, num_blocks);
-    }
+    // initializing the access distribution for random file access //
+    dist_init(&dist, &workload, num_blocks);
 
     // starting worker threads //
     for (i = 0; i < num_threads; ++i) {
@@ -214,9 +1409,16 @@ int main(int argc, char **argv)
         } else {
             args[i].fd_out = -1;
         }
-        args[i].pos_vec = pos_vec;
-        args[i].pos_start = i * (num_blocks / num_threads);
-        args[i].pos_length = num_blocks / num_threads;
+        args[i].dist = &dist;
+        args[i].tid = i;
+        args[i].num_threads = num_threads;
+        args[i].workload = &workload;
+        // the first num_blocks % num_threads threads take one block more,
+        // so every block is transferred for any number of threads //
+        args[i].pos_start = i * (num_blocks / num_threads)
+                + (i < num_blocks % num_threads ? i : num_blocks % num_threads);
+        args[i].pos_length = num_blocks / num_threads
+                + (i < num_blocks % num_threads ? 1 : 0);
         args[i].block_size = block_size;
         rc = pthread_create(&threads[i], NULL, work, &args[i]);
         
@@ -242,10 +1444,12 @@ int main(int argc, char **argv)
     }
 
     max_runtime = (long) args[0].runtime;
+    syscalls = args[0].syscalls;
     for (i = 1; i < num_threads; ++i) {
         if (max_runtime < args[i].runtime) {
             max_runtime = args[i].runtime;
         }
+        syscalls += args[i].syscalls;
     }
 
     latency = 0;
@@ -261,9 +1465,16 @@ int main(int argc, char **argv)
     if (atoi(argv[2]) == SIZE8B) {
         printf("1B Lantecy: %ld ms\n", latency);
     }
+    if (workload.batch > 1 || workload.sort) {
+        blocks = num_blocks;
+        if (mode == READWRITE) {
+            blocks *= 2;
+        }
+        printf("Syscalls: %ld (%.2lf blocks per syscall)\n", syscalls,
+                syscalls > 0 ? (double) blocks / syscalls : 0.0);
+    }
 
     // cleaning up //
-    free(pos_vec);
     free(threads);
     free(args);
 
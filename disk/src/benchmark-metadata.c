@@ -0,0 +1,489 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "topology.h"
+#include "util.h"
+
+#define PHASE_MKDIR 0
+#define PHASE_CREATE 1
+#define PHASE_STAT 2
+#define PHASE_OPEN 3
+#define PHASE_READDIR 4
+#define PHASE_WRITE 5
+#define PHASE_READ 6
+#define PHASE_UNLINK 7
+#define PHASE_RMDIR 8
+#define NUM_PHASES 9
+
+#define DEFAULT_DEPTH 2
+#define DEFAULT_FANOUT 16
+#define DEFAULT_MIN_SIZE (4 * 1024)
+#define DEFAULT_MAX_SIZE (64 * 1024)
+#define DEFAULT_SEED 1
+
+#define MAX_PATH 512
+
+/* description of the directory tree and of the files, shared by all the
+ * threads; files are spread round-robin over the leaf directories, so
+ * several threads work inside the same directory at the same time
+ */
+typedef struct tree_t
+{
+    char root[MAX_PATH / 2];
+    int depth;
+    int fanout;
+    long num_files;
+    long num_leaves;
+    long min_size;
+    long max_size;
+    int fsync;
+    unsigned long seed;
+    pthread_barrier_t barrier;
+    long phase_start[NUM_PHASES + 1];
+} tree_t;
+
+typedef struct thread_arg_t
+{
+    tree_t *tree;
+    int tid;
+    int num_threads;
+    long ops[NUM_PHASES];
+    long bytes[NUM_PHASES];
+    int failed;
+} thread_arg_t;
+
+static const char *phase_names[NUM_PHASES] = {"Mkdir", "Create", "Stat",
+        "Open", "Readdir", "Small-file write", "Small-file read", "Unlink",
+        "Rmdir"};
+
+int parse_option(tree_t *tree, const char *opt)
+{
+    char *end;
+
+    if (strncmp(opt, "--depth=", 8) == 0) {
+        tree->depth = atoi(opt + 8);
+        return tree->depth < 0 ? -1 : 0;
+    } else if (strncmp(opt, "--fanout=", 9) == 0) {
+        tree->fanout = atoi(opt + 9);
+        return tree->fanout <= 0 ? -1 : 0;
+    } else if (strncmp(opt, "--size=", 7) == 0) {
+        tree->min_size = parse_size(opt + 7, &end);
+        tree->max_size = tree->min_size;
+        if (*end == ':') {
+            tree->max_size = parse_size(end + 1, &end);
+        }
+        return (*end != '\0' || tree->min_size < 0
+                || tree->max_size < tree->min_size) ? -1 : 0;
+    } else if (strncmp(opt, "--root=", 7) == 0) {
+        if (strlen(opt + 7) >= sizeof(tree->root)) {
+            return -1;
+        }
+        strcpy(tree->root, opt + 7);
+        return 0;
+    } else if (strcmp(opt, "--fsync") == 0) {
+        tree->fsync = 1;
+        return 0;
+    } else if (strncmp(opt, "--seed=", 7) == 0) {
+        tree->seed = strtoul(opt + 7, NULL, 10);
+        return 0;
+    }
+    return -1;
+}
+
+long num_dirs(tree_t *tree, int level)
+{
+    long n = 1;
+    int i;
+
+    for (i = 0; i < level; ++i) {
+        n *= tree->fanout;
+    }
+    return n;
+}
+
+/* writes the path of the index-th directory of a level (level 0 is the
+ * root), one path component per base-fanout digit of the index
+ */
+void dir_path(tree_t *tree, int level, long index, char *path)
+{
+    int len, i;
+    long div;
+
+    len = sprintf(path, "%s", tree->root);
+    div = num_dirs(tree, level - 1);
+    for (i = 1; i <= level; ++i) {
+        len += sprintf(path + len, "/d%ld", (index / div) % tree->fanout);
+        div /= tree->fanout;
+    }
+}
+
+void file_path(tree_t *tree, long file, char *path)
+{
+    int len;
+
+    dir_path(tree, tree->depth, file % tree->num_leaves, path);
+    len = strlen(path);
+    sprintf(path + len, "/f%ld", file);
+}
+
+long file_size(tree_t *tree, long file)
+{
+    return tree->min_size + (long) (mix64(tree->seed ^ (unsigned long) file)
+            % (unsigned long) (tree->max_size - tree->min_size + 1));
+}
+
+/* waits for every thread to finish the current phase; the last thread to
+ * arrive timestamps the start of the next one
+ */
+void next_phase(thread_arg_t *arg, int phase)
+{
+    if (pthread_barrier_wait(&arg->tree->barrier)
+            == PTHREAD_BARRIER_SERIAL_THREAD) {
+        arg->tree->phase_start[phase] = now_ns();
+    }
+    pthread_barrier_wait(&arg->tree->barrier);
+}
+
+int write_file(tree_t *tree, long file, char *buffer, char *path)
+{
+    long size, rc, rd;
+    int fd;
+
+    fd = open(path, O_WRONLY | O_TRUNC);
+    if (fd < 0) {
+        return -1;
+    }
+    size = file_size(tree, file);
+    rc = 0;
+    while (rc < size) {
+        rd = write(fd, &buffer[rc], size - rc);
+        if (rd < 0) {
+            close(fd);
+            return -1;
+        }
+        rc += rd;
+    }
+    if (tree->fsync && fsync(fd) < 0) {
+        close(fd);
+        return -1;
+    }
+    close(fd);
+
+    return 0;
+}
+
+long read_file(tree_t *tree, char *buffer, char *path)
+{
+    long rc, rd;
+    int fd;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return -1;
+    }
+    rc = 0;
+    do {
+        rd = read(fd, buffer, tree->max_size + 1);
+        if (rd < 0) {
+            close(fd);
+            return -1;
+        }
+        rc += rd;
+    } while (rd > 0);
+    close(fd);
+
+    return rc;
+}
+
+long list_dir(char *path)
+{
+    struct dirent *entry;
+    DIR *dir;
+    long n;
+
+    dir = opendir(path);
+    if (dir == NULL) {
+        return -1;
+    }
+    n = 0;
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] != '.') {
+            n++;
+        }
+    }
+    closedir(dir);
+
+    return n;
+}
+
+/* runs every phase over this thread's share of the directories and files:
+ * directory i and file i belong to thread i % num_threads
+ */
+void *work(void *argv)
+{
+    thread_arg_t *arg = (thread_arg_t *) argv;
+    tree_t *tree = arg->tree;
+    char path[MAX_PATH];
+    char *buffer;
+    struct stat st;
+    long i, n, rc;
+    int level, fd;
+
+    buffer = (char *) malloc((tree->max_size + 1) * sizeof(char));
+    memset(buffer, 'a', tree->max_size + 1);
+
+    next_phase(arg, PHASE_MKDIR);
+    for (level = 1; level <= tree->depth && !arg->failed; ++level) {
+        n = num_dirs(tree, level);
+        for (i = arg->tid; i < n; i += arg->num_threads) {
+            dir_path(tree, level, i, path);
+            if (mkdir(path, 0755) < 0) {
+                arg->failed = 1;
+                break;
+            }
+            arg->ops[PHASE_MKDIR]++;
+        }
+        // the parents of the next level must exist before it is created //
+        pthread_barrier_wait(&tree->barrier);
+    }
+    for (; level <= tree->depth; ++level) {
+        pthread_barrier_wait(&tree->barrier);
+    }
+
+    next_phase(arg, PHASE_CREATE);
+    for (i = arg->tid; i < tree->num_files && !arg->failed;
+            i += arg->num_threads) {
+        file_path(tree, i, path);
+        fd = open(path, O_WRONLY | O_CREAT | O_EXCL, 0644);
+        if (fd < 0) {
+            arg->failed = 1;
+            break;
+        }
+        close(fd);
+        arg->ops[PHASE_CREATE]++;
+    }
+
+    next_phase(arg, PHASE_STAT);
+    for (i = arg->tid; i < tree->num_files && !arg->failed;
+            i += arg->num_threads) {
+        file_path(tree, i, path);
+        if (stat(path, &st) < 0) {
+            arg->failed = 1;
+            break;
+        }
+        arg->ops[PHASE_STAT]++;
+    }
+
+    next_phase(arg, PHASE_OPEN);
+    for (i = arg->tid; i < tree->num_files && !arg->failed;
+            i += arg->num_threads) {
+        file_path(tree, i, path);
+        fd = open(path, O_RDONLY);
+        if (fd < 0) {
+            arg->failed = 1;
+            break;
+        }
+        close(fd);
+        arg->ops[PHASE_OPEN]++;
+    }
+
+    next_phase(arg, PHASE_READDIR);
+    for (i = arg->tid; i < tree->num_leaves && !arg->failed;
+            i += arg->num_threads) {
+        dir_path(tree, tree->depth, i, path);
+        n = list_dir(path);
+        if (n < 0) {
+            arg->failed = 1;
+            break;
+        }
+        arg->ops[PHASE_READDIR]++;
+        arg->bytes[PHASE_READDIR] += n;
+    }
+
+    next_phase(arg, PHASE_WRITE);
+    for (i = arg->tid; i < tree->num_files && !arg->failed;
+            i += arg->num_threads) {
+        file_path(tree, i, path);
+        if (write_file(tree, i, buffer, path) < 0) {
+            arg->failed = 1;
+            break;
+        }
+        arg->ops[PHASE_WRITE]++;
+        arg->bytes[PHASE_WRITE] += file_size(tree, i);
+    }
+
+    next_phase(arg, PHASE_READ);
+    for (i = arg->tid; i < tree->num_files && !arg->failed;
+            i += arg->num_threads) {
+        file_path(tree, i, path);
+        rc = read_file(tree, buffer, path);
+        if (rc < 0) {
+            arg->failed = 1;
+            break;
+        }
+        arg->ops[PHASE_READ]++;
+        arg->bytes[PHASE_READ] += rc;
+    }
+
+    next_phase(arg, PHASE_UNLINK);
+    for (i = arg->tid; i < tree->num_files; i += arg->num_threads) {
+        file_path(tree, i, path);
+        if (unlink(path) == 0) {
+            arg->ops[PHASE_UNLINK]++;
+        }
+    }
+
+    // tear the tree down bottom-up, whatever happened before //
+    next_phase(arg, PHASE_RMDIR);
+    for (level = tree->depth; level >= 1; --level) {
+        n = num_dirs(tree, level);
+        for (i = arg->tid; i < n; i += arg->num_threads) {
+            dir_path(tree, level, i, path);
+            if (rmdir(path) == 0) {
+                arg->ops[PHASE_RMDIR]++;
+            }
+        }
+        pthread_barrier_wait(&tree->barrier);
+    }
+
+    next_phase(arg, NUM_PHASES);
+
+    free(buffer);
+
+    pthread_exit(NULL);
+}
+
+int main(int argc, char **argv)
+{
+    pthread_t *threads;
+    thread_arg_t *args;
+    tree_t tree;
+    topology_t topo;
+    long ops, bytes, elapsed;
+    int num_threads, rc, i, phase, failed;
+
+    // initialized arguments //
+    if (argc <= 2) {
+        printf("program usage: ./benchmark-metadata.exe "
+                "<num_threads> <num_files> [options]\n"
+                "<num_threads> 0 -> the hardware threads of the host\n"
+                "[options] accepts the following values:\n"
+                "\t --depth=<n>         directory levels below the root "
+                "(default 2)\n"
+                "\t --fanout=<n>        subdirectories per directory "
+                "(default 16)\n"
+                "\t --size=<min>[:<max>]  small file size range "
+                "(default 4k:64k)\n"
+                "\t --root=<dir>        root of the tree (default meta.tree)\n"
+                "\t --fsync             fsync every small file after writing\n"
+                "\t --seed=<n>          seed of the file sizes (default 1)\n");
+        exit(-1);
+    }
+
+    memset(&tree, 0, sizeof(tree));
+    strcpy(tree.root, "meta.tree");
+    tree.depth = DEFAULT_DEPTH;
+    tree.fanout = DEFAULT_FANOUT;
+    tree.min_size = DEFAULT_MIN_SIZE;
+    tree.max_size = DEFAULT_MAX_SIZE;
+    tree.seed = DEFAULT_SEED;
+
+    num_threads = atoi(argv[1]);
+    tree.num_files = atol(argv[2]);
+    if (num_threads < 0 || tree.num_files <= 0) {
+        printf("Unsupported number of threads or files\n");
+        exit(-1);
+    }
+    for (i = 3; i < argc; ++i) {
+        if (parse_option(&tree, argv[i]) < 0) {
+            printf("Unsupported option %s\n", argv[i]);
+            exit(-1);
+        }
+    }
+    tree.num_leaves = num_dirs(&tree, tree.depth);
+
+    // creating the root of the tree //
+    if (mkdir(tree.root, 0755) < 0) {
+        printf("Could not create root directory %s\n", tree.root);
+        exit(-2);
+    }
+
+    // describing the host, with the disk holding the tree //
+    topology_read(&topo, tree.root);
+    topology_print(&topo);
+    if (num_threads == 0) {
+        num_threads = topo.threads;
+    }
+
+    pthread_barrier_init(&tree.barrier, NULL, num_threads);
+    threads = (pthread_t *) malloc(num_threads * sizeof(pthread_t));
+    args = (thread_arg_t *) calloc(num_threads, sizeof(thread_arg_t));
+
+    // starting worker threads //
+    for (i = 0; i < num_threads; ++i) {
+        args[i].tree = &tree;
+        args[i].tid = i;
+        args[i].num_threads = num_threads;
+        rc = pthread_create(&threads[i], NULL, work, &args[i]);
+
+        if (rc) {
+            printf("Could not create thread %d!\n", i);
+            exit(-3);
+        }
+    }
+
+    // joining worker threads //
+    failed = 0;
+    for (i = 0; i < num_threads; ++i) {
+        rc = pthread_join(threads[i], NULL);
+
+        if (rc) {
+            printf("Could not terminate thread %d!\n", i);
+            exit(-3);
+        }
+        failed |= args[i].failed;
+    }
+
+    if (rmdir(tree.root) < 0 || failed) {
+        printf("Error while building or tearing down the tree under %s\n",
+                tree.root);
+    }
+
+    printf("Tree: %d levels, fanout %d, %ld directories with %ld files, "
+            "%ld-%ld B files\n", tree.depth, tree.fanout, tree.num_leaves,
+            tree.num_files, tree.min_size, tree.max_size);
+    for (phase = 0; phase < NUM_PHASES; ++phase) {
+        ops = 0;
+        bytes = 0;
+        for (i = 0; i < num_threads; ++i) {
+            ops += args[i].ops[phase];
+            bytes += args[i].bytes[phase];
+        }
+        elapsed = (tree.phase_start[phase + 1] - tree.phase_start[phase])
+                / 1000;
+        if (elapsed <= 0) {
+            elapsed = 1;
+        }
+        printf("%s: %.0lf ops/s", phase_names[phase], ops * 1e6 / elapsed);
+        if (phase == PHASE_READDIR) {
+            printf(" (%.0lf entries/s)", bytes * 1e6 / elapsed);
+        } else if (phase == PHASE_WRITE || phase == PHASE_READ) {
+            printf(" (%lf MB/s)", (double) bytes / elapsed);
+        }
+        printf("\n");
+    }
+
+    pthread_barrier_destroy(&tree.barrier);
+    free(threads);
+    free(args);
+
+    return failed ? -4 : 0;
+}
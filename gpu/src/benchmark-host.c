@@ -0,0 +1,398 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "topology.h"
+
+/* default size of the vectors, the same as on the device; used when the
+ * size of the last level cache of the host is unknown
+ */
+#define DLEN 262144
+
+/* vectors of the kernel, which by default fill half the last level cache */
+#define NUM_VECS 4
+
+/* debug mode prints the contents of the matrices after the calculation
+ * 0 - deactivate debug mode
+ * 1 - activate debug mode
+ */
+#define DEBUG 0
+
+/* macro definition set up at compile time, deciding the data type
+ * and precision to be used;
+ */
+#ifdef DOUBLE
+#define DSIZE sizeof(double)
+typedef double DTYPE;
+#elif FLOAT
+#define DSIZE sizeof(float)
+typedef float DTYPE;
+#endif
+
+/* width of the explicit vectors, the widest the target supports */
+#if defined(__AVX512F__)
+#define VBYTES 64
+#elif defined(__AVX__)
+#define VBYTES 32
+#else
+#define VBYTES 16
+#endif
+
+/* number of elements in one vector and the alignment of the slices */
+#define VLEN (VBYTES / DSIZE)
+#define ALIGNMENT 64
+
+/* structure of the iteration loop:
+ * forkjoin - the threads are created and joined for every iteration, the
+ *            host counterpart of a launch followed by a synchronization
+ * barrier  - persistent threads meet at a barrier after every iteration
+ * fused    - persistent threads run FUSE iterations between two barriers
+ */
+#define STRUCT_FORKJOIN 0
+#define STRUCT_BARRIER 1
+#define STRUCT_FUSED 2
+#define NUM_STRUCTS 3
+
+/* default number of iterations fused between two barriers */
+#define FUSE 16
+
+/* floating point operations and bytes moved per element of D */
+#define FLOPS_PER_ELEM 3
+#define BYTES_PER_ELEM (4 * DSIZE)
+
+typedef DTYPE vec_t __attribute__((vector_size(VBYTES), may_alias));
+
+/* the slice of the vectors computed by one thread; every fuse iterations
+ * are followed by a barrier, the host counterpart of cudaDeviceSynchronize
+ */
+typedef struct thread_arg_t
+{
+    DTYPE *A;
+    DTYPE *B;
+    DTYPE *C;
+    DTYPE *D;
+    DTYPE s;
+    long start;
+    long end;
+    int iterations;
+    int fuse;
+    pthread_barrier_t *barrier;
+} thread_arg_t;
+
+const char *struct_names[NUM_STRUCTS] = { "forkjoin", "barrier", "fused" };
+
+/* function that initializes the values in a vector given as paramenter,
+ * and that has a definition and implementation dependent on the
+ * definition of several macros in order to determine the data type of
+ * the vector;
+ */
+void init(DTYPE *vec, long N)
+{
+    long i;
+    int sign;
+    DTYPE x, y;
+
+    for (i = 0; i < N; ++i) {
+        x = rand() % 100;
+        y = (rand() + 1) % 100;
+        sign = (-1) + (rand() % 2 * 2);
+        vec[i] = sign * (x / y);
+    }
+}
+
+/* function that prints the contents of a vector given as parameter,
+ * and that has a definition and implementation dependent on the
+ * definition of several macros in order to determine the data type of
+ * the vector;
+ */
+void print_vec(DTYPE *vec, long N)
+{
+    long i;
+
+    for (i = 0; i < N; i++) {
+#ifdef DOUBLE
+        printf("%lf ", vec[i]);
+#elif FLOAT
+        printf("%f ", vec[i]);
+#endif
+    }
+    printf("\n");
+}
+
+/* host function that D = A * B * scalar + C over [start, end), one vector
+ * at a time; the slices start on aligned elements, so only the end of the
+ * last slice needs the scalar loop
+ */
+void func(DTYPE *A, DTYPE *B, DTYPE *C, DTYPE *D, DTYPE s, long start,
+        long end)
+{
+    vec_t a, b, c, d;
+    long i;
+
+    for (i = start; i + (long) VLEN <= end; i += VLEN) {
+        a = *(vec_t *) &A[i];
+        b = *(vec_t *) &B[i];
+        c = *(vec_t *) &C[i];
+        d = a * b * s + c;
+        *(vec_t *) &D[i] = d;
+    }
+    for (; i < end; ++i) {
+        D[i] = A[i] * B[i] * s + C[i];
+    }
+}
+
+void *work(void *argv)
+{
+    thread_arg_t *arg;
+    int i;
+
+    arg = (thread_arg_t *) argv;
+
+    for (i = 0; i < arg->iterations; ++i) {
+        func(arg->A, arg->B, arg->C, arg->D, arg->s, arg->start, arg->end);
+        if (arg->barrier != NULL && ((i + 1) % arg->fuse == 0
+                || i + 1 == arg->iterations)) {
+            pthread_barrier_wait(arg->barrier);
+        }
+    }
+
+    pthread_exit(NULL);
+}
+
+/* runs the N iterations with one of the loop structures and returns the
+ * wall time in microseconds
+ */
+long run(int structure, int N, int fuse, pthread_t *threads,
+        thread_arg_t *args, int num_threads)
+{
+    pthread_barrier_t barrier;
+    struct timespec start, end;
+    int i, it, rounds;
+
+    pthread_barrier_init(&barrier, NULL, num_threads);
+    for (i = 0; i < num_threads; ++i) {
+        args[i].iterations = N;
+        args[i].fuse = structure == STRUCT_FUSED ? fuse : 1;
+        args[i].barrier = &barrier;
+    }
+
+    // fork and join replace the barrier, one round per iteration //
+    rounds = 1;
+    if (structure == STRUCT_FORKJOIN) {
+        rounds = N;
+        for (i = 0; i < num_threads; ++i) {
+            args[i].iterations = 1;
+            args[i].barrier = NULL;
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (it = 0; it < rounds; ++it) {
+        for (i = 0; i < num_threads; ++i) {
+            if (pthread_create(&threads[i], NULL, work, (void *) &args[i])) {
+                fprintf(stderr, "Could not create thread!\n");
+                exit(-3);
+            }
+        }
+        for (i = 0; i < num_threads; ++i) {
+            pthread_join(threads[i], NULL);
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    pthread_barrier_destroy(&barrier);
+
+    return ((long) end.tv_sec - (long) start.tv_sec) * 1000000
+            + (end.tv_nsec - start.tv_nsec) / 1000;
+}
+
+void print_result(long runtime, long len, int N)
+{
+    if (runtime <= 0) {
+        runtime = 1;
+    }
+
+    printf("Execution time: %ldus\n", runtime);
+    printf("GFlops: %lf\n", (double) FLOPS_PER_ELEM * len * N / runtime
+            / 1000.0);
+    printf("GB/s: %lf\n", (double) BYTES_PER_ELEM * len * N / runtime
+            / 1000.0);
+}
+
+/* parses the options following the positional arguments; returns -1 on
+ * errors
+ */
+int parse_option(const char *opt, int *structure, int *fuse)
+{
+    int i;
+
+    if (strncmp(opt, "--structure=", 12) == 0) {
+        if (strcmp(opt + 12, "compare") == 0) {
+            *structure = -1;
+            return 0;
+        }
+        for (i = 0; i < NUM_STRUCTS; ++i) {
+            if (strcmp(opt + 12, struct_names[i]) == 0) {
+                *structure = i;
+                return 0;
+            }
+        }
+    } else if (strncmp(opt, "--fuse=", 7) == 0) {
+        *fuse = atoi(opt + 7);
+        return *fuse <= 0 ? -1 : 0;
+    }
+    return -1;
+}
+
+DTYPE *alloc_vec(long N)
+{
+    void *vec;
+
+    if (posix_memalign(&vec, ALIGNMENT, DSIZE * N) != 0) {
+        fprintf(stderr, "Could not allocate vector!\n");
+        exit(-1);
+    }
+    return (DTYPE *) vec;
+}
+
+int main(int argc, char **argv)
+{
+    int N, i, num_threads, structure, fuse, st;
+    long len, chunk, runtimes[NUM_STRUCTS];
+    DTYPE *A, *B, *C, *D, scalar;
+    pthread_t *threads;
+    thread_arg_t *args;
+    topology_t topo;
+
+    if (argc <= 2) {
+        fprintf(stderr, "program usage: <./benchmark-host.exe> <iterations> "
+                "<num_threads> [length] [options]\n"
+                "where <num_threads> 0 runs one thread per hardware thread "
+                "of the host\n"
+                "where [options] accepts the following values:\n"
+                "\t --structure=<s>   iteration loop: forkjoin, barrier "
+                "(default), fused or\n"
+                "\t                   compare, which runs all three\n"
+                "\t --fuse=<k>        iterations between two barriers of "
+                "the fused loop (default 16)\n");
+        return -1;
+    } else {
+        // describing the host //
+        topology_read(&topo, NULL);
+        topology_print(&topo);
+        N = atoi(argv[1]);
+        num_threads = atoi(argv[2]);
+        if (num_threads == 0) {
+            num_threads = topo.threads;
+        }
+        len = topology_llc(&topo) / 2 / (NUM_VECS * DSIZE);
+        len -= len % (ALIGNMENT / DSIZE);
+        if (len <= 0) {
+            len = DLEN;
+        }
+        i = 3;
+        if (argc > 3 && strncmp(argv[3], "--", 2) != 0) {
+            len = atol(argv[3]);
+            i = 4;
+        }
+        structure = STRUCT_BARRIER;
+        fuse = FUSE;
+        for (; i < argc; ++i) {
+            if (parse_option(argv[i], &structure, &fuse) < 0) {
+                fprintf(stderr, "Unrecognized option %s!\n", argv[i]);
+                return -1;
+            }
+        }
+        if (N <= 0 || num_threads <= 0 || len <= 0) {
+            fprintf(stderr, "The arguments must be positive!\n");
+            return -1;
+        }
+    }
+
+    A = alloc_vec(len);
+    B = alloc_vec(len);
+    C = alloc_vec(len);
+    D = alloc_vec(len);
+
+    srand(time(NULL));
+    init(A, len);
+    init(B, len);
+    init(C, len);
+    scalar = ((-1) + (rand() % 2 * 2)) * (rand() % 10 + 1);
+
+    if (DEBUG) {
+        printf("A = \n");
+        print_vec(A, len);
+        printf("B = \n");
+        print_vec(B, len);
+        printf("C = \n");
+        print_vec(C, len);
+#ifdef DOUBLE
+        printf("scalar = %lf\n", scalar);
+#elif FLOAT
+        printf("scalar = %f\n", scalar);
+#endif
+    }
+
+    // the slices are whole cache lines, the last one takes the rest, so
+    // every thread needs at least one line; func relies on the alignment //
+    if (len / (ALIGNMENT / DSIZE) < num_threads) {
+        num_threads = len / (ALIGNMENT / DSIZE) > 0
+                ? len / (ALIGNMENT / DSIZE) : 1;
+        fprintf(stderr, "Running %d thread(s), one per cache line of the "
+                "vectors\n", num_threads);
+    }
+    chunk = len / num_threads;
+    chunk -= chunk % (ALIGNMENT / DSIZE);
+
+    threads = (pthread_t *) malloc(num_threads * sizeof(pthread_t));
+    args = (thread_arg_t *) malloc(num_threads * sizeof(thread_arg_t));
+
+    for (i = 0; i < num_threads; ++i) {
+        args[i].A = A;
+        args[i].B = B;
+        args[i].C = C;
+        args[i].D = D;
+        args[i].s = scalar;
+        args[i].start = i * chunk;
+        args[i].end = i == num_threads - 1 ? len : (i + 1) * chunk;
+    }
+
+    for (st = 0; st < NUM_STRUCTS; ++st) {
+        if (structure >= 0 && st != structure) {
+            continue;
+        }
+        runtimes[st] = run(st, N, fuse, threads, args, num_threads);
+
+        if (structure < 0) {
+            printf("Structure: %s\n", struct_names[st]);
+        }
+        print_result(runtimes[st], len, N);
+    }
+
+    // the fused loop has the least overhead, the others pay the difference //
+    if (structure < 0) {
+        for (st = 0; st < STRUCT_FUSED; ++st) {
+            printf("Overhead of %s: %.3lf us per iteration over fused\n",
+                    struct_names[st],
+                    (double) (runtimes[st] - runtimes[STRUCT_FUSED]) / N);
+        }
+    }
+
+    if (DEBUG) {
+        printf("D = \n");
+        print_vec(D, len);
+    }
+
+    free(threads);
+    free(args);
+
+    free(A);
+    free(B);
+    free(C);
+    free(D);
+
+    return 0;
+}
@@ -1,11 +1,12 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 
 /* number of threads defined in a block */
 //#define NUMTHREADS 64
 
-/* size of the vectors */
+/* default size of the vectors, changed by the optional length argument */
 #define DLEN 262144
 
 /* debug mode prints the contents of the matrices after the calculation
@@ -25,6 +26,27 @@ typedef double DTYPE;
 typedef float DTYPE;
 #endif
 
+/* structure of the iteration loop:
+ * sync  - every launch is followed by cudaDeviceSynchronize()
+ * batch - all the launches are queued, then synchronized once
+ * fused - every launch runs FUSE iterations, then synchronizes
+ */
+#define STRUCT_SYNC 0
+#define STRUCT_BATCH 1
+#define STRUCT_FUSED 2
+#define NUM_STRUCTS 3
+
+/* default number of iterations fused into one launch */
+#define FUSE 16
+
+const char *struct_names[NUM_STRUCTS] = { "sync", "batch", "fused" };
+
+/* floating point operations and bytes moved per element of D, the same
+ * accounting as the host backend
+ */
+#define FLOPS_PER_ELEM 3
+#define BYTES_PER_ELEM (4 * DSIZE)
+
 /* function that initializes the values in a vector given as paramenter,
  * and that has a definition and implementation dependent on the
  * definition of several macros in order to determine the data type of 
@@ -65,47 +87,153 @@ __host__ void print_vec(DTYPE *vec, int N)
 /* GPU device function that D = A * B * scalar + C */
 __global__ void func(DTYPE *A, DTYPE *B, DTYPE *C, DTYPE *D, DTYPE s, int N) {
     int index = blockIdx.x * blockDim.x + threadIdx.x;
-    D[index] = A[index] * B[index] * s + C[index];
+    if (index < N) {
+        D[index] = A[index] * B[index] * s + C[index];
+    }
+}
+
+/* GPU device function that runs k iterations of D = A * B * scalar + C;
+ * the volatile accesses keep every iteration's loads and stores, so that
+ * fusing removes the launch overhead only
+ */
+__global__ void func_fused(DTYPE *A, DTYPE *B, DTYPE *C, DTYPE *D, DTYPE s,
+        int N, int k) {
+    int index = blockIdx.x * blockDim.x + threadIdx.x;
+    volatile DTYPE *vA = A, *vB = B, *vC = C, *vD = D;
+    int j;
+
+    if (index < N) {
+        for (j = 0; j < k; ++j) {
+            vD[index] = vA[index] * vB[index] * s + vC[index];
+        }
+    }
+}
+
+/* runs the N iterations with one of the loop structures and returns the
+ * wall time in microseconds; clock() would only count the host's cpu time
+ */
+__host__ long run(int structure, int N, int fuse, int NUMTHREADS, int len,
+        DTYPE *dA, DTYPE *dB, DTYPE *dC, DTYPE *dD, DTYPE scalar)
+{
+    struct timespec start, end;
+    int i, blocks;
+
+    blocks = (len + NUMTHREADS - 1) / NUMTHREADS;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (structure == STRUCT_FUSED) {
+        for (i = 0; i < N; i += fuse) {
+            func_fused<<<blocks, NUMTHREADS>>>(dA, dB, dC, dD, scalar, len,
+                    N - i < fuse ? N - i : fuse);
+            cudaDeviceSynchronize();
+        }
+    } else {
+        for (i = 0; i < N; ++i) {
+            func<<<blocks, NUMTHREADS>>>(dA, dB, dC, dD, scalar, len);
+            if (structure == STRUCT_SYNC) {
+                cudaDeviceSynchronize();
+            }
+        }
+        cudaDeviceSynchronize();
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    return ((long) end.tv_sec - (long) start.tv_sec) * 1000000
+            + (end.tv_nsec - start.tv_nsec) / 1000;
+}
+
+__host__ void print_result(long runtime, int len, int N)
+{
+    if (runtime <= 0) {
+        runtime = 1;
+    }
+
+    printf("Execution time: %ldus\n", runtime);
+    printf("GFlops: %lf\n", (double) FLOPS_PER_ELEM * len * N / runtime
+            / 1000.0);
+    printf("GB/s: %lf\n", (double) BYTES_PER_ELEM * len * N / runtime
+            / 1000.0);
+}
+
+/* parses the options following the positional arguments; returns -1 on
+ * errors
+ */
+__host__ int parse_option(const char *opt, int *structure, int *fuse)
+{
+    int i;
+
+    if (strncmp(opt, "--structure=", 12) == 0) {
+        if (strcmp(opt + 12, "compare") == 0) {
+            *structure = -1;
+            return 0;
+        }
+        for (i = 0; i < NUM_STRUCTS; ++i) {
+            if (strcmp(opt + 12, struct_names[i]) == 0) {
+                *structure = i;
+                return 0;
+            }
+        }
+    } else if (strncmp(opt, "--fuse=", 7) == 0) {
+        *fuse = atoi(opt + 7);
+        return *fuse <= 0 ? -1 : 0;
+    }
+    return -1;
 }
 
 int main(int argc, char **argv)
 {
-    int N, i, NUMTHREADS;
+    int N, i, NUMTHREADS, len, structure, fuse, st;
     DTYPE *A, *B, *C, *D, scalar;
     DTYPE *dA, *dB, *dC, *dD;
-    clock_t start, end;
+    long runtimes[NUM_STRUCTS];
 
-    if (argc <= 1 || argc >= 4) {
-        perror("program usage: <./benchmark.exe> <iterations> <num_threads");
+    if (argc <= 2) {
+        perror("program usage: <./benchmark.exe> <iterations> <num_threads> "
+                "[length] [--structure=sync|batch|fused|compare] "
+                "[--fuse=<k>]");
         return -1;
     } else {
         N = atoi(argv[1]);
         NUMTHREADS = atoi(argv[2]);
+        len = DLEN;
+        i = 3;
+        if (argc > 3 && strncmp(argv[3], "--", 2) != 0) {
+            len = atoi(argv[3]);
+            i = 4;
+        }
+        structure = STRUCT_SYNC;
+        fuse = FUSE;
+        for (; i < argc; ++i) {
+            if (parse_option(argv[i], &structure, &fuse) < 0) {
+                fprintf(stderr, "Unrecognized option %s!\n", argv[i]);
+                return -1;
+            }
+        }
     }
 
-    A = (DTYPE *) malloc(DSIZE * DLEN);
-    B = (DTYPE *) malloc(DSIZE * DLEN);
-    C = (DTYPE *) malloc(DSIZE * DLEN);
-    D = (DTYPE *) malloc(DSIZE * DLEN);
+    A = (DTYPE *) malloc(DSIZE * len);
+    B = (DTYPE *) malloc(DSIZE * len);
+    C = (DTYPE *) malloc(DSIZE * len);
+    D = (DTYPE *) malloc(DSIZE * len);
 
-    cudaMalloc((void **) &dA, DSIZE * DLEN);
-    cudaMalloc((void **) &dB, DSIZE * DLEN);
-    cudaMalloc((void **) &dC, DSIZE * DLEN);
-    cudaMalloc((void **) &dD, DSIZE * DLEN);
+    cudaMalloc((void **) &dA, DSIZE * len);
+    cudaMalloc((void **) &dB, DSIZE * len);
+    cudaMalloc((void **) &dC, DSIZE * len);
+    cudaMalloc((void **) &dD, DSIZE * len);
 
     srand(time(NULL));
-    init(A, DLEN);
-    init(B, DLEN);
-    init(C, DLEN);
+    init(A, len);
+    init(B, len);
+    init(C, len);
     scalar = ((-1) + (rand() % 2 * 2)) * (rand() % 10 + 1);
 
     if (DEBUG) {
         printf("A = \n");
-        print_vec(A, DLEN);
+        print_vec(A, len);
         printf("B = \n");
-        print_vec(B, DLEN);
+        print_vec(B, len);
         printf("C = \n");
-        print_vec(C, DLEN);
+        print_vec(C, len);
 #ifdef DOUBLE
         printf("scalar = %lf\n", scalar);
 #elif FLOAT
@@ -113,27 +241,39 @@ int main(int argc, char **argv)
 #endif
     }
 
-    cudaMemcpy(dA, A, DSIZE * DLEN, cudaMemcpyHostToDevice);
-    cudaMemcpy(dB, B, DSIZE * DLEN, cudaMemcpyHostToDevice);
-    cudaMemcpy(dC, C, DSIZE * DLEN, cudaMemcpyHostToDevice);
+    cudaMemcpy(dA, A, DSIZE * len, cudaMemcpyHostToDevice);
+    cudaMemcpy(dB, B, DSIZE * len, cudaMemcpyHostToDevice);
+    cudaMemcpy(dC, C, DSIZE * len, cudaMemcpyHostToDevice);
     
-    start = clock();
-    for (i = 0; i < N; ++i) {
-        func<<<(DLEN / NUMTHREADS), NUMTHREADS>>>(dA, dB, dC, dD, scalar, DLEN);
-        cudaDeviceSynchronize();
+    for (st = 0; st < NUM_STRUCTS; ++st) {
+        if (structure >= 0 && st != structure) {
+            continue;
+        }
+        runtimes[st] = run(st, N, fuse, NUMTHREADS, len, dA, dB, dC, dD,
+                scalar);
+
+        if (structure < 0) {
+            printf("Structure: %s\n", struct_names[st]);
+        }
+        print_result(runtimes[st], len, N);
     }
-    end = clock();
 
-    cudaMemcpy(D, dD, DSIZE * DLEN, cudaMemcpyDeviceToHost);
+    // the fused loop has the least overhead, the others pay the difference //
+    if (structure < 0) {
+        for (st = 0; st < STRUCT_FUSED; ++st) {
+            printf("Overhead of %s: %.3lf us per iteration over fused\n",
+                    struct_names[st],
+                    (double) (runtimes[st] - runtimes[STRUCT_FUSED]) / N);
+        }
+    }
+
+    cudaMemcpy(D, dD, DSIZE * len, cudaMemcpyDeviceToHost);
     
     if (DEBUG) {
         printf("D = \n");
-        print_vec(D, DLEN);
+        print_vec(D, len);
     }
 
-    printf("Execution time: %ldus\n", 
-            ((long) (end - start) * 1000000) / CLOCKS_PER_SEC);
-
     cudaFree(dA);
     cudaFree(dB);
     cudaFree(dC);
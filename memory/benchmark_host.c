@@ -2,16 +2,33 @@
 // Written by David Ghiurco.
 //
 
+#define _GNU_SOURCE
+
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <pthread.h>
 #include <math.h>
 #include <sys/time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "autotune.h"
+#include "topology.h"
+
 
+double benchmark(const char *type, size_t blk_size, int num_threads);
+
+void autotune(const char *type, double budget, const char *profile);
+
+void load_profile(const char *type, const char *profile, size_t *blk_size, int *num_threads);
 
 double work(size_t blk_size, int num_threads, void *thread_function, char *block, char *cp_block);
 
+char *alloc_block(void);
+
+long lcm(long a, long b);
+
 void *read_and_write_thread(void *param);
 
 void *seq_write_access_thread(void *param);
@@ -24,14 +41,6 @@ void swap (long *a, long *b);
 // A utility function to generate a random permutation of arr[]
 void randomize (long *arr, long n);
 
-// parameter struct
-struct thread_sub_block {
-    int block_number;
-    int num_blocks;
-    size_t blk_size;
-    char *block;
-    char *cp_block;
-};
 
 
 // 1.28 GB block --> allows for equal split of work for all threads and block sizes
@@ -40,63 +49,296 @@ struct thread_sub_block {
 #define GIGABYTE_BLOCK 1280000000
 #define NUM_EXPERIMENT_REPEATS 15
 
+// the bytes of a block: the gigabyte block, or a multiple of 80 MB that keeps the two blocks of
+// read_and_write within half the available memory of smaller hosts
+#define MIN_BLOCK 80000000
+long block_bytes = GIGABYTE_BLOCK;
+
+// the host the benchmark runs on, printed with every result
+topology_t topo;
+
+// the alignment of the blocks and of the thread parts in bytes: a cache line
+// by default, a huge page, or 0 for the malloc'd blocks split in equal parts
+#define CACHE_LINE 64
+#define HUGE_PAGE (2 * 1024 * 1024)
+long alignment = CACHE_LINE;
+
+// the repeats of an experiment; the autotune mode shortens them and warms the blocks up first
+int repeats = NUM_EXPERIMENT_REPEATS;
+int warmup = 0;
+
+// the search space of the autotune mode: the powers of two up to the hardware threads and the
+// hardware threads, the block sizes from 8 KB up (8 B blocks measure the latency, never the best
+// throughput) and the alignments
+#define MAX_THREADS 64
+#define NUM_ALIGNS 3
+#define TUNE_BUDGET 120
+const size_t tune_sizes[] = {8000, 64000, 1000000, 8000000, 80000000};
+#define NUM_TUNE_SIZES (sizeof(tune_sizes) / sizeof(tune_sizes[0]))
+const char *align_names[NUM_ALIGNS] = {"none", "line", "huge"};
+const long align_values[NUM_ALIGNS] = {0, CACHE_LINE, HUGE_PAGE};
+
+struct memory_tune {
+    const char *type;
+    int threads[MAX_THREADS];
+    int num_threads;
+};
+
+// parameter struct, padded to its own cache lines; start_index and
+// end_index bound the part of the block written by the thread
+struct thread_sub_block {
+    size_t blk_size;
+    char *block;
+    char *cp_block;
+    long start_index;
+    long end_index;
+} __attribute__((aligned(CACHE_LINE)));
+
 
 int main(int argc, char *argv[]) {
     /*
      * Usage:
-     * $ benchmark_host <type> <block_size> <num_threads>
+     * $ benchmark_host <type> <block_size> [num_threads] [--align=none|line|huge] [--align-diagnostics]
+     * $ benchmark_host <type> autotune [--budget=<sec>] [--profile=<file>]
+     * $ benchmark_host <type> profile [--profile=<file>]
      * type: 'read_and_write' or 'seq_write_access' or 'random_write_access'
      * block_size: # of bytes
-     * num_threads: 1, 2, 4, 8
+     * num_threads: 1, 2, 4, 8 (default: the physical cores)
+     * autotune: searches the block size, threads and alignment with the best throughput within
+     *           --budget seconds (default 120) and stores them in the host profile
+     * profile: runs with the configuration stored in the host profile
+     * --align: aligns the blocks and the part of every thread to a cache line (default)
+     *          or a 2 MB huge page; none splits malloc'd blocks in equal parts
+     * --align-diagnostics: runs unaligned, then aligned, and compares
      */
 
-    if (argc != 4) {
-        printf("Error: 3 parameters required\n");
+    if (argc < 3) {
+        printf("Error: at least 2 parameters required\n");
         exit(1);
     }
 
-    size_t blk_size = (size_t) atoi(argv[2]);
-    int num_threads = atoi(argv[3]);
-
-    // all experiments will need a gigabyte block, but only the memcpy experiment needs a second gigabyte block
-    char *block = malloc(GIGABYTE_BLOCK);
-    if (block == NULL) {
-        printf("Out of memory!\n");
-        exit(1);
+    topology_read(&topo, NULL);
+    topology_print(&topo);
+    if (topo.memory_available_kb > 0) {
+        long quarter = topo.memory_available_kb * 1024 / 4 / MIN_BLOCK * MIN_BLOCK;
+        block_bytes = quarter < MIN_BLOCK ? MIN_BLOCK : quarter < block_bytes ? quarter : block_bytes;
     }
-    char *cp_block;
 
-    double sum = 0;
-    if (strcmp(argv[1], "read_and_write") == 0) { ;
-        cp_block = malloc(GIGABYTE_BLOCK);
-        if (cp_block == NULL) {
-            printf("Out of memory!\n");
+    int tuned = strcmp(argv[2], "autotune") == 0 || strcmp(argv[2], "profile") == 0;
+    int has_threads = !tuned && argc >= 4 && strncmp(argv[3], "--", 2) != 0;
+    size_t blk_size = tuned ? 0 : (size_t) atoi(argv[2]);
+    int num_threads = has_threads ? atoi(argv[3]) : topo.cores;
+
+    int diagnostics = 0;
+    double budget = TUNE_BUDGET;
+    const char *profile = NULL;
+    for (int i = has_threads ? 4 : 3; i < argc; i++) {
+        if (strcmp(argv[i], "--align=none") == 0) {
+            alignment = 0;
+        } else if (strcmp(argv[i], "--align=line") == 0) {
+            alignment = CACHE_LINE;
+        } else if (strcmp(argv[i], "--align=huge") == 0) {
+            alignment = HUGE_PAGE;
+        } else if (strcmp(argv[i], "--align-diagnostics") == 0) {
+            diagnostics = 1;
+        } else if (strncmp(argv[i], "--budget=", 9) == 0) {
+            budget = atof(argv[i] + 9);
+        } else if (strncmp(argv[i], "--profile=", 10) == 0) {
+            profile = argv[i] + 10;
+        } else {
+            printf("Usage error: unknown option %s\n", argv[i]);
             exit(1);
         }
-        // repeat the benchmark NUM_EXPERIMENT_REPEATs times, and aggregate the runtime in microseconds
-        for (int i = 0; i < NUM_EXPERIMENT_REPEATS; i++)
-            sum += work(blk_size, num_threads, read_and_write_thread, block, cp_block);
-    } else if (strcmp(argv[1], "seq_write_access") == 0) {
-        cp_block = NULL;
-        for (int i = 0; i < NUM_EXPERIMENT_REPEATS; i++)
-            sum += work(blk_size, num_threads, seq_write_access_thread, block, cp_block);
-    } else if (strcmp(argv[1], "random_write_access") == 0) {
-        cp_block = NULL;
-        for (int i = 0; i < NUM_EXPERIMENT_REPEATS; i++)
-            sum += work(blk_size, num_threads, random_write_access_thread, block, cp_block);
+    }
+
+    profile = profile_path(profile);
+    if (strcmp(argv[2], "autotune") == 0) {
+        autotune(argv[1], budget, profile);
+        exit(0);
+    } else if (strcmp(argv[2], "profile") == 0) {
+        load_profile(argv[1], profile, &blk_size, &num_threads);
+    }
+
+    if (!diagnostics) {
+        double mbps = benchmark(argv[1], blk_size, num_threads);
+        printf("MBps: %f\n", mbps);
+        exit(0);
+    }
+
+    // the unaligned layout is the layout before the parts were aligned
+    long aligned = alignment != 0 ? alignment : CACHE_LINE;
+
+    alignment = 0;
+    double unaligned_mbps = benchmark(argv[1], blk_size, num_threads);
+    printf("Alignment: none\n");
+    printf("MBps: %f\n", unaligned_mbps);
+
+    alignment = aligned;
+    double aligned_mbps = benchmark(argv[1], blk_size, num_threads);
+    printf("Alignment: %s\n", aligned == HUGE_PAGE ? "huge" : "line");
+    printf("MBps: %f\n", aligned_mbps);
+
+    printf("Aligned speedup over unaligned: %.3f\n", aligned_mbps / unaligned_mbps);
+
+    exit(0);
+}
+
+/*
+ * Allocates the blocks of the experiment, runs it 'repeats' times (after an untimed run that
+ * faults the pages in, when warming up)
+ * Returns the average throughput (in MBps)
+ */
+double benchmark(const char *type, size_t blk_size, int num_threads) {
+    // all experiments will need a gigabyte block, but only the memcpy experiment needs a second gigabyte block
+    char *block = alloc_block();
+    char *cp_block = NULL;
+    void *thread_function;
+
+    double sum = 0;
+    if (strcmp(type, "read_and_write") == 0) { ;
+        cp_block = alloc_block();
+        thread_function = read_and_write_thread;
+    } else if (strcmp(type, "seq_write_access") == 0) {
+        thread_function = seq_write_access_thread;
+    } else if (strcmp(type, "random_write_access") == 0) {
+        thread_function = random_write_access_thread;
     } else {
         printf("Usage error\n");
         exit(1);
     }
-    // Divide the total aggregated runtime by the total number of experiments to get an average throughput
-    // Note: For the latency experiments, throughput will be converted to latency through unit conversions
-    double mbps = sum / NUM_EXPERIMENT_REPEATS;
-    printf("MBps: %f\n", mbps);
+
+    if (warmup) {
+        work(blk_size, num_threads, thread_function, block, cp_block);
+    }
+    // repeat the benchmark 'repeats' times, and aggregate the runtime in microseconds
+    for (int i = 0; i < repeats; i++)
+        sum += work(blk_size, num_threads, thread_function, block, cp_block);
 
     free(block);
     free(cp_block);
 
-    exit(0);
+    // Divide the total aggregated runtime by the total number of experiments to get an average throughput
+    // Note: For the latency experiments, throughput will be converted to latency through unit conversions
+    return sum / repeats;
+}
+
+/*
+ * Runs configuration 'config' of the autotune search with the given repeats
+ * Returns the throughput (in MBps)
+ */
+double tune_eval(int config, long resource, void *ctx) {
+    struct memory_tune *space = ctx;
+    int align = config % NUM_ALIGNS;
+    int size = config / NUM_ALIGNS % NUM_TUNE_SIZES;
+    int threads = config / NUM_ALIGNS / NUM_TUNE_SIZES;
+
+    alignment = align_values[align];
+    repeats = (int) resource;
+    warmup = 1;
+    return benchmark(space->type, tune_sizes[size], space->threads[threads]);
+}
+
+void tune_describe(int config, char *buf, int len, void *ctx) {
+    struct memory_tune *space = ctx;
+    snprintf(buf, len, "block_size=%zu threads=%d align=%s", tune_sizes[config / NUM_ALIGNS % NUM_TUNE_SIZES],
+             space->threads[config / NUM_ALIGNS / NUM_TUNE_SIZES], align_names[config % NUM_ALIGNS]);
+}
+
+/*
+ * Searches the block size, thread count and alignment with the best throughput by successive halving
+ * over the repeats, within 'budget' seconds, and stores the best configuration in the host profile as
+ * memory.<type>.block_size, memory.<type>.threads and memory.<type>.align
+ */
+void autotune(const char *type, double budget, const char *profile) {
+    struct memory_tune space;
+    space.type = type;
+    space.num_threads = 0;
+    int hw_threads = topo.threads;
+    for (int t = 1; space.num_threads < MAX_THREADS; t *= 2) {
+        space.threads[space.num_threads++] = t < hw_threads ? t : hw_threads;
+        if (t >= hw_threads) {
+            break;
+        }
+    }
+
+    tuner_t tuner = {space.num_threads * NUM_TUNE_SIZES * NUM_ALIGNS, 1, "repeats", budget, tune_eval,
+                     tune_describe, &space};
+    double best_mbps;
+    int best = tune(&tuner, &best_mbps);
+
+    char blk_size[32], threads[16], align[16], mbps[32], prefix[64];
+    snprintf(blk_size, sizeof(blk_size), "%zu", tune_sizes[best / NUM_ALIGNS % NUM_TUNE_SIZES]);
+    snprintf(threads, sizeof(threads), "%d", space.threads[best / NUM_ALIGNS / NUM_TUNE_SIZES]);
+    snprintf(align, sizeof(align), "%s", align_names[best % NUM_ALIGNS]);
+    snprintf(mbps, sizeof(mbps), "%f", best_mbps);
+    snprintf(prefix, sizeof(prefix), "memory.%s.", type);
+    const char *keys[] = {"block_size", "threads", "align", "throughput"};
+    const char *values[] = {blk_size, threads, align, mbps};
+
+    printf("Best configuration: block_size=%s threads=%s align=%s\n", blk_size, threads, align);
+    printf("MBps: %f\n", best_mbps);
+    if (profile_store(profile, prefix, keys, values, 4) == 0) {
+        printf("Stored in %s\n", profile);
+    }
+}
+
+/*
+ * Reads the block size, thread count and alignment stored for the experiment in the host profile
+ */
+void load_profile(const char *type, const char *profile, size_t *blk_size, int *num_threads) {
+    char key[64], size_value[PROFILE_LINE], threads_value[PROFILE_LINE], align_value[PROFILE_LINE];
+
+    snprintf(key, sizeof(key), "memory.%s.block_size", type);
+    int missing = profile_load(profile, key, size_value, sizeof(size_value));
+    snprintf(key, sizeof(key), "memory.%s.threads", type);
+    missing |= profile_load(profile, key, threads_value, sizeof(threads_value));
+    if (missing) {
+        printf("Error: no configuration of %s in %s, run autotune first\n", type, profile);
+        exit(1);
+    }
+    *blk_size = (size_t) atol(size_value);
+    *num_threads = atoi(threads_value);
+
+    snprintf(key, sizeof(key), "memory.%s.align", type);
+    if (profile_load(profile, key, align_value, sizeof(align_value)) == 0) {
+        for (int i = 0; i < NUM_ALIGNS; i++) {
+            if (strcmp(align_value, align_names[i]) == 0) {
+                alignment = align_values[i];
+            }
+        }
+    }
+    printf("Profile: block_size=%zu threads=%d align=%s\n", *blk_size, *num_threads,
+           alignment == 0 ? "none" : alignment == HUGE_PAGE ? "huge" : "line");
+}
+
+/*
+ * Allocates a gigabyte block aligned to the alignment of the run; huge pages are requested
+ * from the kernel with madvise, which needs transparent huge pages in 'madvise' or 'always' mode
+ */
+char *alloc_block(void) {
+    void *block;
+    if (alignment == 0) {
+        block = malloc(block_bytes);
+    } else if (posix_memalign(&block, alignment, block_bytes) != 0) {
+        block = NULL;
+    } else if (alignment == HUGE_PAGE) {
+        madvise(block, block_bytes, MADV_HUGEPAGE);
+    }
+    if (block == NULL) {
+        printf("Out of memory!\n");
+        exit(1);
+    }
+    return block;
+}
+
+long lcm(long a, long b) {
+    long x = a, y = b;
+    while (y != 0) {
+        long t = x % y;
+        x = y;
+        y = t;
+    }
+    return a / x * b;
 }
 
 /*
@@ -111,11 +353,26 @@ double work(size_t blk_size, int num_threads, void *thread_function, char *block
     struct timeval start;
     struct timeval end;
 
+    // split the block in units of whole sub-blocks that are also whole aligned lines (or pages), unless a
+    // part would be too small for one unit, so that no two threads write the same line; the remaining
+    // units go one each to the first threads and the last thread takes the bytes that don't make a
+    // whole unit. Unaligned, the units are single sub-blocks of the malloc'd block
+    long unit = alignment != 0 ? lcm((long) blk_size, alignment) : 0;
+    if (unit == 0 || unit > block_bytes / num_threads) {
+        unit = (long) blk_size;
+    }
+    long units = block_bytes / unit;
+
     gettimeofday(&start, NULL);
     for (int num = 0; num < num_threads; num++) {
-        args[num].block_number = num;
+        long chunk = units / num_threads, rest = units % num_threads;
+        long first = num * chunk + (num < rest ? num : rest);
+        args[num].start_index = first * unit;
+        args[num].end_index = (first + chunk + (num < rest ? 1 : 0)) * unit;
+        if (num == num_threads - 1) {
+            args[num].end_index = block_bytes / (long) blk_size * (long) blk_size;
+        }
         args[num].cp_block = cp_block;
-        args[num].num_blocks = num_threads;
         args[num].blk_size = blk_size;
         args[num].block = block;
 
@@ -134,7 +391,7 @@ double work(size_t blk_size, int num_threads, void *thread_function, char *block
     long elapsed_time_us = (end.tv_sec - start.tv_sec) * 1000000 + end.tv_usec - start.tv_usec;
 
     // Megabytes / second is equivalent to bytes / microsecond
-    return (double) GIGABYTE_BLOCK / elapsed_time_us;
+    return (double) block_bytes / elapsed_time_us;
 }
 
 /*
@@ -144,15 +401,12 @@ double work(size_t blk_size, int num_threads, void *thread_function, char *block
  */
 void *read_and_write_thread(void *param) {
     struct thread_sub_block *arg = param;
-    int block_number = arg->block_number;
-    int num_blocks = arg->num_blocks;
     size_t sub_block_size = arg->blk_size;
     char *block = arg->block;
     char *cp_block = arg->cp_block;
 
-    long thread_block_size = (long) ceil(GIGABYTE_BLOCK / num_blocks);
-    long start_index = block_number * thread_block_size;
-    long end_index = (block_number + 1) * thread_block_size;
+    long start_index = arg->start_index;
+    long end_index = arg->end_index;
 
 
     for (long i = start_index; i < end_index; i += sub_block_size) {
@@ -168,15 +422,12 @@ void *read_and_write_thread(void *param) {
 void *seq_write_access_thread(void *param) {
     // unpack the parameters
     struct thread_sub_block *arg = param;
-    int block_number = arg->block_number;
-    int num_blocks = arg->num_blocks;
     size_t blk_size = arg->blk_size;
     char *block = arg->block;
 
-    // calculate the bounds of this thread
-    long thread_workload_block_size = (long) ceil(GIGABYTE_BLOCK / num_blocks); // chunk of the big block given to each thread
-    long start_index = block_number * thread_workload_block_size;
-    long end_index = (block_number + 1) * thread_workload_block_size;
+    // the bounds of this thread, computed by work()
+    long start_index = arg->start_index;
+    long end_index = arg->end_index;
 
     // iterate over each block and perform the memset operation
     for (long i = start_index; i < end_index; i += blk_size) {
@@ -192,15 +443,12 @@ void *seq_write_access_thread(void *param) {
 void *random_write_access_thread(void *param) {
     // unpack the parameters
     struct thread_sub_block *arg = param;
-    int block_number = arg->block_number;
-    int num_blocks = arg->num_blocks;
     size_t blk_size = arg->blk_size;
     char *block = arg->block;
 
-    // calculate the bounds of this thread
-    long thread_block_size = (int) ceil(GIGABYTE_BLOCK / num_blocks);
-    long start_index = block_number * thread_block_size;
-    long end_index = (block_number + 1) * thread_block_size;
+    // the bounds of this thread, computed by work()
+    long start_index = arg->start_index;
+    long end_index = arg->end_index;
 
     // create an array of randomized indices in order to simulate random access
     long num_sub_blocks = (long) ceil((end_index - start_index) / blk_size);
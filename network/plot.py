@@ -5,28 +5,12 @@ import matplotlib.patches as mpatches
 def load(filename):
     latency = []
     throughput = []
-    mode = 0
-    label = 1
-    entry = 0
-    count = 0
     with open(filename, "r") as fil:
         for line in fil:
-            if label == 1:
-                label = 0
-            else:
-                if entry == 0:
-                    entry = 1
-                elif entry == 1:
-                    entry = 0
-                    count += 1
-                    if mode == 0:
-                        latency.append(int(line.split(" ")[3]))
-                    else:
-                        throughput.append(float(line.split(" ")[1]))
-                if count == 4:
-                    label = 1
-                    mode += 1
-                    count = 0
+            if line.startswith("Ping-pong message latency:"):
+                latency.append(float(line.split(" ")[3]))
+            elif line.startswith("Throughput:"):
+                throughput.append(float(line.split(" ")[1]))
 
     return (latency, throughput)
 
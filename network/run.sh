@@ -8,6 +8,15 @@ logcltudp="udp-client.log"
 ipaddr=127.0.0.1
 port=11155
 
+# with --loopback the client runs its own server threads, so the TCP and UDP
+# sweep needs no pauses and finishes in seconds; the other experiments are
+# skipped
+loopback=0
+if [ "$1" == "--loopback" ]
+then
+    loopback=1
+fi
+
 echo -n "" > $logsrvtcp
 echo -n "" > $logsrvudp
 echo -n "" > $logclttcp
@@ -26,6 +35,13 @@ do
     
     for threads in 1 2 4 8
     do
+        if [ $loopback -eq 1 ]
+        then
+            ./bin/benchmark-tcp.exe $threads $mode 0 $ipaddr $port \
+                --loopback --time=0.5 &>> $logclttcp
+            continue
+        fi
+
         ./bin/benchmark-tcp.exe $threads $mode 1 $ipaddr $port &>> $logsrvtcp &
         sleep 1;
         ./bin/benchmark-tcp.exe $threads $mode 0 $ipaddr $port &>> $logclttcp &
@@ -47,6 +63,13 @@ do
     
     for threads in 1 2 4 8
     do
+        if [ $loopback -eq 1 ]
+        then
+            ./bin/benchmark-udp.exe $threads $mode 0 $ipaddr $port \
+                --loopback --time=0.5 &>> $logcltudp
+            continue
+        fi
+
         ./bin/benchmark-udp.exe $threads $mode 1 $ipaddr $port &>> $logsrvudp &
         sleep 1;
         ./bin/benchmark-udp.exe $threads $mode 0 $ipaddr $port &>> $logcltudp &
@@ -54,3 +77,180 @@ do
         sleep 60
     done
 done
+
+if [ $loopback -eq 1 ]
+then
+    exit 0
+fi
+
+logsrvepoll="epoll-server.log"
+logcltepoll="epoll-client.log"
+
+echo -n "" > $logsrvepoll
+echo -n "" > $logcltepoll
+
+for mode in {0..1}
+do
+    if [ $mode -eq 0 ]
+    then
+        echo "Running latency experiment" >> $logsrvepoll
+        echo "Running latency experiment" >> $logcltepoll
+    else
+        echo "Running throughput experiment" >> $logsrvepoll
+        echo "Running throughput experiment" >> $logcltepoll
+    fi
+
+    for connections in 1000 2000 5000 10000
+    do
+        ./bin/benchmark-tcp.exe 8 $mode 1 $ipaddr $port --server=epoll \
+            --connections=$connections &>> $logsrvepoll &
+        sleep 1;
+        ./bin/benchmark-tcp.exe 8 $mode 0 $ipaddr $port --server=epoll \
+            --connections=$connections &>> $logcltepoll &
+        wait
+        sleep 60
+    done
+done
+
+logsrvopen="open-loop-server.log"
+logcltopen="open-loop-client.log"
+
+echo -n "" > $logsrvopen
+echo -n "" > $logcltopen
+
+for rate in 1000 10000 50000 100000
+do
+    ./bin/benchmark-tcp.exe 4 0 1 $ipaddr $port --rate=$rate \
+        --runtime=10 &>> $logsrvopen &
+    sleep 1;
+    ./bin/benchmark-tcp.exe 4 0 0 $ipaddr $port --rate=$rate \
+        --runtime=10 &>> $logcltopen &
+    wait
+    sleep 60
+done
+
+logsrvsweep="sweep-server.log"
+logcltsweep="sweep-client.log"
+
+echo -n "" > $logsrvsweep
+echo -n "" > $logcltsweep
+
+for protocol in tcp udp
+do
+    for mode in {0..1}
+    do
+        echo "Running $protocol sweep, mode $mode" >> $logsrvsweep
+        echo "Running $protocol sweep, mode $mode" >> $logcltsweep
+
+        ./bin/benchmark-$protocol.exe 1 $mode 1 $ipaddr $port --sweep \
+            --time=2 &>> $logsrvsweep &
+        sleep 1;
+        ./bin/benchmark-$protocol.exe 1 $mode 0 $ipaddr $port --sweep \
+            --time=2 &>> $logcltsweep &
+        wait
+        sleep 60
+    done
+done
+
+logsrvsend="send-server.log"
+logcltsend="send-client.log"
+
+echo -n "" > $logsrvsend
+echo -n "" > $logcltsend
+
+for send in copy zerocopy sendfile splice
+do
+    echo "Running $send send path" >> $logsrvsend
+    echo "Running $send send path" >> $logcltsend
+
+    ./bin/benchmark-tcp.exe 4 1 1 $ipaddr $port --send=$send --size=64k \
+        --time=10 &>> $logsrvsend &
+    sleep 1;
+    ./bin/benchmark-tcp.exe 4 1 0 $ipaddr $port --send=$send --size=64k \
+        --time=10 &>> $logcltsend &
+    wait
+    sleep 60
+done
+
+logsrvbatch="batch-server.log"
+logcltbatch="batch-client.log"
+
+echo -n "" > $logsrvbatch
+echo -n "" > $logcltbatch
+
+for batch in "--batch=1" "--batch=8" "--batch=64" "--batch=64 --gso --gro"
+do
+    echo "Running UDP throughput with $batch" >> $logsrvbatch
+    echo "Running UDP throughput with $batch" >> $logcltbatch
+
+    ./bin/benchmark-udp.exe 1 1 1 $ipaddr $port $batch --time=10 \
+        &>> $logsrvbatch &
+    sleep 1;
+    ./bin/benchmark-udp.exe 1 1 0 $ipaddr $port $batch --time=10 \
+        &>> $logcltbatch &
+    wait
+    sleep 60
+done
+
+logsrvipc="ipc-server.log"
+logcltipc="ipc-client.log"
+
+echo -n "" > $logsrvipc
+echo -n "" > $logcltipc
+
+for transport in unix-stream unix-dgram pipe shm
+do
+    for mode in 0 1
+    do
+        echo "Running $transport mode $mode" >> $logsrvipc
+        echo "Running $transport mode $mode" >> $logcltipc
+
+        ./bin/benchmark-ipc.exe 1 $mode 1 $transport /tmp/benchmark-ipc \
+            --time=10 &>> $logsrvipc &
+        sleep 1;
+        ./bin/benchmark-ipc.exe 1 $mode 0 $transport /tmp/benchmark-ipc \
+            --time=10 &>> $logcltipc &
+        wait
+    done
+done
+
+logsrvtune="tune-server.log"
+logclttune="tune-client.log"
+
+echo -n "" > $logsrvtune
+echo -n "" > $logclttune
+
+for mode in 0 1
+do
+    echo "Running TCP socket option matrix mode $mode" >> $logsrvtune
+    echo "Running TCP socket option matrix mode $mode" >> $logclttune
+
+    ./bin/benchmark-tcp.exe 1 $mode 1 $ipaddr $port --tune &>> $logsrvtune &
+    sleep 1;
+    ./bin/benchmark-tcp.exe 1 $mode 0 $ipaddr $port --tune &>> $logclttune &
+    wait
+    sleep 60
+done
+
+logsrvconnrate="connrate-server.log"
+logcltconnrate="connrate-client.log"
+
+echo -n "" > $logsrvconnrate
+echo -n "" > $logcltconnrate
+
+for reuseport in "" "--reuseport"
+do
+    for threads in 1 2 4 8
+    do
+        echo "Running connection rate $threads $reuseport" >> $logsrvconnrate
+        echo "Running connection rate $threads $reuseport" >> $logcltconnrate
+
+        ./bin/benchmark-tcp.exe $threads 2 1 $ipaddr $port $reuseport \
+            --time=10 &>> $logsrvconnrate &
+        sleep 1;
+        ./bin/benchmark-tcp.exe $threads 2 0 $ipaddr $port $reuseport \
+            --time=10 &>> $logcltconnrate &
+        wait
+        sleep 60
+    done
+done
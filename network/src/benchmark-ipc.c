@@ -0,0 +1,844 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sched.h>
+
+#include "histogram.h"
+#include "topology.h"
+#include "util.h"
+
+#define MODE_LATENCY 0
+#define MODE_THROUGHPUT 1
+
+#define TYPE_CLIENT 0
+#define TYPE_SERVER 1
+
+#define TRANSPORT_UNIX_STREAM 0
+#define TRANSPORT_UNIX_DGRAM 1
+#define TRANSPORT_PIPE 2
+#define TRANSPORT_SHM 3
+
+#define PACKET_SIZE 1024
+#define NUM_MESSAGES 64 * 8 * 1024
+#define NUM_PACKETS 64 * 128 * 1024
+
+/* the throughput experiment ends with an acknowledgement of this size */
+#define ACK_SIZE PACKET_SIZE
+
+/* the datagram transport is limited by the socket buffers */
+#define MAX_DGRAM (64 * 1024)
+#define RING_SIZE (1024 * 1024)
+/* an idle ring side spins this often before yielding the core */
+#define SPIN_LIMIT 1024
+#define CONNECT_RETRIES 50
+
+/* runtime options, identical on the client and the server side */
+typedef struct options_t
+{
+    long size;
+    double time;
+    long ring;
+} options_t;
+
+/* single-producer single-consumer byte ring in shared memory: only the
+ * producer moves head and only the consumer moves tail, each on a cache line
+ * of its own, so neither side ever takes a lock
+ */
+typedef struct ring_t
+{
+    long head __attribute__((aligned(64)));
+    long tail __attribute__((aligned(64)));
+    int closed __attribute__((aligned(64)));
+    int ready;
+    long capacity;
+    char data[] __attribute__((aligned(64)));
+} ring_t;
+
+/* one end of a connection, whatever the transport: fds for the sockets and
+ * the pipes, rings for the shared memory
+ */
+typedef struct channel_t
+{
+    int transport;
+    int rfd;
+    int wfd;
+    ring_t *rx;
+    ring_t *tx;
+    void *shm;
+    size_t shm_size;
+    struct sockaddr_un peer;
+    socklen_t peerlen;
+    char bound[108];
+} channel_t;
+
+typedef struct thread_arg_t
+{
+    char path[88];
+    int transport;
+    int mode;
+    int type;
+    int num_messages;
+    int num_packets;
+    long runtime;
+    long bytes;
+    options_t *opts;
+    histogram_t hist;
+} thread_arg_t;
+
+int parse_option(options_t *opts, const char *opt)
+{
+    char *end;
+
+    if (strncmp(opt, "--size=", 7) == 0) {
+        opts->size = parse_size(opt + 7, &end);
+        return (*end != '\0' || opts->size <= 0) ? -1 : 0;
+    } else if (strncmp(opt, "--time=", 7) == 0) {
+        opts->time = atof(opt + 7);
+        return opts->time <= 0 ? -1 : 0;
+    } else if (strncmp(opt, "--ring=", 7) == 0) {
+        opts->ring = parse_size(opt + 7, &end);
+        // the ring indices are masked, so the size is a power of two //
+        return (*end != '\0' || opts->ring <= 0
+                || (opts->ring & (opts->ring - 1)) != 0) ? -1 : 0;
+    }
+    return -1;
+}
+
+int parse_transport(const char *str)
+{
+    if (strcmp(str, "unix-stream") == 0) {
+        return TRANSPORT_UNIX_STREAM;
+    } else if (strcmp(str, "unix-dgram") == 0) {
+        return TRANSPORT_UNIX_DGRAM;
+    } else if (strcmp(str, "pipe") == 0) {
+        return TRANSPORT_PIPE;
+    } else if (strcmp(str, "shm") == 0) {
+        return TRANSPORT_SHM;
+    }
+    return -1;
+}
+
+/* without a time budget the fixed message counts are kept for small
+ * messages and scaled down for large ones, so that a run moves at most as
+ * many bytes as it would with PACKET_SIZE messages
+ */
+long scale_count(long count, long size)
+{
+    if (size > PACKET_SIZE) {
+        count = count * PACKET_SIZE / size;
+    }
+    return count > 0 ? count : 1;
+}
+
+void init_dataset(char *dataset, int n)
+{
+    int i;
+
+    for (i = 0; i < n; i++) {
+        dataset[i] = rand() % 255 + 1;
+    }
+}
+
+/* waits for the other side of a ring: busy spinning keeps the latency low
+ * when both sides have a core of their own, yielding keeps the ring moving
+ * when they share one
+ */
+static inline void ring_wait(int *spins)
+{
+    if (++(*spins) < SPIN_LIMIT) {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#endif
+    } else {
+        *spins = 0;
+        sched_yield();
+    }
+}
+
+/* copies size bytes into the ring, spinning while it is full */
+void ring_write(ring_t *r, const char *buffer, long size)
+{
+    long head, tail, free, off, chunk, first;
+    int spins = 0;
+
+    head = r->head;
+    while (size > 0) {
+        tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+        free = r->capacity - (head - tail);
+        if (free == 0) {
+            ring_wait(&spins);
+            continue;
+        }
+
+        chunk = size < free ? size : free;
+        off = head & (r->capacity - 1);
+        first = r->capacity - off < chunk ? r->capacity - off : chunk;
+        memcpy(&r->data[off], buffer, first);
+        memcpy(r->data, buffer + first, chunk - first);
+
+        head += chunk;
+        buffer += chunk;
+        size -= chunk;
+        __atomic_store_n(&r->head, head, __ATOMIC_RELEASE);
+    }
+}
+
+/* copies size bytes out of the ring, spinning while it is empty; returns 1
+ * once the producer closed the ring and everything was consumed
+ */
+int ring_read(ring_t *r, char *buffer, long size)
+{
+    long head, tail, off, chunk, first;
+    int spins = 0;
+
+    tail = r->tail;
+    while (size > 0) {
+        head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+        if (head == tail) {
+            if (__atomic_load_n(&r->closed, __ATOMIC_ACQUIRE)
+                    && head == __atomic_load_n(&r->head, __ATOMIC_ACQUIRE)) {
+                return 1;
+            }
+            ring_wait(&spins);
+            continue;
+        }
+
+        chunk = size < head - tail ? size : head - tail;
+        off = tail & (r->capacity - 1);
+        first = r->capacity - off < chunk ? r->capacity - off : chunk;
+        memcpy(buffer, &r->data[off], first);
+        memcpy(buffer + first, r->data, chunk - first);
+
+        tail += chunk;
+        buffer += chunk;
+        size -= chunk;
+        __atomic_store_n(&r->tail, tail, __ATOMIC_RELEASE);
+    }
+    return 0;
+}
+
+/* sends one message; returns 0 on success and -1 on errors */
+int chan_send(channel_t *ch, char *buffer, long size)
+{
+    long rc, rd;
+
+    if (ch->transport == TRANSPORT_SHM) {
+        ring_write(ch->tx, buffer, size);
+        return 0;
+    }
+
+    if (ch->transport == TRANSPORT_UNIX_DGRAM) {
+        rd = sendto(ch->wfd, buffer, size, 0, (struct sockaddr *) &ch->peer,
+                ch->peerlen);
+        return rd == size ? 0 : -1;
+    }
+
+    for (rc = 0; rc < size; rc += rd) {
+        rd = write(ch->wfd, &buffer[rc], size - rc);
+        if (rd < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* receives one message of size bytes; returns 0 on success, 1 once the peer
+ * ended the connection and -1 on errors
+ */
+int chan_recv(channel_t *ch, char *buffer, long size)
+{
+    long rc, rd;
+
+    if (ch->transport == TRANSPORT_SHM) {
+        return ring_read(ch->rx, buffer, size);
+    }
+
+    // an empty datagram ends a datagram connection //
+    if (ch->transport == TRANSPORT_UNIX_DGRAM) {
+        ch->peerlen = sizeof(ch->peer);
+        rd = recvfrom(ch->rfd, buffer, size, 0,
+                (struct sockaddr *) &ch->peer, &ch->peerlen);
+        if (rd < 0) {
+            return -1;
+        }
+        return rd == 0 ? 1 : 0;
+    }
+
+    for (rc = 0; rc < size; rc += rd) {
+        rd = read(ch->rfd, &buffer[rc], size - rc);
+        if (rd == 0) {
+            return 1;
+        }
+        if (rd < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* tells the peer that no more messages follow, keeping the way back open */
+void chan_close_send(channel_t *ch)
+{
+    switch (ch->transport) {
+        case TRANSPORT_SHM:
+            __atomic_store_n(&ch->tx->closed, 1, __ATOMIC_RELEASE);
+            break;
+        case TRANSPORT_UNIX_DGRAM:
+            sendto(ch->wfd, NULL, 0, 0, (struct sockaddr *) &ch->peer,
+                    ch->peerlen);
+            break;
+        case TRANSPORT_UNIX_STREAM:
+            shutdown(ch->wfd, SHUT_WR);
+            break;
+        case TRANSPORT_PIPE:
+            close(ch->wfd);
+            ch->wfd = -1;
+            break;
+    }
+}
+
+void chan_close(channel_t *ch)
+{
+    if (ch->bound[0] != '\0') {
+        unlink(ch->bound);
+    }
+    if (ch->transport == TRANSPORT_SHM) {
+        munmap(ch->shm, ch->shm_size);
+        return;
+    }
+    if (ch->rfd >= 0) {
+        close(ch->rfd);
+    }
+    if (ch->wfd >= 0 && ch->wfd != ch->rfd) {
+        close(ch->wfd);
+    }
+}
+
+/* posix shared memory names take a single leading slash only */
+void make_shm_name(char *name, const char *path)
+{
+    char *c;
+
+    sprintf(name, "/%s", path);
+    for (c = name + 1; *c != '\0'; ++c) {
+        if (*c == '/') {
+            *c = '_';
+        }
+    }
+}
+
+void make_addr(struct sockaddr_un *addr, const char *path)
+{
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    snprintf(addr->sun_path, sizeof(addr->sun_path), "%s", path);
+}
+
+/* sets up the server end of a channel and waits for the client */
+int chan_listen(thread_arg_t *arg, channel_t *ch)
+{
+    struct sockaddr_un addr;
+    char name[108];
+    ring_t *ring;
+    int fd, i;
+
+    memset(ch, 0, sizeof(*ch));
+    ch->transport = arg->transport;
+    ch->rfd = -1;
+    ch->wfd = -1;
+
+    switch (arg->transport) {
+        case TRANSPORT_UNIX_STREAM:
+            make_addr(&addr, arg->path);
+            unlink(arg->path);
+            fd = socket(AF_UNIX, SOCK_STREAM, 0);
+            if (fd < 0 || bind(fd, (struct sockaddr *) &addr,
+                    sizeof(addr)) < 0 || listen(fd, 1) < 0) {
+                return -1;
+            }
+            ch->rfd = accept(fd, NULL, NULL);
+            ch->wfd = ch->rfd;
+            close(fd);
+            unlink(arg->path);
+            return ch->rfd < 0 ? -1 : 0;
+
+        case TRANSPORT_UNIX_DGRAM:
+            make_addr(&addr, arg->path);
+            unlink(arg->path);
+            ch->rfd = socket(AF_UNIX, SOCK_DGRAM, 0);
+            ch->wfd = ch->rfd;
+            if (ch->rfd < 0 || bind(ch->rfd, (struct sockaddr *) &addr,
+                    sizeof(addr)) < 0) {
+                return -1;
+            }
+            strcpy(ch->bound, arg->path);
+            return 0;
+
+        case TRANSPORT_PIPE:
+            // one fifo per direction, opened in the same order on both sides //
+            for (i = 0; i < 2; ++i) {
+                sprintf(name, "%s.%s", arg->path, i == 0 ? "up" : "down");
+                unlink(name);
+                if (mkfifo(name, 0600) < 0) {
+                    return -1;
+                }
+            }
+            sprintf(name, "%s.up", arg->path);
+            ch->rfd = open(name, O_RDONLY);
+            sprintf(name, "%s.down", arg->path);
+            ch->wfd = open(name, O_WRONLY);
+            for (i = 0; i < 2; ++i) {
+                sprintf(name, "%s.%s", arg->path, i == 0 ? "up" : "down");
+                unlink(name);
+            }
+            return (ch->rfd < 0 || ch->wfd < 0) ? -1 : 0;
+
+        case TRANSPORT_SHM:
+            make_shm_name(name, arg->path);
+            shm_unlink(name);
+            fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+            ch->shm_size = 2 * (sizeof(ring_t) + arg->opts->ring);
+            if (fd < 0 || ftruncate(fd, ch->shm_size) < 0) {
+                return -1;
+            }
+            ch->shm = mmap(NULL, ch->shm_size, PROT_READ | PROT_WRITE,
+                    MAP_SHARED, fd, 0);
+            close(fd);
+            if (ch->shm == MAP_FAILED) {
+                return -1;
+            }
+            ch->rx = (ring_t *) ch->shm;
+            ch->tx = (ring_t *) ((char *) ch->shm + ch->shm_size / 2);
+            ch->rx->capacity = arg->opts->ring;
+            ch->tx->capacity = arg->opts->ring;
+
+            // the client only uses the rings once they are initialized //
+            __atomic_store_n(&ch->rx->ready, 1, __ATOMIC_RELEASE);
+            ring = ch->rx;
+            while (__atomic_load_n(&ring->ready, __ATOMIC_ACQUIRE) != 2) {
+                usleep(1000);
+            }
+            shm_unlink(name);
+            return 0;
+    }
+    return -1;
+}
+
+/* connects the client end of a channel, retrying while the server is
+ * starting
+ */
+int chan_connect(thread_arg_t *arg, channel_t *ch)
+{
+    struct sockaddr_un addr;
+    struct stat st;
+    char name[108];
+    int fd, i;
+
+    memset(ch, 0, sizeof(*ch));
+    ch->transport = arg->transport;
+    ch->rfd = -1;
+    ch->wfd = -1;
+
+    for (i = 0; i < CONNECT_RETRIES; ++i) {
+        switch (arg->transport) {
+            case TRANSPORT_UNIX_STREAM:
+                make_addr(&addr, arg->path);
+                ch->rfd = socket(AF_UNIX, SOCK_STREAM, 0);
+                ch->wfd = ch->rfd;
+                if (ch->rfd >= 0 && connect(ch->rfd,
+                        (struct sockaddr *) &addr, sizeof(addr)) == 0) {
+                    return 0;
+                }
+                close(ch->rfd);
+                break;
+
+            case TRANSPORT_UNIX_DGRAM:
+                // the client binds a path of its own to receive the echoes //
+                sprintf(name, "%s.client", arg->path);
+                make_addr(&addr, name);
+                unlink(name);
+                ch->rfd = socket(AF_UNIX, SOCK_DGRAM, 0);
+                ch->wfd = ch->rfd;
+                make_addr(&ch->peer, arg->path);
+                ch->peerlen = sizeof(ch->peer);
+                if (ch->rfd >= 0 && bind(ch->rfd, (struct sockaddr *) &addr,
+                        sizeof(addr)) == 0 && connect(ch->rfd,
+                        (struct sockaddr *) &ch->peer, ch->peerlen) == 0) {
+                    strcpy(ch->bound, name);
+                    return 0;
+                }
+                close(ch->rfd);
+                unlink(name);
+                break;
+
+            case TRANSPORT_PIPE:
+                sprintf(name, "%s.up", arg->path);
+                ch->wfd = open(name, O_WRONLY);
+                if (ch->wfd >= 0) {
+                    sprintf(name, "%s.down", arg->path);
+                    ch->rfd = open(name, O_RDONLY);
+                    return ch->rfd < 0 ? -1 : 0;
+                }
+                break;
+
+            case TRANSPORT_SHM:
+                make_shm_name(name, arg->path);
+                fd = shm_open(name, O_RDWR, 0600);
+                if (fd < 0) {
+                    break;
+                }
+
+                // the server sizes the object after creating it //
+                ch->shm_size = 2 * (sizeof(ring_t) + arg->opts->ring);
+                if (fstat(fd, &st) < 0 || st.st_size < (off_t) ch->shm_size) {
+                    close(fd);
+                    break;
+                }
+                ch->shm = mmap(NULL, ch->shm_size, PROT_READ | PROT_WRITE,
+                        MAP_SHARED, fd, 0);
+                close(fd);
+                if (ch->shm == MAP_FAILED) {
+                    return -1;
+                }
+                ch->tx = (ring_t *) ch->shm;
+                ch->rx = (ring_t *) ((char *) ch->shm + ch->shm_size / 2);
+                while (__atomic_load_n(&ch->tx->ready, __ATOMIC_ACQUIRE)
+                        != 1) {
+                    usleep(1000);
+                }
+                __atomic_store_n(&ch->tx->ready, 2, __ATOMIC_RELEASE);
+                return 0;
+        }
+        usleep(100000);
+    }
+    return -1;
+}
+
+/* serves the client until it ends the connection: in latency mode every
+ * message is echoed back, in throughput mode the messages are drained and
+ * acknowledged once the client stopped sending
+ */
+void *work_server(void *argv)
+{
+    thread_arg_t *arg;
+    channel_t ch;
+    char *buffer;
+    long size;
+    int rc;
+
+    arg = (thread_arg_t *) argv;
+    size = arg->opts->size;
+
+    if (chan_listen(arg, &ch) < 0) {
+        fprintf(stderr, "Could not set up channel %s: %s\n", arg->path,
+                strerror(errno));
+        pthread_exit(NULL);
+    }
+
+    buffer = (char *) malloc((size > ACK_SIZE ? size : ACK_SIZE)
+            * sizeof(char));
+
+    while ((rc = chan_recv(&ch, buffer, size)) == 0) {
+        if (arg->mode == MODE_LATENCY && chan_send(&ch, buffer, size) < 0) {
+            rc = -1;
+            break;
+        }
+    }
+
+    if (rc < 0) {
+        fprintf(stderr, "Could not receive message: %s\n", strerror(errno));
+    } else if (arg->mode == MODE_THROUGHPUT) {
+        memset(buffer, 0, ACK_SIZE);
+        if (chan_send(&ch, buffer, ACK_SIZE) < 0) {
+            fprintf(stderr, "Could not send message!\n");
+        }
+    }
+
+    chan_close(&ch);
+    free(buffer);
+    pthread_exit(NULL);
+}
+
+/* runs count messages, ping-pong in the latency experiment, recording their
+ * round trip time when a histogram is given
+ */
+int run_messages(thread_arg_t *arg, channel_t *ch, char *buffer, long size,
+        long count, histogram_t *hist)
+{
+    long i, sent_at;
+
+    for (i = 0; i < count; ++i) {
+        sent_at = now_ns();
+        if (chan_send(ch, buffer, size) < 0) {
+            return -1;
+        }
+        if (arg->mode == MODE_LATENCY) {
+            if (chan_recv(ch, buffer, size) != 0) {
+                return -1;
+            }
+            if (hist != NULL) {
+                hist_record(hist, now_ns() - sent_at);
+            }
+        }
+    }
+    return 0;
+}
+
+/* picks the number of iterations that fills the time budget: the iteration
+ * count is doubled until a run takes 5% of the budget, and the measured
+ * rate is extrapolated to the whole budget
+ */
+long calibrate(thread_arg_t *arg, channel_t *ch, char *buffer, long size)
+{
+    long budget, count, start, elapsed;
+
+    budget = (long) (arg->opts->time * 1e9);
+    count = 1;
+    for (;;) {
+        start = now_ns();
+        if (run_messages(arg, ch, buffer, size, count, NULL) < 0) {
+            return -1;
+        }
+        elapsed = now_ns() - start;
+
+        if (elapsed >= budget / 20 || count >= (1L << 30)) {
+            break;
+        }
+        count *= 2;
+    }
+
+    count = (long) ((double) budget * count / (elapsed > 0 ? elapsed : 1));
+    return count > 0 ? count : 1;
+}
+
+void *work_client(void *argv)
+{
+    thread_arg_t *arg;
+    channel_t ch;
+    char *buffer;
+    long size, count, start, end;
+    int rc;
+
+    arg = (thread_arg_t *) argv;
+    size = arg->opts->size;
+
+    buffer = (char *) malloc((size > ACK_SIZE ? size : ACK_SIZE)
+            * sizeof(char));
+    init_dataset(buffer, size);
+
+    if (chan_connect(arg, &ch) < 0) {
+        fprintf(stderr, "Could not connect channel %s: %s\n", arg->path,
+                strerror(errno));
+        free(buffer);
+        pthread_exit(NULL);
+    }
+
+    if (arg->opts->time > 0) {
+        count = calibrate(arg, &ch, buffer, size);
+    } else if (arg->mode == MODE_LATENCY) {
+        count = scale_count(arg->num_messages, size);
+    } else {
+        count = scale_count(arg->num_packets, size);
+    }
+
+    start = now_ns();
+    rc = count < 0 ? -1
+            : run_messages(arg, &ch, buffer, size, count, &arg->hist);
+    chan_close_send(&ch);
+    if (rc == 0 && arg->mode == MODE_THROUGHPUT) {
+        rc = chan_recv(&ch, buffer, ACK_SIZE);
+    }
+    end = now_ns();
+
+    if (rc != 0) {
+        fprintf(stderr, "Could not run experiment: %s\n", strerror(errno));
+    } else {
+        arg->runtime = (end - start) / 1000;
+        arg->bytes = count * size;
+    }
+
+    chan_close(&ch);
+    free(buffer);
+    pthread_exit(NULL);
+}
+
+int main(int argc, char **argv)
+{
+    int num_threads, mode, type, transport;
+    pthread_t *threads;
+    thread_arg_t *args;
+    int i, rc;
+    long max_runtime, bytes;
+    options_t opts;
+    histogram_t *hist;
+    topology_t topo;
+
+    // parsing arguments //
+    if (argc <= 5) {
+        fprintf(stderr, "Program usage: ./benchmark-ipc.exe "
+                "<num_threads> <mode> <type> <transport> <path> "
+                "[options]\n"
+                "where <num_threads> 0 runs one thread per hardware thread "
+                "of the host\n"
+                "where <mode> accepts the following values:\n"
+                "\t 0 - Latency experiment\n"
+                "\t 1 - Througput experiment\n"
+                "where <type> accepts the following values:\n"
+                "\t 0 - Client\n"
+                "\t 1 - Server\n"
+                "where <transport> accepts the following values:\n"
+                "\t unix-stream - AF_UNIX stream socket\n"
+                "\t unix-dgram  - AF_UNIX datagram socket\n"
+                "\t pipe        - a pair of named pipes\n"
+                "\t shm         - a pair of shared memory rings\n"
+                "where <path> is the socket, pipe or shared memory name of "
+                "the first thread\n"
+                "where [options] accepts the following values, which must "
+                "be the same on both sides:\n"
+                "\t --size=<bytes>       message size, k and m suffixes "
+                "accepted (default 1024)\n"
+                "\t --time=<sec>         time budget of the experiment\n"
+                "\t --ring=<bytes>       size of the shared memory rings, "
+                "a power of two (default 1m)\n");
+        exit(-1);
+    } else {
+        // describing the host, with its network interfaces //
+        topology_read(&topo, NULL);
+        topology_print(&topo);
+        num_threads = atoi(argv[1]);
+        if (num_threads <= 0) {
+            num_threads = topo.threads;
+        }
+        switch (atoi(argv[2])) {
+            case MODE_LATENCY:
+                mode = MODE_LATENCY;
+                break;
+            case MODE_THROUGHPUT:
+                mode = MODE_THROUGHPUT;
+                break;
+            default:
+                fprintf(stderr, "Unrecognized mode!\n");
+                exit(-1);
+        }
+        switch (atoi(argv[3])) {
+            case TYPE_CLIENT:
+                type = TYPE_CLIENT;
+                break;
+            case TYPE_SERVER:
+                type = TYPE_SERVER;
+                break;
+            default:
+                fprintf(stderr, "Unrecognized type!\n");
+                exit(-1);
+        }
+        transport = parse_transport(argv[4]);
+        if (transport < 0) {
+            fprintf(stderr, "Unrecognized transport!\n");
+            exit(-1);
+        }
+        if (strlen(argv[5]) > 80) {
+            fprintf(stderr, "The path is too long!\n");
+            exit(-1);
+        }
+
+        opts.size = PACKET_SIZE;
+        opts.time = 0;
+        opts.ring = RING_SIZE;
+        for (i = 6; i < argc; ++i) {
+            if (parse_option(&opts, argv[i]) < 0) {
+                fprintf(stderr, "Unrecognized option %s!\n", argv[i]);
+                exit(-1);
+            }
+        }
+        if (transport == TRANSPORT_UNIX_DGRAM && opts.size > MAX_DGRAM) {
+            fprintf(stderr, "The datagrams are limited to %d bytes!\n",
+                    MAX_DGRAM);
+            exit(-1);
+        }
+    }
+
+    srand(time(NULL));
+    args = (thread_arg_t *) calloc(num_threads, sizeof(thread_arg_t));
+
+    // every thread uses its own path, suffixed with the thread id //
+    for (i = 0; i < num_threads; ++i) {
+        sprintf(args[i].path, "%s-%d", argv[5], i);
+        args[i].transport = transport;
+        args[i].mode = mode;
+        args[i].type = type;
+        args[i].num_messages = NUM_MESSAGES / num_threads;
+        args[i].num_packets = NUM_PACKETS / num_threads;
+        args[i].opts = &opts;
+    }
+
+    // creating and running the threads //
+    threads = (pthread_t *) malloc(num_threads * sizeof(pthread_t));
+
+    for (i = 0; i < num_threads; ++i) {
+        if (type == TYPE_SERVER) {
+            rc = pthread_create(&threads[i], NULL, work_server,
+                    (void *) &args[i]);
+        } else {
+            rc = pthread_create(&threads[i], NULL, work_client,
+                    (void *) &args[i]);
+        }
+
+        if (rc) {
+            fprintf(stderr, "Could not create thread!\n");
+            free(args);
+            free(threads);
+            exit(-3);
+        }
+    }
+
+    // joining the threads //
+    for (i = 0; i < num_threads; ++i) {
+        rc = pthread_join(threads[i], NULL);
+        if (rc) {
+            fprintf(stderr, "Could not join thread!\n");
+        }
+    }
+
+    if (type == TYPE_CLIENT) {
+        hist = (histogram_t *) calloc(1, sizeof(histogram_t));
+        max_runtime = 0;
+        bytes = 0;
+        for (i = 0; i < num_threads; ++i) {
+            if (max_runtime < args[i].runtime) {
+                max_runtime = args[i].runtime;
+            }
+            bytes += args[i].bytes;
+            hist_merge(hist, &args[i].hist);
+        }
+        if (max_runtime <= 0) {
+            max_runtime = 1;
+        }
+
+        printf("Elapsed time: %ld ms\n", max_runtime / 1000);
+        if (mode == MODE_LATENCY) {
+            printf("Ping-pong message latency: %.2lf us\n",
+                    hist->total > 0
+                    ? (double) hist->sum / hist->total / 1000.0 : 0.0);
+            hist_print("Message", hist);
+        } else {
+            printf("Throughput: %lf Mbps\n", 8.0 * bytes / max_runtime);
+        }
+        free(hist);
+    }
+
+    free(threads);
+    free(args);
+
+    pthread_exit(NULL);
+}
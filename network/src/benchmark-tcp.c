@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -7,11 +8,27 @@
 #include <sys/time.h>
 #include <arpa/inet.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <netdb.h>
 #include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <poll.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <linux/errqueue.h>
+
+#include "histogram.h"
+#include "topology.h"
+#include "util.h"
 
 #define MODE_LATENCY 0
 #define MODE_THROUGHPUT 1
+#define MODE_CONNRATE 2
 
 #define TYPE_CLIENT 0
 #define TYPE_SERVER 1
@@ -19,6 +36,128 @@
 #define PACKET_SIZE 1024
 #define NUM_MESSAGES 64 * 8 * 1024
 #define NUM_PACKETS 64 * 128 * 1024
+#define NUM_CONNECTIONS 64 * 1024
+
+/* the throughput experiment ends with an acknowledgement of this size */
+#define ACK_SIZE PACKET_SIZE
+
+#define SWEEP_MIN 64
+#define SWEEP_MAX (1024 * 1024)
+#define SWEEP_TIME 1.0
+#define SATURATION 0.95
+
+/* busy polling budget and cork batch measured by the tuning sweep */
+#define TUNE_BUSY_POLL 50
+#define TUNE_CORK 16
+
+#define SERVER_THREADS 0
+#define SERVER_EPOLL 1
+
+#define SEND_COPY 0
+#define SEND_ZEROCOPY 1
+#define SEND_SENDFILE 2
+#define SEND_SPLICE 3
+
+/* zero-copy sends in flight before the sender waits for completions */
+#define ZEROCOPY_PENDING 256
+
+#define DEFAULT_RUNTIME 10
+
+#define MAX_EVENTS 256
+#define LISTEN_BACKLOG 4096
+#define STOP_RETRIES 50
+
+/* socket options applied to both ends of a connection; zero keeps the
+ * kernel default
+ */
+typedef struct tuning_t
+{
+    int nodelay;
+    int quickack;
+    int busy_poll;
+    int cork;
+    long sndbuf;
+    long rcvbuf;
+} tuning_t;
+
+/* runtime options, identical on the client and the server side */
+typedef struct options_t
+{
+    int server;
+    int connections;
+    double rate;
+    long runtime;
+    long size;
+    int sweep;
+    double time;
+    int send;
+    char *file;
+    int tune;
+    tuning_t tuning;
+    int loopback;
+    int reuseport;
+} options_t;
+
+/* cpu time the server spent receiving a throughput run, sent back in the
+ * acknowledgement
+ */
+typedef struct ack_t
+{
+    long user;
+    long sys;
+    long bytes;
+} ack_t;
+
+/* state of the send path of a client thread */
+typedef struct sender_t
+{
+    int file;
+    off_t file_size;
+    off_t offset;
+    int pipe[2];
+    long pipe_size;
+    long zc_sends;
+    long zc_completed;
+    long zc_copied;
+} sender_t;
+
+/* results of one message size */
+typedef struct point_t
+{
+    long size;
+    tuning_t tuning;
+    long runtime;
+    long bytes;
+    long count;
+    long send_cpu;
+    double recv_user;
+    double recv_sys;
+    long zc_sends;
+    long zc_copied;
+    histogram_t hist;
+} point_t;
+
+/* state shared by the event-loop threads of the epoll server */
+typedef struct epoll_shared_t
+{
+    long closed;
+    int done;
+} epoll_shared_t;
+
+/* one connection of the epoll client or server; in latency mode a message
+ * is either being sent or being received, in throughput mode the client
+ * sends its packets, shuts down its side and waits for the acknowledgement
+ */
+typedef struct conn_t
+{
+    int fd;
+    int sending;
+    int finished;
+    long done;
+    long remaining;
+    long sent_at;
+    char *buffer;
+} conn_t;
 
 typedef struct thread_arg_t
 {
@@ -29,8 +168,241 @@ typedef struct thread_arg_t
     int num_messages;
     int num_packets;
     long runtime;
+    int tid;
+    int num_threads;
+    options_t *opts;
+    epoll_shared_t *shared;
+    pthread_barrier_t *barrier;
+    pthread_barrier_t *ready;
+    point_t *points;
+    int num_points;
+    sender_t sender;
+    long bytes;
+    long connect_time;
+    long connections;
+    histogram_t hist;
+    histogram_t request_hist;
 } thread_arg_t;
 
+int parse_option(options_t *opts, const char *opt)
+{
+    char *end;
+
+    if (strcmp(opt, "--server=threads") == 0) {
+        opts->server = SERVER_THREADS;
+        return 0;
+    } else if (strcmp(opt, "--server=epoll") == 0) {
+        opts->server = SERVER_EPOLL;
+        return 0;
+    } else if (strncmp(opt, "--connections=", 14) == 0) {
+        opts->connections = atoi(opt + 14);
+        return opts->connections <= 0 ? -1 : 0;
+    } else if (strncmp(opt, "--rate=", 7) == 0) {
+        opts->rate = atof(opt + 7);
+        return opts->rate <= 0 ? -1 : 0;
+    } else if (strncmp(opt, "--runtime=", 10) == 0) {
+        opts->runtime = atol(opt + 10);
+        return opts->runtime <= 0 ? -1 : 0;
+    } else if (strncmp(opt, "--size=", 7) == 0) {
+        opts->size = parse_size(opt + 7, &end);
+        return (*end != '\0' || opts->size <= 0) ? -1 : 0;
+    } else if (strcmp(opt, "--send=copy") == 0) {
+        opts->send = SEND_COPY;
+        return 0;
+    } else if (strcmp(opt, "--send=zerocopy") == 0) {
+        opts->send = SEND_ZEROCOPY;
+        return 0;
+    } else if (strcmp(opt, "--send=sendfile") == 0) {
+        opts->send = SEND_SENDFILE;
+        return 0;
+    } else if (strcmp(opt, "--send=splice") == 0) {
+        opts->send = SEND_SPLICE;
+        return 0;
+    } else if (strncmp(opt, "--file=", 7) == 0) {
+        opts->file = (char *) opt + 7;
+        return 0;
+    } else if (strcmp(opt, "--sweep") == 0) {
+        opts->sweep = 1;
+        return 0;
+    } else if (strncmp(opt, "--time=", 7) == 0) {
+        opts->time = atof(opt + 7);
+        return opts->time <= 0 ? -1 : 0;
+    } else if (strcmp(opt, "--nodelay") == 0) {
+        opts->tuning.nodelay = 1;
+        return 0;
+    } else if (strcmp(opt, "--quickack") == 0) {
+        opts->tuning.quickack = 1;
+        return 0;
+    } else if (strncmp(opt, "--sndbuf=", 9) == 0) {
+        opts->tuning.sndbuf = parse_size(opt + 9, &end);
+        return (*end != '\0' || opts->tuning.sndbuf <= 0) ? -1 : 0;
+    } else if (strncmp(opt, "--rcvbuf=", 9) == 0) {
+        opts->tuning.rcvbuf = parse_size(opt + 9, &end);
+        return (*end != '\0' || opts->tuning.rcvbuf <= 0) ? -1 : 0;
+    } else if (strncmp(opt, "--busy-poll=", 12) == 0) {
+        opts->tuning.busy_poll = atoi(opt + 12);
+        return opts->tuning.busy_poll <= 0 ? -1 : 0;
+    } else if (strncmp(opt, "--cork=", 7) == 0) {
+        opts->tuning.cork = atoi(opt + 7);
+        return opts->tuning.cork <= 0 ? -1 : 0;
+    } else if (strcmp(opt, "--tune") == 0) {
+        opts->tune = 1;
+        return 0;
+    } else if (strcmp(opt, "--loopback") == 0) {
+        opts->loopback = 1;
+        return 0;
+    } else if (strcmp(opt, "--reuseport") == 0) {
+        opts->reuseport = 1;
+        return 0;
+    }
+    return -1;
+}
+
+/* builds the socket option matrix of the tuning sweep: the latency
+ * experiment combines Nagle, delayed acknowledgements, busy polling and
+ * large buffers, the throughput experiment combines Nagle, the buffer sizes,
+ * busy polling and corked batches of writes; returns the number of entries
+ * and fills the matrix when one is given
+ */
+int init_tunings(int mode, tuning_t *tunings)
+{
+    long buffers[] = { 0, 256 * 1024, 4 * 1024 * 1024 };
+    int nodelay, quickack, busy_poll, cork, b, n;
+
+    n = 0;
+    for (nodelay = 0; nodelay <= 1; ++nodelay) {
+        for (busy_poll = 0; busy_poll <= TUNE_BUSY_POLL;
+                busy_poll += TUNE_BUSY_POLL) {
+            if (mode == MODE_LATENCY) {
+                for (quickack = 0; quickack <= 1; ++quickack) {
+                    for (b = 0; b < 3; b += 2) {
+                        if (tunings != NULL) {
+                            memset(&tunings[n], 0, sizeof(tuning_t));
+                            tunings[n].nodelay = nodelay;
+                            tunings[n].busy_poll = busy_poll;
+                            tunings[n].quickack = quickack;
+                            tunings[n].sndbuf = buffers[b];
+                            tunings[n].rcvbuf = buffers[b];
+                        }
+                        n++;
+                    }
+                }
+                continue;
+            }
+            for (cork = 0; cork <= TUNE_CORK; cork += TUNE_CORK) {
+                for (b = 0; b < 3; ++b) {
+                    if (tunings != NULL) {
+                        memset(&tunings[n], 0, sizeof(tuning_t));
+                        tunings[n].nodelay = nodelay;
+                        tunings[n].busy_poll = busy_poll;
+                        tunings[n].cork = cork;
+                        tunings[n].sndbuf = buffers[b];
+                        tunings[n].rcvbuf = buffers[b];
+                    }
+                    n++;
+                }
+            }
+        }
+    }
+    return n;
+}
+
+/* prints the socket options as the command line flags that select them */
+void print_tuning(tuning_t *t)
+{
+    if (t->nodelay) {
+        printf(" --nodelay");
+    }
+    if (t->quickack) {
+        printf(" --quickack");
+    }
+    if (t->sndbuf > 0) {
+        printf(" --sndbuf=%ldk", t->sndbuf / 1024);
+    }
+    if (t->rcvbuf > 0) {
+        printf(" --rcvbuf=%ldk", t->rcvbuf / 1024);
+    }
+    if (t->busy_poll > 0) {
+        printf(" --busy-poll=%d", t->busy_poll);
+    }
+    if (t->cork > 0) {
+        printf(" --cork=%d", t->cork);
+    }
+    if (!t->nodelay && !t->quickack && t->sndbuf == 0 && t->rcvbuf == 0
+            && t->busy_poll == 0 && t->cork == 0) {
+        printf(" defaults");
+    }
+    printf("\n");
+}
+
+/* builds the list of message sizes of a run: the sweep doubles the size from
+ * SWEEP_MIN to SWEEP_MAX, otherwise only --size is measured
+ */
+point_t *init_points(options_t *opts, int mode, int *num_points)
+{
+    tuning_t *tunings;
+    point_t *points;
+    long size;
+    int n, i;
+
+    // the tuning sweep measures every socket configuration at --size //
+    if (opts->tune) {
+        n = init_tunings(mode, NULL);
+        tunings = (tuning_t *) calloc(n, sizeof(tuning_t));
+        init_tunings(mode, tunings);
+        points = (point_t *) calloc(n, sizeof(point_t));
+        for (i = 0; i < n; ++i) {
+            points[i].size = opts->size;
+            points[i].tuning = tunings[i];
+        }
+        free(tunings);
+        *num_points = n;
+        return points;
+    }
+
+    if (!opts->sweep) {
+        points = (point_t *) calloc(1, sizeof(point_t));
+        points[0].size = opts->size;
+        points[0].tuning = opts->tuning;
+        *num_points = 1;
+        return points;
+    }
+
+    n = 0;
+    for (size = SWEEP_MIN; size <= SWEEP_MAX; size *= 2) {
+        n++;
+    }
+    points = (point_t *) calloc(n, sizeof(point_t));
+    n = 0;
+    for (size = SWEEP_MIN; size <= SWEEP_MAX; size *= 2) {
+        points[n].tuning = opts->tuning;
+        points[n++].size = size;
+    }
+    *num_points = n;
+    return points;
+}
+
+/* largest buffer needed by a run, including the throughput acknowledgement */
+long buffer_size(options_t *opts)
+{
+    long size;
+
+    size = opts->sweep ? SWEEP_MAX : opts->size;
+    return size > ACK_SIZE ? size : ACK_SIZE;
+}
+
+/* without a time budget the fixed message counts are kept for small
+ * messages and scaled down for large ones, so that a run moves at most as
+ * many bytes as it would with PACKET_SIZE messages
+ */
+long scale_count(long count, long size)
+{
+    if (size > PACKET_SIZE) {
+        count = count * PACKET_SIZE / size;
+    }
+    return count > 0 ? count : 1;
+}
+
 void init_dataset(char *dataset, int n)
 {
     int i;
@@ -40,286 +412,1382 @@ void init_dataset(char *dataset, int n)
     }
 }
 
+/* sends or receives exactly size bytes; returns 0 once the whole buffer was
+ * transferred, 1 if the peer closed the connection first and -1 on errors
+ */
+int transfer(int fd, char *buffer, long size, int sending)
+{
+    long rc, rd;
+
+    rc = 0;
+    while (rc < size) {
+        if (sending) {
+            rd = send(fd, &buffer[rc], size - rc, MSG_NOSIGNAL);
+        } else {
+            rd = recv(fd, &buffer[rc], size - rc, 0);
+        }
+
+        if (rd == 0 && !sending) {
+            return 1;
+        }
+
+        if (rd < 0) {
+            return -1;
+        }
+
+        rc += rd;
+    }
+    return 0;
+}
+
+int set_nonblocking(int fd)
+{
+    int flags = fcntl(fd, F_GETFL, 0);
+
+    if (flags < 0) {
+        return -1;
+    }
+    return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+/* cpu time in microseconds between two rusage samples */
+long cpu_time(struct timeval *start, struct timeval *end)
+{
+    return ((long) end->tv_sec - (long) start->tv_sec) * 1000000
+            + (end->tv_usec - start->tv_usec);
+}
+
+/* applies the buffer sizes of a connection; they have to be set before
+ * connecting, or on the listening socket, to take part in the window
+ * negotiation. A rejected option is reported and left at the kernel
+ * default, so that both sides stay in step
+ */
+void apply_buffers(int fd, tuning_t *t)
+{
+    int value;
+
+    if (t->sndbuf > 0) {
+        value = (int) t->sndbuf;
+        if (setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &value,
+                sizeof(value)) < 0) {
+            fprintf(stderr, "Could not set SO_SNDBUF: %s\n",
+                    strerror(errno));
+        }
+    }
+    if (t->rcvbuf > 0) {
+        value = (int) t->rcvbuf;
+        if (setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &value,
+                sizeof(value)) < 0) {
+            fprintf(stderr, "Could not set SO_RCVBUF: %s\n",
+                    strerror(errno));
+        }
+    }
+}
+
+/* applies the per-connection socket options, which take effect at any time */
+void apply_tuning(int fd, tuning_t *t)
+{
+    int value;
+
+    if (t->nodelay) {
+        value = 1;
+        if (setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &value,
+                sizeof(value)) < 0) {
+            fprintf(stderr, "Could not set TCP_NODELAY: %s\n",
+                    strerror(errno));
+        }
+    }
+    if (t->busy_poll > 0) {
+        value = t->busy_poll;
+        if (setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &value,
+                sizeof(value)) < 0) {
+            fprintf(stderr, "Could not set SO_BUSY_POLL: %s\n",
+                    strerror(errno));
+        }
+    }
+}
+
+/* the kernel leaves quick acknowledgement mode on its own, so the option is
+ * set again before every receive
+ */
+void rearm_quickack(int fd, tuning_t *t)
+{
+    int one;
+
+    if (t->quickack) {
+        one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_QUICKACK, &one, sizeof(one));
+    }
+}
+
+int set_cork(int fd, int on)
+{
+    return setsockopt(fd, IPPROTO_TCP, TCP_CORK, &on, sizeof(on));
+}
+
+/* opens the source of sendfile and splice: the file given with --file, or
+ * an in-memory file holding the dataset
+ */
+int open_source(thread_arg_t *arg, char *buffer, long size)
+{
+    sender_t *s = &arg->sender;
+    struct stat st;
+    long rc, rd;
+
+    if (arg->opts->file != NULL) {
+        s->file = open(arg->opts->file, O_RDONLY);
+        if (s->file < 0 || fstat(s->file, &st) < 0 || st.st_size <= 0) {
+            return -1;
+        }
+        s->file_size = st.st_size;
+    } else {
+        s->file = memfd_create("benchmark-tcp", 0);
+        if (s->file < 0) {
+            return -1;
+        }
+        for (rc = 0; rc < size; rc += rd) {
+            rd = write(s->file, &buffer[rc], size - rc);
+            if (rd <= 0) {
+                return -1;
+            }
+        }
+        s->file_size = size;
+    }
+
+    if (arg->opts->send == SEND_SPLICE) {
+        if (pipe(s->pipe) < 0) {
+            return -1;
+        }
+        // a larger pipe moves a whole message with fewer splice calls //
+        fcntl(s->pipe[1], F_SETPIPE_SZ, size);
+        s->pipe_size = fcntl(s->pipe[1], F_GETPIPE_SZ);
+        if (s->pipe_size <= 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void close_source(thread_arg_t *arg)
+{
+    if (arg->sender.file >= 0) {
+        close(arg->sender.file);
+    }
+    if (arg->opts->send == SEND_SPLICE) {
+        close(arg->sender.pipe[0]);
+        close(arg->sender.pipe[1]);
+    }
+}
+
+/* sends size bytes of the source file with sendfile, wrapping around at the
+ * end of the file
+ */
+int send_file(sender_t *s, int fd, long size)
+{
+    long rc, rd, len;
+
+    for (rc = 0; rc < size; rc += rd) {
+        if (s->offset >= s->file_size) {
+            s->offset = 0;
+        }
+        len = size - rc;
+        if (len > s->file_size - s->offset) {
+            len = s->file_size - s->offset;
+        }
+        rd = sendfile(fd, s->file, &s->offset, len);
+        if (rd <= 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* moves size bytes of the source file into the socket through a pipe, so
+ * the data only moves as page references
+ */
+int send_splice(sender_t *s, int fd, long size)
+{
+    loff_t offset;
+    long rc, rd, wr, len;
+
+    for (rc = 0; rc < size; rc += rd) {
+        if (s->offset >= s->file_size) {
+            s->offset = 0;
+        }
+        len = size - rc;
+        if (len > s->file_size - s->offset) {
+            len = s->file_size - s->offset;
+        }
+        if (len > s->pipe_size) {
+            len = s->pipe_size;
+        }
+
+        offset = s->offset;
+        rd = splice(s->file, &offset, s->pipe[1], NULL, len, SPLICE_F_MOVE);
+        if (rd <= 0) {
+            return -1;
+        }
+        s->offset = offset;
+
+        for (len = rd; len > 0; len -= wr) {
+            wr = splice(s->pipe[0], NULL, fd, NULL, len,
+                    SPLICE_F_MOVE | SPLICE_F_MORE);
+            if (wr <= 0) {
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+/* reads the zero-copy completions from the error queue of the socket; every
+ * notification covers a range of send calls, and the kernel flags the
+ * ranges it had to copy after all (always the case over loopback)
+ */
+int reap_completions(sender_t *s, int fd)
+{
+    struct sock_extended_err *serr;
+    struct msghdr msg;
+    struct cmsghdr *cm;
+    char control[128];
+    long n;
+
+    for (;;) {
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        if (recvmsg(fd, &msg, MSG_ERRQUEUE) < 0) {
+            return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+        }
+
+        for (cm = CMSG_FIRSTHDR(&msg); cm != NULL;
+                cm = CMSG_NXTHDR(&msg, cm)) {
+            serr = (struct sock_extended_err *) CMSG_DATA(cm);
+            if (serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+                continue;
+            }
+            if (serr->ee_errno != 0) {
+                errno = serr->ee_errno;
+                return -1;
+            }
+            n = (long) (serr->ee_data - serr->ee_info) + 1;
+            s->zc_completed += n;
+            if (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+                s->zc_copied += n;
+            }
+        }
+    }
+}
+
+/* waits until at most pending zero-copy sends are still in flight */
+int wait_completions(sender_t *s, int fd, long pending)
+{
+    struct pollfd pfd;
+
+    pfd.fd = fd;
+    pfd.events = 0;
+    while (s->zc_sends - s->zc_completed > pending) {
+        // the error queue is reported as POLLERR //
+        if (poll(&pfd, 1, 1) < 0 || reap_completions(s, fd) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* sends one message with MSG_ZEROCOPY; the buffer is never modified, so it
+ * may be reused before its completion arrives, and only the number of sends
+ * in flight is bounded
+ */
+int send_zerocopy(sender_t *s, int fd, char *buffer, long size)
+{
+    long rc, rd;
+
+    for (rc = 0; rc < size; rc += rd) {
+        if (wait_completions(s, fd, ZEROCOPY_PENDING) < 0) {
+            return -1;
+        }
+        rd = send(fd, &buffer[rc], size - rc, MSG_ZEROCOPY | MSG_NOSIGNAL);
+        if (rd < 0 && errno == ENOBUFS) {
+            // out of option memory for the notifications //
+            if (wait_completions(s, fd, 0) < 0) {
+                return -1;
+            }
+            rd = 0;
+            continue;
+        }
+        if (rd < 0) {
+            return -1;
+        }
+        s->zc_sends++;
+    }
+    return 0;
+}
+
+/* sends one message through the path selected with --send */
+int send_message(thread_arg_t *arg, int fd, char *buffer, long size)
+{
+    switch (arg->opts->send) {
+        case SEND_ZEROCOPY:
+            return send_zerocopy(&arg->sender, fd, buffer, size);
+        case SEND_SENDFILE:
+            return send_file(&arg->sender, fd, size);
+        case SEND_SPLICE:
+            return send_splice(&arg->sender, fd, size);
+        default:
+            return transfer(fd, buffer, size, 1) == 0 ? 0 : -1;
+    }
+}
+
+/* serves one client connection until the client closes it: in latency mode
+ * every message is echoed back, in throughput mode the packets are drained
+ * and acknowledged once the client shuts down its side
+ */
+int serve_connection(thread_arg_t *arg, int fd, char *buffer, int size,
+        tuning_t *tuning)
+{
+    struct rusage start, end;
+    ack_t ack;
+    long rd;
+    int rc;
+
+    apply_tuning(fd, tuning);
+
+    if (arg->mode == MODE_LATENCY) {
+        for (;;) {
+            rearm_quickack(fd, tuning);
+            rc = transfer(fd, buffer, size, 0);
+            if (rc != 0) {
+                return rc < 0 ? -1 : 0;
+            }
+            if (transfer(fd, buffer, size, 1) < 0) {
+                return -1;
+            }
+        }
+    }
+
+    getrusage(RUSAGE_THREAD, &start);
+    ack.bytes = 0;
+    while ((rd = recv(fd, buffer, size, 0)) > 0) {
+        ack.bytes += rd;
+    }
+    if (rd < 0) {
+        return -1;
+    }
+    getrusage(RUSAGE_THREAD, &end);
+
+    ack.user = cpu_time(&start.ru_utime, &end.ru_utime);
+    ack.sys = cpu_time(&start.ru_stime, &end.ru_stime);
+    memset(buffer, 0, ACK_SIZE);
+    memcpy(buffer, &ack, sizeof(ack));
+    return transfer(fd, buffer, ACK_SIZE, 1);
+}
+
+/* replaces the listening socket of a server thread with one holding the
+ * buffer sizes of the next point, which its connections inherit; a socket
+ * that had its buffers set can not go back to the autotuned default
+ */
+int reopen_listener(thread_arg_t *arg, tuning_t *t)
+{
+    int fd, one;
+
+    close(arg->sockfd);
+    arg->sockfd = socket(arg->srv->sa_family, SOCK_STREAM, 0);
+    fd = arg->sockfd;
+    if (fd < 0) {
+        return -1;
+    }
+    apply_buffers(fd, t);
+    one = 1;
+    if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) < 0
+            || bind(fd, arg->srv, arg->addrlen) < 0) {
+        return -1;
+    }
+    return listen(fd, 10);
+}
+
 void *work_server(void *argv)
 {
     thread_arg_t *arg;
     struct sockaddr_storage clt;
     socklen_t addrlen;
     char *buffer;
-    int newfd, rc, rd, i;
+    int newfd, p, rc;
 
     arg = (thread_arg_t *) argv;
 
-    if (listen(arg->sockfd, 10) < 0) {
+    apply_buffers(arg->sockfd, &arg->points[0].tuning);
+    rc = listen(arg->sockfd, 10);
+
+    // an in-process client waits until every server thread listens //
+    if (arg->ready != NULL) {
+        pthread_barrier_wait(arg->ready);
+    }
+
+    if (rc < 0) {
         fprintf(stderr, "Could not listen on socket!\n");
         pthread_exit(NULL);
     }
 
-    newfd = accept(arg->sockfd, (struct sockaddr *) &clt, &addrlen);
+    buffer = (char *) malloc(buffer_size(arg->opts) * sizeof(char));
 
-    if (newfd < 0) {
-        fprintf(stderr, "Could not accept socket!\n");
-        pthread_exit(NULL);
+    // the client opens one connection per message size //
+    for (p = 0; p < arg->num_points; ++p) {
+        addrlen = sizeof(clt);
+        newfd = accept(arg->sockfd, (struct sockaddr *) &clt, &addrlen);
+
+        if (newfd < 0) {
+            fprintf(stderr, "Could not accept socket!\n");
+            free(buffer);
+            pthread_exit(NULL);
+        }
+
+        // the client connects for the next point only once this one is
+        // served, so its buffers are on the listener before its SYN //
+        if (p + 1 < arg->num_points
+                && (arg->points[p + 1].tuning.sndbuf
+                != arg->points[p].tuning.sndbuf
+                || arg->points[p + 1].tuning.rcvbuf
+                != arg->points[p].tuning.rcvbuf)
+                && reopen_listener(arg, &arg->points[p + 1].tuning) < 0) {
+            fprintf(stderr, "Could not listen on socket!\n");
+            close(newfd);
+            free(buffer);
+            pthread_exit(NULL);
+        }
+
+        if (serve_connection(arg, newfd, buffer, arg->points[p].size,
+                &arg->points[p].tuning) < 0) {
+            fprintf(stderr, "Could not serve connection: %s\n",
+                    strerror(errno));
+        }
+
+        close(newfd);
+    }
+
+    free(buffer);
+    pthread_exit(NULL);
+}
+
+/* runs count ping-pong messages, recording their round trip time when a
+ * histogram is given
+ */
+int ping_pong(int fd, char *buffer, int size, long count, tuning_t *tuning,
+        histogram_t *hist)
+{
+    long i, sent_at;
+
+    for (i = 0; i < count; ++i) {
+        sent_at = now_ns();
+        if (transfer(fd, buffer, size, 1) != 0) {
+            return -1;
+        }
+        rearm_quickack(fd, tuning);
+        if (transfer(fd, buffer, size, 0) != 0) {
+            return -1;
+        }
+        if (hist != NULL) {
+            hist_record(hist, now_ns() - sent_at);
+        }
+    }
+    return 0;
+}
+
+/* streams count messages; with corking every batch of messages is held
+ * back by the kernel and sent in full segments once the batch is complete.
+ * Zero-copy sends may still be in flight on return, see wait_completions
+ */
+int stream(thread_arg_t *arg, int fd, char *buffer, int size, long count,
+        tuning_t *tuning)
+{
+    long i;
+    int cork;
+
+    cork = tuning->cork;
+    for (i = 0; i < count; ++i) {
+        if (cork > 0 && i % cork == 0 && set_cork(fd, 1) < 0) {
+            return -1;
+        }
+        if (send_message(arg, fd, buffer, size) != 0) {
+            return -1;
+        }
+        if (cork > 0 && ((i + 1) % cork == 0 || i + 1 == count)
+                && set_cork(fd, 0) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* picks the number of iterations that fills the time budget: the iteration
+ * count is doubled until a run takes 5% of the budget, and the measured
+ * rate is extrapolated to the whole budget. The zero-copy completions are
+ * collected after the timing, so their waits don't shrink the count
+ */
+long calibrate(thread_arg_t *arg, int fd, char *buffer, int size,
+        tuning_t *tuning)
+{
+    long budget, count, start, elapsed;
+    int rc;
+
+    budget = (long) (arg->opts->time * 1e9);
+    count = 1;
+    for (;;) {
+        start = now_ns();
+        if (arg->mode == MODE_LATENCY) {
+            rc = ping_pong(fd, buffer, size, count, tuning, NULL);
+        } else {
+            rc = stream(arg, fd, buffer, size, count, tuning);
+        }
+        elapsed = now_ns() - start;
+        if (rc == 0 && arg->opts->send == SEND_ZEROCOPY) {
+            rc = wait_completions(&arg->sender, fd, 0);
+        }
+
+        if (rc < 0) {
+            return -1;
+        }
+        if (elapsed >= budget / 20 || count >= (1L << 30)) {
+            break;
+        }
+        count *= 2;
     }
 
-    buffer = (char *) malloc(PACKET_SIZE * sizeof(char));
+    count = (long) ((double) budget * count / (elapsed > 0 ? elapsed : 1));
+    return count > 0 ? count : 1;
+}
+
+/* open-loop latency client: message i is due at start + i * interval no
+ * matter how many replies are still outstanding, and its latency is taken
+ * from that intended send time, so a stalled server is not hidden by the
+ * client slowing down (coordinated omission). The socket is non-blocking
+ * and the echoes are drained while sends are pending, so a client that
+ * falls behind schedule never stops reading and stalls the server
+ */
+int open_loop(thread_arg_t *arg, int fd, char *buffer, char *scratch,
+        point_t *point)
+{
+    struct pollfd pfd;
+    struct timespec timeout;
+    long interval, start, now, wait, count, sent, received, offset, rc, rd;
+
+    interval = (long) (1e9 * arg->num_threads / arg->opts->rate);
+    count = (long) (arg->opts->rate * arg->opts->runtime / arg->num_threads);
+    if (set_nonblocking(fd) < 0) {
+        return -1;
+    }
+    pfd.fd = fd;
 
+    sent = 0;
+    offset = 0;
+    received = 0;
+    rc = 0;
+    start = now_ns();
+    now = start;
+    while (received < count) {
+        // sends the due messages until the send buffer is full //
+        while (sent < count && now >= start + sent * interval) {
+            rd = send(fd, &buffer[offset], point->size - offset,
+                    MSG_NOSIGNAL);
+            if (rd < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                break;
+            }
+            if (rd < 0) {
+                return -1;
+            }
+            offset += rd;
+            if (offset == point->size) {
+                sent++;
+                offset = 0;
+            }
+        }
+
+        // waits for echoes, for room to send or for the next message //
+        pfd.events = POLLIN;
+        if (sent < count && now >= start + sent * interval) {
+            pfd.events |= POLLOUT;
+            wait = 1000000000L;
+        } else if (sent < count) {
+            wait = start + sent * interval - now;
+        } else {
+            wait = 1000000000L;
+        }
+        timeout.tv_sec = wait / 1000000000L;
+        timeout.tv_nsec = wait % 1000000000L;
+        if (ppoll(&pfd, 1, &timeout, NULL) < 0) {
+            return -1;
+        }
+
+        while (pfd.revents & (POLLIN | POLLERR | POLLHUP)
+                && received < count) {
+            rd = recv(fd, scratch, point->size - rc, 0);
+            if (rd == 0) {
+                return -1;
+            }
+            if (rd < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                break;
+            }
+            if (rd < 0) {
+                return -1;
+            }
+            rc += rd;
+            if (rc == point->size) {
+                hist_record(&point->hist,
+                        now_ns() - (start + received * interval));
+                received++;
+                rc = 0;
+            }
+        }
+        now = now_ns();
+    }
+
+    point->runtime = (now - start) / 1000;
+    point->count = received;
+    point->bytes = received * point->size;
+
+    return 0;
+}
+
+/* runs one message size over a fresh connection: the iteration count is
+ * either fixed or derived from the time budget, and the timed region
+ * excludes the connection setup and the calibration
+ */
+int run_point(thread_arg_t *arg, int fd, char *buffer, char *scratch,
+        point_t *point)
+{
+    struct rusage usage_start, usage_end;
+    ack_t ack;
+    long count, start, end;
+    int rc, one;
+
+    if (arg->mode == MODE_LATENCY && arg->opts->rate > 0) {
+        return open_loop(arg, fd, buffer, scratch, point);
+    }
+
+    one = 1;
+    if (arg->opts->send == SEND_ZEROCOPY && setsockopt(fd, SOL_SOCKET,
+            SO_ZEROCOPY, &one, sizeof(one)) < 0) {
+        return -1;
+    }
+
+    if (arg->opts->time > 0) {
+        count = calibrate(arg, fd, buffer, point->size, &point->tuning);
+        if (count < 0) {
+            return -1;
+        }
+    } else if (arg->mode == MODE_LATENCY) {
+        count = scale_count(arg->num_messages, point->size);
+    } else {
+        count = scale_count(arg->num_packets, point->size);
+    }
+
+    arg->sender.zc_sends = 0;
+    arg->sender.zc_completed = 0;
+    arg->sender.zc_copied = 0;
+
+    getrusage(RUSAGE_THREAD, &usage_start);
+    start = now_ns();
     if (arg->mode == MODE_LATENCY) {
-        for (i = 0; i < arg->num_messages; ++i) {
-            memset(buffer, 0, PACKET_SIZE);
-            
-            rc = 0;
-            while (rc < PACKET_SIZE) {
-                rd = recv(newfd, &buffer[rc], PACKET_SIZE - rc, 0);
-                
-                if (rd == 0) {
-                    fprintf(stdout, "Connection closed at receive!\n");
-                    break;
+        rc = ping_pong(fd, buffer, point->size, count, &point->tuning,
+                &point->hist);
+    } else {
+        rc = stream(arg, fd, buffer, point->size, count, &point->tuning);
+        if (rc == 0 && arg->opts->send == SEND_ZEROCOPY) {
+            rc = wait_completions(&arg->sender, fd, 0);
+        }
+        if (rc == 0) {
+            shutdown(fd, SHUT_WR);
+            rc = transfer(fd, scratch, ACK_SIZE, 0);
+        }
+    }
+    end = now_ns();
+    getrusage(RUSAGE_THREAD, &usage_end);
+
+    if (rc != 0) {
+        return -1;
+    }
+
+    point->runtime = (end - start) / 1000;
+    point->count = count;
+    point->bytes = count * point->size;
+    point->send_cpu = cpu_time(&usage_start.ru_utime, &usage_end.ru_utime)
+            + cpu_time(&usage_start.ru_stime, &usage_end.ru_stime);
+    point->zc_sends = arg->sender.zc_sends;
+    point->zc_copied = arg->sender.zc_copied;
+
+    // the server also counted the calibration, which is left out pro rata //
+    if (arg->mode == MODE_THROUGHPUT) {
+        memcpy(&ack, scratch, sizeof(ack));
+        if (ack.bytes > 0) {
+            point->recv_user = (double) ack.user * point->bytes / ack.bytes;
+            point->recv_sys = (double) ack.sys * point->bytes / ack.bytes;
+        }
+    }
+
+    return 0;
+}
+
+void *work_client(void *argv)
+{
+    thread_arg_t *arg;
+    char *buffer, *scratch;
+    int p, size;
+
+    arg = (thread_arg_t *) argv;
+
+    size = buffer_size(arg->opts);
+    buffer = (char *) malloc(size * sizeof(char));
+    scratch = (char *) malloc(size * sizeof(char));
+
+    init_dataset(buffer, size);
+
+    arg->sender.file = -1;
+    if ((arg->opts->send == SEND_SENDFILE || arg->opts->send == SEND_SPLICE)
+            && open_source(arg, buffer, size) < 0) {
+        fprintf(stderr, "Could not open the source file: %s\n",
+                strerror(errno));
+        free(buffer);
+        free(scratch);
+        pthread_exit(NULL);
+    }
+
+    for (p = 0; p < arg->num_points; ++p) {
+        if (arg->sockfd < 0) {
+            arg->sockfd = socket(AF_INET, SOCK_STREAM, 0);
+        }
+
+        apply_buffers(arg->sockfd, &arg->points[p].tuning);
+        apply_tuning(arg->sockfd, &arg->points[p].tuning);
+
+        // every thread starts a message size at the same time //
+        pthread_barrier_wait(arg->barrier);
+
+        if (connect(arg->sockfd, arg->srv, arg->addrlen) < 0) {
+            fprintf(stderr, "Could not connect to server!\n");
+        } else if (run_point(arg, arg->sockfd, buffer, scratch,
+                &arg->points[p]) < 0) {
+            fprintf(stderr, "Could not run experiment: %s\n",
+                    strerror(errno));
+        }
+
+        close(arg->sockfd);
+        arg->sockfd = -1;
+    }
+
+    close_source(arg);
+    free(buffer);
+    free(scratch);
+    pthread_exit(NULL);
+}
+
+/* connection rate server: every thread accepts connections, answers their
+ * single request and closes them first, so that TIME_WAIT stays on the
+ * server side; without --reuseport the threads share one listening socket,
+ * with it every thread has a listening socket of its own on the same port.
+ * A request starting with a zero byte stops the thread that accepted it
+ */
+void *work_connrate_server(void *argv)
+{
+    thread_arg_t *arg;
+    char *buffer;
+    long size;
+    int fd, rc, stop;
+
+    arg = (thread_arg_t *) argv;
+    size = arg->opts->size;
+
+    rc = listen(arg->sockfd, LISTEN_BACKLOG);
+
+    // an in-process client waits until every server thread listens //
+    if (arg->ready != NULL) {
+        pthread_barrier_wait(arg->ready);
+    }
+
+    if (rc < 0) {
+        fprintf(stderr, "Could not listen on socket!\n");
+        pthread_exit(NULL);
+    }
+
+    buffer = (char *) malloc(size * sizeof(char));
+
+    stop = 0;
+    while (!stop) {
+        fd = accept4(arg->sockfd, NULL, NULL, SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            fprintf(stderr, "Could not accept socket!\n");
+            break;
+        }
+
+        rc = transfer(fd, buffer, size, 0);
+        if (rc == 0) {
+            stop = buffer[0] == 0;
+            rc = transfer(fd, buffer, size, 1);
+        }
+        if (rc == 0 && !stop) {
+            arg->connections++;
+        }
+        close(fd);
+    }
+
+    // the stop requests still queued here are reset and sent again //
+    close(arg->sockfd);
+    arg->sockfd = -1;
+
+    fprintf(stderr, "Thread %d accepted %ld connections\n", arg->tid,
+            arg->connections);
+
+    free(buffer);
+    pthread_exit(NULL);
+}
+
+/* opens one connection, sends its request and waits for the response and
+ * the close of the server; the handshake is timed up to the return of
+ * connect(), the request up to the end of the response
+ */
+int connect_once(thread_arg_t *arg, char *buffer, long size, int record)
+{
+    long start, connected, end;
+    int fd, rc;
+
+    fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return -1;
+    }
+
+    start = now_ns();
+    if (connect(fd, arg->srv, arg->addrlen) < 0) {
+        close(fd);
+        return -1;
+    }
+    connected = now_ns();
+
+    rc = transfer(fd, buffer, size, 1);
+    if (rc == 0) {
+        rc = transfer(fd, buffer, size, 0);
+    }
+    if (rc == 0 && recv(fd, buffer, 1, 0) != 0) {
+        rc = -1;
+    }
+    end = now_ns();
+    close(fd);
+
+    if (rc != 0) {
+        return -1;
+    }
+    if (record) {
+        hist_record(&arg->hist, connected - start);
+        hist_record(&arg->request_hist, end - start);
+    }
+    return 0;
+}
+
+/* connection rate client: opens short-lived connections back to back for
+ * the time budget or the fixed connection count, then stops one server
+ * thread once every client thread is done
+ */
+void *work_connrate_client(void *argv)
+{
+    thread_arg_t *arg;
+    char *buffer;
+    long size, count, deadline, start, end;
+    int i;
+
+    arg = (thread_arg_t *) argv;
+    size = arg->opts->size;
+
+    buffer = (char *) malloc(size * sizeof(char));
+    init_dataset(buffer, size);
+
+    count = NUM_CONNECTIONS / arg->num_threads;
+    deadline = 0;
+
+    // every thread starts connecting at the same time //
+    pthread_barrier_wait(arg->barrier);
+
+    start = now_ns();
+    if (arg->opts->time > 0) {
+        deadline = start + (long) (arg->opts->time * 1e9);
+    }
+    while (deadline > 0 ? now_ns() < deadline
+            : arg->connections < count) {
+        if (connect_once(arg, buffer, size, 1) < 0) {
+            fprintf(stderr, "Could not run connection: %s\n",
+                    strerror(errno));
+            break;
+        }
+        arg->connections++;
+    }
+    end = now_ns();
+    arg->runtime = (end - start) / 1000;
+
+    // a stop request must not take a server thread from another client //
+    pthread_barrier_wait(arg->barrier);
+
+    buffer[0] = 0;
+    for (i = 0; i < STOP_RETRIES; ++i) {
+        if (connect_once(arg, buffer, size, 0) == 0) {
+            break;
+        }
+        buffer[0] = 0;
+        usleep(10000);
+    }
+    if (i == STOP_RETRIES) {
+        fprintf(stderr, "Could not stop the server!\n");
+    }
+
+    free(buffer);
+    pthread_exit(NULL);
+}
+
+/* number of connections handled by one client thread */
+int thread_connections(thread_arg_t *arg)
+{
+    return arg->opts->connections / arg->num_threads
+            + (arg->tid < arg->opts->connections % arg->num_threads);
+}
+
+/* advances a server connection as far as it goes without blocking, as
+ * required by edge-triggered notifications; returns 1 once the client
+ * closed the connection and -1 on errors
+ */
+int server_progress(thread_arg_t *arg, conn_t *c, char *scratch)
+{
+    long rd, size;
+
+    size = arg->opts->size;
+    for (;;) {
+        if (c->sending) {
+            rd = send(c->fd, &c->buffer[c->done], size - c->done,
+                    MSG_NOSIGNAL);
+            if (rd < 0) {
+                return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+            }
+            c->done += rd;
+            if (c->done == size) {
+                c->sending = 0;
+                c->done = 0;
+            }
+            continue;
+        }
+
+        if (arg->mode == MODE_LATENCY) {
+            rd = recv(c->fd, &c->buffer[c->done], size - c->done, 0);
+        } else {
+            rd = recv(c->fd, scratch, size, 0);
+        }
+        if (rd < 0) {
+            return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+        }
+        if (rd == 0) {
+            if (arg->mode == MODE_THROUGHPUT) {
+                // the acknowledgement fits into an empty send buffer //
+                memset(scratch, 1, ACK_SIZE);
+                if (send(c->fd, scratch, ACK_SIZE, MSG_NOSIGNAL)
+                        != ACK_SIZE) {
+                    return -1;
                 }
+            }
+            return 1;
+        }
+        arg->bytes += rd;
+        if (arg->mode == MODE_LATENCY) {
+            c->done += rd;
+            if (c->done == size) {
+                c->sending = 1;
+                c->done = 0;
+            }
+        }
+    }
+}
+
+/* event-loop thread of the epoll server: every thread owns a listening
+ * socket bound to the same port with SO_REUSEPORT, so the kernel spreads
+ * the incoming connections over the threads
+ */
+void *work_epoll_server(void *argv)
+{
+    thread_arg_t *arg;
+    struct epoll_event ev, events[MAX_EVENTS];
+    conn_t *c;
+    char *scratch;
+    int epfd, newfd, n, i, rc;
+
+    arg = (thread_arg_t *) argv;
+
+    if (listen(arg->sockfd, LISTEN_BACKLOG) < 0) {
+        fprintf(stderr, "Could not listen on socket!\n");
+        pthread_exit(NULL);
+    }
+
+    epfd = epoll_create1(0);
+    if (epfd < 0 || set_nonblocking(arg->sockfd) < 0) {
+        fprintf(stderr, "Could not create epoll instance!\n");
+        pthread_exit(NULL);
+    }
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.ptr = NULL;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, arg->sockfd, &ev);
 
-                if (rd < 0) {
-                    fprintf(stderr, "Could not receive package!\n");
-                    free(buffer);
-                    pthread_exit(NULL);
+    scratch = (char *) malloc(buffer_size(arg->opts) * sizeof(char));
+
+    while (!arg->shared->done) {
+        n = epoll_wait(epfd, events, MAX_EVENTS, 100);
+        for (i = 0; i < n; ++i) {
+            if (events[i].data.ptr == NULL) {
+                while ((newfd = accept4(arg->sockfd, NULL, NULL,
+                        SOCK_NONBLOCK)) >= 0) {
+                    c = (conn_t *) calloc(1, sizeof(conn_t));
+                    c->fd = newfd;
+                    c->buffer = (char *) malloc(arg->opts->size
+                            * sizeof(char));
+                    ev.events = EPOLLIN | EPOLLOUT | EPOLLET;
+                    ev.data.ptr = c;
+                    epoll_ctl(epfd, EPOLL_CTL_ADD, newfd, &ev);
                 }
-                
-                rc += rd;
+                continue;
             }
 
-            rc = 0;
-            while (rc < PACKET_SIZE) {
-                rd = send(newfd, &buffer[rc], PACKET_SIZE - rc, 0);
+            c = (conn_t *) events[i].data.ptr;
+            rc = server_progress(arg, c, scratch);
+            if (rc != 0) {
+                if (rc < 0) {
+                    fprintf(stderr, "Connection error: %s\n",
+                            strerror(errno));
+                }
+                close(c->fd);
+                free(c->buffer);
+                free(c);
+                if (__sync_add_and_fetch(&arg->shared->closed, 1)
+                        >= arg->opts->connections) {
+                    arg->shared->done = 1;
+                }
+            }
+        }
+    }
+
+    free(scratch);
+    close(epfd);
+    pthread_exit(NULL);
+}
+
+/* advances a client connection as far as it goes without blocking; the
+ * round trip time of every message is recorded when its echo completes
+ */
+int client_progress(thread_arg_t *arg, conn_t *c, char *buffer,
+        char *scratch)
+{
+    long rd, now, size, reply;
 
-                if (rd < 0) {
-                    fprintf(stderr, "Could not send package!\n");
-                    free(buffer);
-                    pthread_exit(NULL);
+    // the server echoes latency messages and acknowledges throughput runs //
+    size = arg->opts->size;
+    reply = arg->mode == MODE_LATENCY ? size : ACK_SIZE;
+    for (;;) {
+        if (c->sending) {
+            rd = send(c->fd, &buffer[c->done], size - c->done,
+                    MSG_NOSIGNAL);
+            if (rd < 0) {
+                return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+            }
+            c->done += rd;
+            if (c->done < size) {
+                continue;
+            }
+            c->done = 0;
+            if (arg->mode == MODE_LATENCY) {
+                c->sending = 0;
+            } else {
+                arg->bytes += size;
+                if (--c->remaining == 0) {
+                    shutdown(c->fd, SHUT_WR);
+                    c->sending = 0;
                 }
-                
-                rc += rd;
             }
+            continue;
         }
-    } else {
-        for (i = 0; i < arg->num_packets; ++i) {
-            memset(buffer, 0, PACKET_SIZE);
-            
-            rc = 0;
-            while (rc < PACKET_SIZE) {
-                rd = recv(newfd, &buffer[rc], PACKET_SIZE - rc, 0);
-                
-                if (rd == 0) {
-                    fprintf(stdout, "Connection closed at receive!\n");
-                    break;
-                }
 
-                if (rd < 0) {
-                    fprintf(stderr, "Could not receive package!\n");
-                    free(buffer);
-                    pthread_exit(NULL);
-                }
-                
-                rc += rd;
+        rd = recv(c->fd, scratch, reply - c->done, 0);
+        if (rd < 0) {
+            return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+        }
+        if (rd == 0) {
+            if (arg->mode == MODE_THROUGHPUT && c->done == reply) {
+                c->finished = 1;
+                return 0;
             }
+            return -1;
+        }
+        c->done += rd;
+        if (arg->mode == MODE_THROUGHPUT || c->done < reply) {
+            continue;
         }
 
-        rc = 0;
-        while (rc < PACKET_SIZE) {
-            rd = send(newfd, &buffer[rc], PACKET_SIZE - rc, 0);
-
-            if (rd < 0) {
-                fprintf(stderr, "Could not send package!\n");
-                free(buffer);
-                pthread_exit(NULL);
-            }
-            
-            rc += rd;
+        now = now_ns();
+        hist_record(&arg->hist, now - c->sent_at);
+        arg->bytes += size;
+        if (--c->remaining == 0) {
+            c->finished = 1;
+            return 0;
         }
+        c->sending = 1;
+        c->done = 0;
+        c->sent_at = now;
     }
-
-    free(buffer);
-    close(newfd);
-    pthread_exit(NULL);
 }
 
-void *work_client(void *argv)
+/* client thread of the epoll mode: opens its share of the connections and
+ * drives all of them from one event loop
+ */
+void *work_epoll_client(void *argv)
 {
     thread_arg_t *arg;
-    char *buffer;
-    int rc, rd, i;
-    struct timeval start, end;
+    struct epoll_event ev, events[MAX_EVENTS];
+    conn_t *conns;
+    char *buffer, *scratch;
+    int epfd, num_conns, active, n, i;
+    long per_conn, start, end;
 
     arg = (thread_arg_t *) argv;
+    num_conns = thread_connections(arg);
 
-    buffer = (char *) malloc(PACKET_SIZE * sizeof(char));
-
-    init_dataset(buffer, PACKET_SIZE);
-    
-    gettimeofday(&start, NULL);
-    if ((rc = connect(arg->sockfd, arg->srv, arg->addrlen)) < 0) {
-        fprintf(stderr, "Could not connect to server!\n");
-        pthread_exit(NULL);
-    }
+    buffer = (char *) malloc(buffer_size(arg->opts) * sizeof(char));
+    scratch = (char *) malloc(buffer_size(arg->opts) * sizeof(char));
+    conns = (conn_t *) calloc(num_conns, sizeof(conn_t));
+    init_dataset(buffer, arg->opts->size);
 
     if (arg->mode == MODE_LATENCY) {
-        for (i = 0; i < arg->num_messages; ++i) {
-            
-            rc = 0;
-            while (rc < PACKET_SIZE) {
-                rd = send(arg->sockfd, &buffer[rc], PACKET_SIZE - rc, 0);
-
-                if (rd < 0) {
-                    fprintf(stderr, "Could not send package!\n");
-                    free(buffer);
-                    pthread_exit(NULL);
-                }
-                
-                rc += rd;
-            }
-
-            rc = 0;
-            while (rc < PACKET_SIZE) {
-                rd = recv(arg->sockfd, &buffer[rc], PACKET_SIZE - rc, 0);
-                
-                if (rd == 0) {
-                    fprintf(stdout, "Connection closed at receive!\n");
-                    break;
-                }
-
-                if (rd < 0) {
-                    fprintf(stderr, "Could not receive package!\n");
-                    free(buffer);
-                    pthread_exit(NULL);
-                }
-                
-                rc += rd;
-            }
-        }
+        per_conn = scale_count(NUM_MESSAGES, arg->opts->size)
+                / arg->opts->connections;
     } else {
-        for (i = 0; i < arg->num_packets; ++i) {
-            
-            rc = 0;
-            while (rc < PACKET_SIZE) {
-                rd = send(arg->sockfd, &buffer[rc], PACKET_SIZE - rc, 0);
-                
-                if (rd == 0) {
-                    fprintf(stdout, "Connection closed at receive!\n");
-                    break;
-                }
+        per_conn = scale_count(NUM_PACKETS, arg->opts->size)
+                / arg->opts->connections;
+    }
+    if (per_conn < 1) {
+        per_conn = 1;
+    }
 
-                if (rd < 0) {
-                    fprintf(stderr, "Could not receive package!\n");
-                    free(buffer);
-                    pthread_exit(NULL);
-                }
-                
-                rc += rd;
-            }
+    epfd = epoll_create1(0);
+    start = now_ns();
+    for (i = 0; i < num_conns; ++i) {
+        conns[i].fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (conns[i].fd < 0
+                || connect(conns[i].fd, arg->srv, arg->addrlen) < 0
+                || set_nonblocking(conns[i].fd) < 0) {
+            fprintf(stderr, "Could not connect to server!\n");
+            pthread_exit(NULL);
         }
+    }
+    end = now_ns();
+    arg->connect_time = (end - start) / 1000;
 
-        rc = 0;
-        while (rc < PACKET_SIZE) {
-            rd = recv(arg->sockfd, &buffer[rc], PACKET_SIZE - rc, 0);            
+    start = now_ns();
+    for (i = 0; i < num_conns; ++i) {
+        conns[i].sending = 1;
+        conns[i].remaining = per_conn;
+        conns[i].sent_at = start;
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLET;
+        ev.data.ptr = &conns[i];
+        epoll_ctl(epfd, EPOLL_CTL_ADD, conns[i].fd, &ev);
+    }
 
-            if (rd == 0) {
-                fprintf(stdout, "Connection closed at receive!\n");
-                break;
+    active = num_conns;
+    while (active > 0) {
+        n = epoll_wait(epfd, events, MAX_EVENTS, -1);
+        for (i = 0; i < n; ++i) {
+            conn_t *c = (conn_t *) events[i].data.ptr;
+
+            if (c->finished) {
+                continue;
             }
-            
-            if (rd < 0) {
-                fprintf(stderr, "Could not receive package!\n");
-                free(buffer);
-                pthread_exit(NULL);
+            if (client_progress(arg, c, buffer, scratch) < 0) {
+                fprintf(stderr, "Connection error: %s\n", strerror(errno));
+                c->finished = 1;
+            }
+            if (c->finished) {
+                epoll_ctl(epfd, EPOLL_CTL_DEL, c->fd, NULL);
+                close(c->fd);
+                active--;
             }
-            
-            rc += rd;
         }
     }
-    gettimeofday(&end, NULL);
+    end = now_ns();
 
-    arg->runtime = ((long) end.tv_sec - (long) start.tv_sec) 
-            * 1000000 + (end.tv_usec - start.tv_usec);
+    arg->runtime = (end - start) / 1000;
 
+    close(epfd);
+    free(conns);
     free(buffer);
+    free(scratch);
     pthread_exit(NULL);
 }
 
-int main(int argc, char **argv)
+/* runs the epoll mode: a single port served by num_threads event loops,
+ * and a client spreading --connections connections over num_threads
+ * threads
+ */
+int run_epoll(int num_threads, int mode, int type, char *ipaddr,
+        int start_port, options_t *opts)
 {
-    int num_threads, mode, type, start_port;
     struct addrinfo hints, *res;
-    char ipaddr[INET_ADDRSTRLEN], port[10];
+    struct rlimit rl;
+    epoll_shared_t shared;
     pthread_t *threads;
     thread_arg_t *args;
-    int i, j, rc;
-    double throughput;
-    long max_runtime, latency;
+    histogram_t *hist;
+    char port[10];
+    long max_runtime, max_connect, bytes;
+    int i, rc, one;
 
-    // parsing arguments //
-    if (argc <= 5 || argc >= 7) {
-        fprintf(stderr, "Program usage: ./benchmark-tcp.exe "
-                "<num_threads> <mode> <type> <ip_addr> <start_port>\n"
-                "where <mode> accepts the following values:\n"
-                "\t 0 - Latency experiment\n"
-                "\t 1 - Througput experiment\n"
-                "where <type> accepts the following values:\n"
-                "\t 0 - Client\n"
-                "\t 1 - Server\n");
-        exit(-1);
-    } else {
-        num_threads = atoi(argv[1]);
-        switch (atoi(argv[2])) {
-            case MODE_LATENCY:
-                mode = MODE_LATENCY;
-                break;
-            case MODE_THROUGHPUT:
-                mode = MODE_THROUGHPUT;
-                break;
-            default:
-                fprintf(stderr, "Unrecognized mode!\n");
-                exit(-1);
+    // every connection needs a descriptor on both sides //
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    sprintf(port, "%d", start_port);
+    if ((rc = getaddrinfo(ipaddr, port, &hints, &res)) != 0) {
+        fprintf(stderr, "Could not get addrinfo!\n");
+        exit(-2);
+    }
+
+    shared.closed = 0;
+    shared.done = 0;
+    threads = (pthread_t *) malloc(num_threads * sizeof(pthread_t));
+    args = (thread_arg_t *) calloc(num_threads, sizeof(thread_arg_t));
+
+    for (i = 0; i < num_threads; ++i) {
+        args[i].srv = res->ai_addr;
+        args[i].addrlen = res->ai_addrlen;
+        args[i].mode = mode;
+        args[i].tid = i;
+        args[i].num_threads = num_threads;
+        args[i].opts = opts;
+        args[i].shared = &shared;
+        args[i].sockfd = -1;
+
+        if (type == TYPE_SERVER) {
+            one = 1;
+            args[i].sockfd = socket(res->ai_family, res->ai_socktype,
+                    res->ai_protocol);
+            if (args[i].sockfd < 0
+                    || setsockopt(args[i].sockfd, SOL_SOCKET, SO_REUSEADDR,
+                    &one, sizeof(one)) < 0
+                    || setsockopt(args[i].sockfd, SOL_SOCKET, SO_REUSEPORT,
+                    &one, sizeof(one)) < 0
+                    || bind(args[i].sockfd, res->ai_addr,
+                    res->ai_addrlen) < 0) {
+                fprintf(stderr, "Could not bind socket!\n");
+                exit(-2);
+            }
+            rc = pthread_create(&threads[i], NULL, work_epoll_server,
+                    (void *) &args[i]);
+        } else {
+            rc = pthread_create(&threads[i], NULL, work_epoll_client,
+                    (void *) &args[i]);
         }
-        switch (atoi(argv[3])) {
-            case TYPE_CLIENT:
-                type = TYPE_CLIENT;
-                break;
-            case TYPE_SERVER:
-                type = TYPE_SERVER;
-                break;
-            default:
-                fprintf(stderr, "Unrecognized type!\n");
-                exit(-1);
+
+        if (rc) {
+            fprintf(stderr, "Could not create thread!\n");
+            exit(-3);
         }
-        strcpy(ipaddr, argv[4]);
-        start_port = atoi(argv[5]);
     }
 
-    srand(time(NULL));
-    args = (thread_arg_t *) malloc(num_threads * sizeof(thread_arg_t));
+    hist = (histogram_t *) calloc(1, sizeof(histogram_t));
+    max_runtime = 0;
+    max_connect = 0;
+    bytes = 0;
+    for (i = 0; i < num_threads; ++i) {
+        rc = pthread_join(threads[i], NULL);
+        if (rc) {
+            fprintf(stderr, "Could not join thread!\n");
+        }
+        if (args[i].sockfd >= 0) {
+            close(args[i].sockfd);
+        }
+        if (max_runtime < args[i].runtime) {
+            max_runtime = args[i].runtime;
+        }
+        if (max_connect < args[i].connect_time) {
+            max_connect = args[i].connect_time;
+        }
+        bytes += args[i].bytes;
+        hist_merge(hist, &args[i].hist);
+    }
+
+    if (type == TYPE_CLIENT) {
+        if (max_runtime <= 0) {
+            max_runtime = 1;
+        }
+        printf("Connections: %d over %d threads, established in %ld ms\n",
+                opts->connections, num_threads, max_connect / 1000);
+        printf("Elapsed time: %ld ms\n", max_runtime / 1000);
+        if (mode == MODE_LATENCY) {
+            printf("Messages: %.0lf/s\n",
+                    (double) hist->total * 1e6 / max_runtime);
+            hist_print("Ping-pong message", hist);
+        } else {
+            printf("Throughput: %lf Mbps\n", 8.0 * bytes / max_runtime);
+        }
+    }
+
+    freeaddrinfo(res);
+    free(hist);
+    free(threads);
+    free(args);
+
+    return 0;
+}
+
+/* creates the socket of every thread, bound to its port on the server side,
+ * and fills in the thread arguments
+ */
+thread_arg_t *init_args(int num_threads, int mode, int type, char *ipaddr,
+        int start_port, options_t *opts, pthread_barrier_t *barrier,
+        int *num_points)
+{
+    struct addrinfo hints, *res;
+    thread_arg_t *args;
+    char port[10];
+    int i, j, rc, one;
+
+    args = (thread_arg_t *) calloc(num_threads, sizeof(thread_arg_t));
 
-    // creating and binding (where necessary) the sockets for each thread //
     memset(&hints, 0, sizeof(hints));
     hints.ai_family = AF_INET;
     hints.ai_socktype = SOCK_STREAM;
-    
+
     for (i = 0; i < num_threads; ++i) {
-        sprintf(port, "%d", start_port + i);
-        
+        // the connection rate experiment uses a single port //
+        sprintf(port, "%d", mode == MODE_CONNRATE ? start_port
+                : start_port + i);
+
         if ((rc = getaddrinfo(ipaddr, port, &hints, &res)) != 0) {
             fprintf(stderr, "Could not get addrinfo!\n");
-            for (j = 0; j <= i; ++j) {
+            for (j = 0; j < i; ++j) {
                 close(args[j].sockfd);
                 free(args[j].srv);
             }
             free(args);
             exit(-2);
-        }    
+        }
 
-        args[i].sockfd = socket(res->ai_family, res->ai_socktype, 
-                res->ai_protocol);
+        // without SO_REUSEPORT its server threads share one socket //
+        if (mode == MODE_CONNRATE && type == TYPE_SERVER
+                && !opts->reuseport && i > 0) {
+            args[i].sockfd = dup(args[0].sockfd);
+        } else {
+            args[i].sockfd = socket(res->ai_family, res->ai_socktype,
+                    res->ai_protocol);
+        }
 
         if (args[i].sockfd < 0) {
             fprintf(stderr, "Could not create socket!\n");
-            for (j = 0; j <= i; ++j) {
+            for (j = 0; j < i; ++j) {
                 close(args[j].sockfd);
                 free(args[j].srv);
             }
@@ -327,12 +1795,20 @@ int main(int argc, char **argv)
             exit(-2);
         }
 
-        if (type == TYPE_SERVER) {
-            if (bind(args[i].sockfd, res->ai_addr, res->ai_addrlen) < 0) {
+        // connections of an earlier run may still linger in TIME_WAIT //
+        if (type == TYPE_SERVER && (mode != MODE_CONNRATE
+                || opts->reuseport || i == 0)) {
+            one = 1;
+            if (setsockopt(args[i].sockfd, SOL_SOCKET, SO_REUSEADDR, &one,
+                    sizeof(one)) < 0 || (opts->reuseport
+                    && setsockopt(args[i].sockfd, SOL_SOCKET, SO_REUSEPORT,
+                    &one, sizeof(one)) < 0)
+                    || bind(args[i].sockfd, res->ai_addr,
+                    res->ai_addrlen) < 0) {
                 fprintf(stderr, "Could not bind socket!\n");
                 for (j = 0; j <= i; ++j) {
                     close(args[j].sockfd);
-                free(args[j].srv);
+                    free(args[j].srv);
                 }
                 free(args);
                 exit(-2);
@@ -345,24 +1821,46 @@ int main(int argc, char **argv)
         args[i].mode = mode;
         args[i].num_messages = NUM_MESSAGES / num_threads;
         args[i].num_packets = NUM_PACKETS / num_threads;
+        args[i].tid = i;
+        args[i].num_threads = num_threads;
+        args[i].opts = opts;
+        args[i].barrier = barrier;
+        args[i].points = init_points(opts, mode, num_points);
+        args[i].num_points = *num_points;
+        if (opts->rate > 0) {
+            // both sides derive the message count from the schedule //
+            args[i].num_messages = (int) (opts->rate * opts->runtime
+                    / num_threads);
+        }
         freeaddrinfo(res);
     }
 
-    // creating and running the threads //
+    return args;
+}
+
+pthread_t *start_threads(thread_arg_t *args, int num_threads, int type)
+{
+    pthread_t *threads;
+    int i, j, rc;
+
     threads = (pthread_t *) malloc(num_threads * sizeof(pthread_t));
 
     for (i = 0; i < num_threads; ++i) {
-        if (type == TYPE_SERVER) {
-            rc = pthread_create(&threads[i], NULL, work_server, 
+        if (args[i].mode == MODE_CONNRATE) {
+            rc = pthread_create(&threads[i], NULL, type == TYPE_SERVER
+                    ? work_connrate_server : work_connrate_client,
+                    (void *) &args[i]);
+        } else if (type == TYPE_SERVER) {
+            rc = pthread_create(&threads[i], NULL, work_server,
                     (void *) &args[i]);
         } else {
-            rc = pthread_create(&threads[i], NULL, work_client, 
+            rc = pthread_create(&threads[i], NULL, work_client,
                     (void *) &args[i]);
         }
 
         if (rc) {
             fprintf(stderr, "Could not create thread!\n");
-            for (j = 0; j <= i; ++j) {
+            for (j = 0; j < num_threads; ++j) {
                 close(args[j].sockfd);
                 free(args[j].srv);
             }
@@ -370,10 +1868,15 @@ int main(int argc, char **argv)
             free(threads);
             exit(-3);
         }
-
     }
 
-    // joining the threads //
+    return threads;
+}
+
+void join_threads(thread_arg_t *args, pthread_t *threads, int num_threads)
+{
+    int i, rc;
+
     for (i = 0; i < num_threads; ++i) {
         rc = pthread_join(threads[i], NULL);
         if (rc) {
@@ -382,27 +1885,390 @@ int main(int argc, char **argv)
         close(args[i].sockfd);
         free(args[i].srv);
     }
+}
 
-    if (type == TYPE_CLIENT) {
-        max_runtime = args[0].runtime;
-        for (i = 1; i < num_threads; ++i) {
-            if (max_runtime < args[i].runtime) {
-                max_runtime = args[i].runtime;
+/* prints the connection rate of all the client threads together with the
+ * handshake and request latency percentiles
+ */
+void print_connrate(thread_arg_t *args, int num_threads)
+{
+    histogram_t *handshake, *request;
+    long max_runtime, connections;
+    int i;
+
+    handshake = (histogram_t *) calloc(1, sizeof(histogram_t));
+    request = (histogram_t *) calloc(1, sizeof(histogram_t));
+    max_runtime = 0;
+    connections = 0;
+    for (i = 0; i < num_threads; ++i) {
+        if (max_runtime < args[i].runtime) {
+            max_runtime = args[i].runtime;
+        }
+        connections += args[i].connections;
+        hist_merge(handshake, &args[i].hist);
+        hist_merge(request, &args[i].request_hist);
+    }
+    if (max_runtime <= 0) {
+        max_runtime = 1;
+    }
+
+    printf("Elapsed time: %ld ms\n", max_runtime / 1000);
+    printf("Connection rate: %.0lf connections/s, %ld connections\n",
+            connections * 1e6 / max_runtime, connections);
+    hist_print("Handshake", handshake);
+    hist_print("Request", request);
+
+    free(handshake);
+    free(request);
+}
+
+int main(int argc, char **argv)
+{
+    int num_threads, mode, type, start_port;
+    char ipaddr[INET_ADDRSTRLEN];
+    pthread_t *threads, *srv_threads;
+    thread_arg_t *args, *srv_args;
+    pthread_barrier_t barrier, ready;
+    int i, p, num_points, saturation, best, tuned;
+    double throughput, *results, *latencies, peak, recv_user, recv_sys,
+           cores;
+    long max_runtime, bytes, send_cpu, zc_sends, zc_copied;
+    options_t opts;
+    histogram_t *hist;
+    topology_t topo;
+
+    // parsing arguments //
+    if (argc <= 5) {
+        fprintf(stderr, "Program usage: ./benchmark-tcp.exe "
+                "<num_threads> <mode> <type> <ip_addr> <start_port> "
+                "[options]\n"
+                "where <num_threads> 0 runs one thread per hardware thread "
+                "of the host\n"
+                "where <mode> accepts the following values:\n"
+                "\t 0 - Latency experiment\n"
+                "\t 1 - Througput experiment\n"
+                "\t 2 - Connection rate experiment\n"
+                "where <type> accepts the following values:\n"
+                "\t 0 - Client\n"
+                "\t 1 - Server\n"
+                "where [options] accepts the following values, which must "
+                "be the same on both sides:\n"
+                "\t --server=<model>     threads (one port and connection "
+                "per thread) or\n"
+                "\t                      epoll (one port, one event loop "
+                "per thread)\n"
+                "\t --connections=<n>    connections of the epoll mode "
+                "(default <num_threads>)\n"
+                "\t --rate=<msgs/s>      open-loop latency experiment at a "
+                "fixed total rate\n"
+                "\t --runtime=<sec>      duration of the open-loop "
+                "experiment (default 10)\n"
+                "\t --size=<bytes>       message size, k and m suffixes "
+                "accepted (default 1024)\n"
+                "\t --sweep              measure every power of two from "
+                "64 B to 1 MB\n"
+                "\t --time=<sec>         time budget of every message size "
+                "(default 1 with --sweep)\n"
+                "\t --send=<path>        send path of the throughput "
+                "experiment: copy (default),\n"
+                "\t                      zerocopy, sendfile or splice\n"
+                "\t --file=<path>        source of sendfile and splice "
+                "(default an in-memory file)\n"
+                "\t --nodelay            disable Nagle's algorithm "
+                "(TCP_NODELAY)\n"
+                "\t --quickack           acknowledge every message at once "
+                "(TCP_QUICKACK)\n"
+                "\t --sndbuf=<bytes>     socket send buffer size "
+                "(SO_SNDBUF)\n"
+                "\t --rcvbuf=<bytes>     socket receive buffer size "
+                "(SO_RCVBUF)\n"
+                "\t --busy-poll=<usec>   busy poll the device on receive "
+                "(SO_BUSY_POLL)\n"
+                "\t --cork=<n>           cork the throughput stream in "
+                "batches of n messages\n"
+                "\t --tune               measure a matrix of the socket "
+                "options above\n"
+                "\t --loopback           run the server threads in this "
+                "process, <type> is ignored\n"
+                "\t --reuseport          one listening socket per server "
+                "thread in the connection\n"
+                "\t                      rate experiment (SO_REUSEPORT)\n");
+        exit(-1);
+    } else {
+        // describing the host, with its network interfaces //
+        topology_read(&topo, NULL);
+        topology_print(&topo);
+        num_threads = atoi(argv[1]);
+        if (num_threads <= 0) {
+            num_threads = topo.threads;
+        }
+        switch (atoi(argv[2])) {
+            case MODE_LATENCY:
+                mode = MODE_LATENCY;
+                break;
+            case MODE_THROUGHPUT:
+                mode = MODE_THROUGHPUT;
+                break;
+            case MODE_CONNRATE:
+                mode = MODE_CONNRATE;
+                break;
+            default:
+                fprintf(stderr, "Unrecognized mode!\n");
+                exit(-1);
+        }
+        switch (atoi(argv[3])) {
+            case TYPE_CLIENT:
+                type = TYPE_CLIENT;
+                break;
+            case TYPE_SERVER:
+                type = TYPE_SERVER;
+                break;
+            default:
+                fprintf(stderr, "Unrecognized type!\n");
+                exit(-1);
+        }
+        strcpy(ipaddr, argv[4]);
+        start_port = atoi(argv[5]);
+
+        opts.server = SERVER_THREADS;
+        opts.connections = num_threads;
+        opts.rate = 0;
+        opts.runtime = DEFAULT_RUNTIME;
+        opts.size = PACKET_SIZE;
+        opts.sweep = 0;
+        opts.time = 0;
+        opts.send = SEND_COPY;
+        opts.file = NULL;
+        opts.tune = 0;
+        opts.loopback = 0;
+        opts.reuseport = 0;
+        memset(&opts.tuning, 0, sizeof(tuning_t));
+        for (i = 6; i < argc; ++i) {
+            if (parse_option(&opts, argv[i]) < 0) {
+                fprintf(stderr, "Unrecognized option %s!\n", argv[i]);
+                exit(-1);
             }
         }
-        
-        printf("Elapsed time: %ld ms\n", max_runtime / 1000);
-        if (mode == MODE_LATENCY) {
-            latency = NUM_MESSAGES;
-            latency = (max_runtime / latency) * num_threads;
-            printf("Ping-pong message latency: %ld us\n", latency);
-        } else {
-            throughput = (8.0 * PACKET_SIZE * NUM_PACKETS) 
-                    / (double) max_runtime;
-            printf("Throughput: %lf Mbps\n", throughput);
+        if (opts.sweep && opts.server == SERVER_EPOLL) {
+            fprintf(stderr, "The sweep is not supported by the epoll "
+                    "mode!\n");
+            exit(-1);
+        }
+        tuned = opts.tune || opts.tuning.nodelay || opts.tuning.quickack
+                || opts.tuning.sndbuf > 0 || opts.tuning.rcvbuf > 0
+                || opts.tuning.busy_poll > 0 || opts.tuning.cork > 0;
+        if (mode == MODE_CONNRATE && (opts.server != SERVER_THREADS
+                || opts.sweep || tuned || opts.rate > 0
+                || opts.send != SEND_COPY)) {
+            fprintf(stderr, "The connection rate experiment only supports "
+                    "the threaded mode and the --size, --time, --loopback "
+                    "and --reuseport options!\n");
+            exit(-1);
+        }
+        if (opts.reuseport && mode != MODE_CONNRATE) {
+            fprintf(stderr, "SO_REUSEPORT is only selectable in the "
+                    "connection rate experiment!\n");
+            exit(-1);
+        }
+        if (opts.loopback && opts.server != SERVER_THREADS) {
+            fprintf(stderr, "The loopback mode is not supported by the "
+                    "epoll mode!\n");
+            exit(-1);
+        }
+        if (opts.tune && (opts.sweep || opts.rate > 0)) {
+            fprintf(stderr, "The tuning sweep cannot be combined with the "
+                    "size sweep or the open-loop experiment!\n");
+            exit(-1);
+        }
+        if (tuned && opts.server != SERVER_THREADS) {
+            fprintf(stderr, "The socket options are only supported by the "
+                    "threaded mode!\n");
+            exit(-1);
+        }
+        if (opts.tuning.cork > 0 && mode != MODE_THROUGHPUT) {
+            fprintf(stderr, "Corking is only supported by the throughput "
+                    "experiment!\n");
+            exit(-1);
+        }
+        if ((opts.sweep || opts.tune) && opts.time == 0) {
+            opts.time = SWEEP_TIME;
+        }
+        if (opts.send != SEND_COPY && (mode != MODE_THROUGHPUT
+                || opts.server != SERVER_THREADS)) {
+            fprintf(stderr, "The send paths are only supported by the "
+                    "threaded throughput experiment!\n");
+            exit(-1);
+        }
+    }
+
+    srand(time(NULL));
+
+    if (opts.server == SERVER_EPOLL) {
+        return run_epoll(num_threads, mode, type, ipaddr, start_port, &opts);
+    }
+
+    pthread_barrier_init(&barrier, NULL, num_threads);
+
+    srv_args = NULL;
+    srv_threads = NULL;
+
+    // in loopback mode the server threads run in this process as well //
+    if (opts.loopback) {
+        pthread_barrier_init(&ready, NULL, num_threads + 1);
+        srv_args = init_args(num_threads, mode, TYPE_SERVER, ipaddr,
+                start_port, &opts, NULL, &num_points);
+        for (i = 0; i < num_threads; ++i) {
+            srv_args[i].ready = &ready;
         }
+        srv_threads = start_threads(srv_args, num_threads, TYPE_SERVER);
+
+        // the clients start once every server thread listens //
+        pthread_barrier_wait(&ready);
+        type = TYPE_CLIENT;
+    }
+
+    args = init_args(num_threads, mode, type, ipaddr, start_port, &opts,
+            &barrier, &num_points);
+    threads = start_threads(args, num_threads, type);
+    join_threads(args, threads, num_threads);
+
+    if (opts.loopback) {
+        join_threads(srv_args, srv_threads, num_threads);
+        for (i = 0; i < num_threads; ++i) {
+            free(srv_args[i].points);
+        }
+        pthread_barrier_destroy(&ready);
+        free(srv_threads);
+        free(srv_args);
+    }
+
+    if (type == TYPE_CLIENT && mode == MODE_CONNRATE) {
+        print_connrate(args, num_threads);
+    } else if (type == TYPE_CLIENT) {
+        hist = (histogram_t *) calloc(1, sizeof(histogram_t));
+        results = (double *) calloc(num_points, sizeof(double));
+        latencies = (double *) calloc(num_points, sizeof(double));
+        for (p = 0; p < num_points; ++p) {
+            memset(hist, 0, sizeof(histogram_t));
+            max_runtime = 0;
+            bytes = 0;
+            send_cpu = 0;
+            recv_user = 0;
+            recv_sys = 0;
+            zc_sends = 0;
+            zc_copied = 0;
+            for (i = 0; i < num_threads; ++i) {
+                if (max_runtime < args[i].points[p].runtime) {
+                    max_runtime = args[i].points[p].runtime;
+                }
+                bytes += args[i].points[p].bytes;
+                send_cpu += args[i].points[p].send_cpu;
+                recv_user += args[i].points[p].recv_user;
+                recv_sys += args[i].points[p].recv_sys;
+                zc_sends += args[i].points[p].zc_sends;
+                zc_copied += args[i].points[p].zc_copied;
+                hist_merge(hist, &args[i].points[p].hist);
+            }
+            if (max_runtime <= 0) {
+                max_runtime = 1;
+            }
+            throughput = 8.0 * bytes / (double) max_runtime;
+            results[p] = throughput;
+
+            latencies[p] = hist->total > 0
+                    ? (double) hist->sum / hist->total / 1000.0 : 0.0;
+
+            if (opts.sweep) {
+                printf("Message size: %ld B\n", args[0].points[p].size);
+            }
+            if (opts.tune) {
+                printf("Socket options:");
+                print_tuning(&args[0].points[p].tuning);
+            }
+            printf("Elapsed time: %ld ms\n", max_runtime / 1000);
+            if (mode == MODE_LATENCY) {
+                printf("Ping-pong message latency: %.2lf us\n",
+                        latencies[p]);
+                if (opts.rate > 0) {
+                    printf("Open-loop rate: %.0lf msgs/s target, %.0lf "
+                            "msgs/s achieved\n", opts.rate,
+                            hist->total * 1e6 / max_runtime);
+                }
+                hist_print("Message", hist);
+                if (opts.sweep) {
+                    printf("Throughput: %lf Mbps\n", throughput);
+                }
+            } else {
+                // utilization in percent of one core, as reported by top //
+                cores = (recv_user + recv_sys) / max_runtime;
+                printf("Throughput: %lf Mbps\n", throughput);
+                printf("Receive CPU: %.1lf%% (user %.1lf%%, sys %.1lf%%), "
+                        "%.2lf Gbps per core\n", cores * 100,
+                        recv_user * 100 / max_runtime,
+                        recv_sys * 100 / max_runtime,
+                        cores > 0 ? throughput / 1000 / cores : 0.0);
+                printf("Send CPU: %.1lf%%, %.2lf Gbps per core\n",
+                        100.0 * send_cpu / max_runtime, send_cpu > 0
+                        ? throughput / 1000 * max_runtime / send_cpu : 0.0);
+                if (opts.send == SEND_ZEROCOPY) {
+                    printf("Zero-copy sends: %ld, %ld (%.1lf%%) copied by "
+                            "the kernel\n", zc_sends, zc_copied,
+                            zc_sends > 0 ? 100.0 * zc_copied / zc_sends
+                            : 0.0);
+                }
+            }
+        }
+
+        // the saturation point is the smallest size close to the peak //
+        if (opts.sweep) {
+            peak = 0;
+            for (p = 0; p < num_points; ++p) {
+                if (peak < results[p]) {
+                    peak = results[p];
+                }
+            }
+            saturation = 0;
+            while (results[saturation] < SATURATION * peak) {
+                saturation++;
+            }
+            printf("Saturation: %ld B reaches %.0lf%% of the peak "
+                    "throughput of %lf Mbps\n",
+                    args[0].points[saturation].size, SATURATION * 100,
+                    peak);
+        }
+
+        // the best configuration has the lowest latency or highest rate //
+        if (opts.tune) {
+            best = -1;
+            for (p = 0; p < num_points; ++p) {
+                if (mode == MODE_LATENCY && latencies[p] > 0 && (best < 0
+                        || latencies[p] < latencies[best])) {
+                    best = p;
+                } else if (mode == MODE_THROUGHPUT && (best < 0
+                        || results[p] > results[best])) {
+                    best = p;
+                }
+            }
+            if (best >= 0) {
+                if (mode == MODE_LATENCY) {
+                    printf("Best configuration: %.2lf us with",
+                            latencies[best]);
+                } else {
+                    printf("Best configuration: %lf Mbps with",
+                            results[best]);
+                }
+                print_tuning(&args[0].points[best].tuning);
+            }
+        }
+        free(latencies);
+        free(results);
+        free(hist);
     }
 
+    for (i = 0; i < num_threads; ++i) {
+        free(args[i].points);
+    }
+    pthread_barrier_destroy(&barrier);
     free(threads);
     free(args);
 
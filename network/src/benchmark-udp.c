@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -10,6 +11,13 @@
 #include <netdb.h>
 #include <unistd.h>
 #include <errno.h>
+#include <time.h>
+#include <netinet/udp.h>
+#include <sys/resource.h>
+#include <poll.h>
+
+#include "topology.h"
+#include "util.h"
 
 #define MODE_LATENCY 0
 #define MODE_THROUGHPUT 1
@@ -21,7 +29,121 @@
 #define NUM_MESSAGES 64 * 8 * 1024
 #define NUM_PACKETS 64 * 128 * 1024
 
-#define NUM_TERMINATE_MSGS 2048
+#define CTRL_START 0
+#define CTRL_READY 1
+#define CTRL_STOP 2
+#define CTRL_RESULT 3
+#define CTRL_DONE 4
+
+/* the server reports a run once no datagram arrived for this long after the
+ * client stopped it, and the latency client gives up on an echo after
+ * ECHO_TIMEOUT_MS
+ */
+#define DRAIN_TIMEOUT_MS 50
+#define ECHO_TIMEOUT_MS 100
+#define CONNECT_RETRIES 50
+
+/* largest UDP payload over IPv4; the sweep stops at the largest power of two
+ * below it
+ */
+#define MAX_DATAGRAM 65507
+
+/* a GRO receive buffer holds up to 64 KB of coalesced datagrams */
+#define RECV_BUFFER 65536
+#define CONTROL_SIZE 64
+#define MAX_BATCH 1024
+#define GSO_SEGMENTS 64
+
+#define SWEEP_MIN 64
+#define SWEEP_MAX (32 * 1024)
+#define SWEEP_TIME 1.0
+#define SATURATION 0.95
+
+/* runtime options, identical on the client and the server side */
+typedef struct options_t
+{
+    long size;
+    int sweep;
+    double time;
+    int batch;
+    int gso;
+    int gro;
+    int loopback;
+} options_t;
+
+/* header at the start of every datagram; the run tells the measured runs
+ * apart from the calibration and from stragglers of earlier runs
+ */
+typedef struct header_t
+{
+    int run;
+    long seq;
+    long sent_at;
+} header_t;
+
+/* message of the control channel, a TCP connection to the same port; both
+ * sides are expected to share the architecture, and the counters are only
+ * filled in by RESULT
+ */
+typedef struct control_t
+{
+    int type;
+    int run;
+    long sent;
+    long received;
+    long reordered;
+    long bytes;
+    long jitter;
+    long runtime;
+    long cpu;
+    long syscalls;
+} control_t;
+
+/* receive side counters of the current run */
+typedef struct stats_t
+{
+    int run;
+    long received;
+    long reordered;
+    long bytes;
+    long next;
+    long transit;
+    double jitter;
+    long first;
+    long last;
+    long syscalls;
+    struct rusage usage;
+} stats_t;
+
+/* message headers of a sendmmsg or recvmmsg batch */
+typedef struct batch_t
+{
+    int n;
+    struct mmsghdr *msgs;
+    struct iovec *iovs;
+    struct sockaddr_storage *addrs;
+    char *buffers;
+    char *control;
+} batch_t;
+
+/* results of one message size */
+typedef struct point_t
+{
+    long size;
+    long runtime;
+    long bytes;
+    long count;
+    long send_cpu;
+    long syscalls;
+    long timeouts;
+    long received;
+    long reordered;
+    long recv_bytes;
+    long jitter;
+    long recv_cpu;
+    long recv_syscalls;
+    long recv_runtime;
+} point_t;
 
 typedef struct thread_arg_t
 {
@@ -32,8 +154,90 @@ typedef struct thread_arg_t
     int num_messages;
     int num_packets;
     long runtime;
+    options_t *opts;
+    pthread_barrier_t *barrier;
+    pthread_barrier_t *ready;
+    point_t *points;
+    int num_points;
+    int ctrlfd;
+    int run;
+    batch_t *batch;
+    long gso_segments;
+    long syscalls;
+    long timeouts;
 } thread_arg_t;
 
+int parse_option(options_t *opts, const char *opt)
+{
+    char *end;
+
+    if (strncmp(opt, "--size=", 7) == 0) {
+        opts->size = parse_size(opt + 7, &end);
+        return (*end != '\0' || opts->size <= 0
+                || opts->size > MAX_DATAGRAM) ? -1 : 0;
+    } else if (strncmp(opt, "--batch=", 8) == 0) {
+        opts->batch = atoi(opt + 8);
+        return (opts->batch <= 0 || opts->batch > MAX_BATCH) ? -1 : 0;
+    } else if (strcmp(opt, "--gso") == 0) {
+        opts->gso = 1;
+        return 0;
+    } else if (strcmp(opt, "--gro") == 0) {
+        opts->gro = 1;
+        return 0;
+    } else if (strcmp(opt, "--sweep") == 0) {
+        opts->sweep = 1;
+        return 0;
+    } else if (strncmp(opt, "--time=", 7) == 0) {
+        opts->time = atof(opt + 7);
+        return opts->time <= 0 ? -1 : 0;
+    } else if (strcmp(opt, "--loopback") == 0) {
+        opts->loopback = 1;
+        return 0;
+    }
+    return -1;
+}
+
+/* builds the list of message sizes of a run: the sweep doubles the size from
+ * SWEEP_MIN to SWEEP_MAX, otherwise only --size is measured
+ */
+point_t *init_points(options_t *opts, int *num_points)
+{
+    point_t *points;
+    long size;
+    int n;
+
+    if (!opts->sweep) {
+        points = (point_t *) calloc(1, sizeof(point_t));
+        points[0].size = opts->size;
+        *num_points = 1;
+        return points;
+    }
+
+    n = 0;
+    for (size = SWEEP_MIN; size <= SWEEP_MAX; size *= 2) {
+        n++;
+    }
+    points = (point_t *) calloc(n, sizeof(point_t));
+    n = 0;
+    for (size = SWEEP_MIN; size <= SWEEP_MAX; size *= 2) {
+        points[n++].size = size;
+    }
+    *num_points = n;
+    return points;
+}
+
+/* without a time budget the fixed message counts are kept for small
+ * messages and scaled down for large ones, so that a run moves at most as
+ * many bytes as it would with PACKET_SIZE messages
+ */
+long scale_count(long count, long size)
+{
+    if (size > PACKET_SIZE) {
+        count = count * PACKET_SIZE / size;
+    }
+    return count > 0 ? count : 1;
+}
+
 void init_dataset(char *dataset, int n)
 {
     int i;
@@ -43,289 +247,642 @@ void init_dataset(char *dataset, int n)
     }
 }
 
-void *work_server(void *argv)
+/* cpu time in microseconds between two rusage samples */
+long cpu_time(struct rusage *start, struct rusage *end)
+{
+    return ((long) end->ru_utime.tv_sec - (long) start->ru_utime.tv_sec
+            + (long) end->ru_stime.tv_sec - (long) start->ru_stime.tv_sec)
+            * 1000000 + (end->ru_utime.tv_usec - start->ru_utime.tv_usec)
+            + (end->ru_stime.tv_usec - start->ru_stime.tv_usec);
+}
+
+/* allocates the message headers of a batch, each with a buffer of its own
+ * holding the dataset and room for the control message that carries the
+ * GRO segment size
+ */
+batch_t *alloc_batch(int n, long buffer_size)
+{
+    batch_t *b;
+    int i;
+
+    b = (batch_t *) calloc(1, sizeof(batch_t));
+    b->n = n;
+    b->msgs = (struct mmsghdr *) calloc(n, sizeof(struct mmsghdr));
+    b->iovs = (struct iovec *) calloc(n, sizeof(struct iovec));
+    b->addrs = (struct sockaddr_storage *) calloc(n,
+            sizeof(struct sockaddr_storage));
+    b->buffers = (char *) malloc(n * buffer_size * sizeof(char));
+    b->control = (char *) calloc(n, CONTROL_SIZE);
+    init_dataset(b->buffers, n * buffer_size);
+    for (i = 0; i < n; ++i) {
+        b->iovs[i].iov_base = &b->buffers[i * buffer_size];
+        b->iovs[i].iov_len = buffer_size;
+        b->msgs[i].msg_hdr.msg_iov = &b->iovs[i];
+        b->msgs[i].msg_hdr.msg_iovlen = 1;
+        b->msgs[i].msg_hdr.msg_name = &b->addrs[i];
+    }
+    return b;
+}
+
+void free_batch(batch_t *b)
+{
+    free(b->msgs);
+    free(b->iovs);
+    free(b->addrs);
+    free(b->buffers);
+    free(b->control);
+    free(b);
+}
+
+/* sends and receives whole control messages over the TCP connection */
+int send_control(int fd, control_t *c)
+{
+    return send(fd, c, sizeof(*c), MSG_NOSIGNAL) == sizeof(*c) ? 0 : -1;
+}
+
+int recv_control(int fd, control_t *c)
+{
+    return recv(fd, c, sizeof(*c), MSG_WAITALL) == sizeof(*c) ? 0 : -1;
+}
+
+/* receives up to a batch of datagrams without blocking: one recvfrom per
+ * datagram by default, one recvmmsg per batch with --batch or --gro
+ */
+int receive(thread_arg_t *arg, batch_t *b)
 {
-    thread_arg_t *arg;
-    struct sockaddr_storage clt;
     socklen_t addrlen;
+    int i, rd;
+
+    if (b->n == 1 && !arg->opts->gro) {
+        addrlen = sizeof(struct sockaddr_storage);
+        rd = recvfrom(arg->sockfd, b->buffers, MAX_DATAGRAM, MSG_DONTWAIT,
+                (struct sockaddr *) b->addrs, &addrlen);
+        b->msgs[0].msg_len = rd;
+        b->msgs[0].msg_hdr.msg_namelen = addrlen;
+        b->msgs[0].msg_hdr.msg_controllen = 0;
+        return rd < 0 ? -1 : 1;
+    }
+
+    for (i = 0; i < b->n; ++i) {
+        b->msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_storage);
+        b->msgs[i].msg_hdr.msg_control = &b->control[i * CONTROL_SIZE];
+        b->msgs[i].msg_hdr.msg_controllen = CONTROL_SIZE;
+    }
+    return recvmmsg(arg->sockfd, b->msgs, b->n, MSG_DONTWAIT, NULL);
+}
+
+/* size of the datagrams in a received buffer: GRO coalesces datagrams of
+ * the same size and reports that size in a control message
+ */
+long segment_size(struct msghdr *msg, long len)
+{
+    struct cmsghdr *cm;
+    int gso_size;
+
+    if (msg->msg_controllen == 0) {
+        return len;
+    }
+    for (cm = CMSG_FIRSTHDR(msg); cm != NULL; cm = CMSG_NXTHDR(msg, cm)) {
+        if (cm->cmsg_level == SOL_UDP && cm->cmsg_type == UDP_GRO) {
+            memcpy(&gso_size, CMSG_DATA(cm), sizeof(gso_size));
+            return gso_size;
+        }
+    }
+    return len;
+}
+
+/* accounts one datagram of the current run: a datagram with a lower
+ * sequence number than one already received arrived out of order, and the
+ * jitter is the smoothed variation of the one-way transit time (RFC 3550),
+ * which does not depend on the offset between the clocks of both hosts
+ */
+void record(stats_t *st, char *buffer, long len, long now)
+{
+    header_t h;
+    long transit, d;
+
+    memcpy(&h, buffer, sizeof(h));
+    if (h.run != st->run) {
+        return;
+    }
+
+    if (st->received == 0) {
+        st->first = now;
+        getrusage(RUSAGE_THREAD, &st->usage);
+    }
+    st->received++;
+    st->bytes += len;
+    st->last = now;
+
+    if (h.seq < st->next) {
+        st->reordered++;
+    } else {
+        st->next = h.seq + 1;
+    }
+
+    transit = now - h.sent_at;
+    if (st->received > 1) {
+        d = transit > st->transit ? transit - st->transit
+                : st->transit - transit;
+        st->jitter += (d - st->jitter) / 16.0;
+    }
+    st->transit = transit;
+}
+
+/* reads every datagram queued on the socket; in the latency experiment each
+ * datagram is echoed back right away, header included
+ */
+int drain(thread_arg_t *arg, batch_t *b, stats_t *st)
+{
+    struct msghdr *msg;
     char *buffer;
-    int rc, rd, i, terminate;
+    long len, seg, off, now;
+    int n, i;
 
-    arg = (thread_arg_t *) argv;
+    for (;;) {
+        n = receive(arg, b);
+        if (n < 0) {
+            return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+        }
+        now = now_ns();
+        if (st->run >= 0) {
+            st->syscalls++;
+        }
 
-    buffer = (char *) malloc(PACKET_SIZE * sizeof(char));
-
-    terminate = 0;
-    if (arg->mode == MODE_LATENCY) {
-        for (i = 0; i <= arg->num_messages; ++i) {
-            memset(buffer, 1, PACKET_SIZE);
-            
-            rc = 0;
-            while (rc < PACKET_SIZE) {
-                addrlen = arg->addrlen;
-                rd = recvfrom(arg->sockfd, &buffer[rc], PACKET_SIZE - rc, 0,
-                        (struct sockaddr *) &clt, &addrlen);
-                
-                if (rd == 0) {
-                    fprintf(stdout, "Connection closed at receive!\n");
-                    break;
-                }
+        for (i = 0; i < n; ++i) {
+            msg = &b->msgs[i].msg_hdr;
+            buffer = (char *) msg->msg_iov->iov_base;
+            len = b->msgs[i].msg_len;
 
-                if (rd < 0) {
-                    fprintf(stderr, "Could not receive package!\n");
-                    free(buffer);
-                    pthread_exit(NULL);
-                }
-                
-                rc += rd;
+            if (len < (long) sizeof(header_t)) {
+                continue;
+            }
 
-                if (rc > 0 && buffer[rc - 1] == 0) {
-                    terminate = 1;
-                    break;
+            if (arg->mode == MODE_LATENCY) {
+                if (sendto(arg->sockfd, buffer, len, 0,
+                        (struct sockaddr *) msg->msg_name,
+                        msg->msg_namelen) < 0) {
+                    return -1;
                 }
             }
 
-            if (terminate) {
-                break;
+            seg = segment_size(msg, len);
+            for (off = 0; off < len; off += seg) {
+                record(st, &buffer[off], len - off < seg ? len - off : seg,
+                        now);
             }
+        }
+    }
+}
+
+/* the server follows the runs announced by the client on the control
+ * connection: START resets the counters, STOP makes the server wait until
+ * the stragglers stopped arriving and send back its counters, and DONE or
+ * a closed connection ends the server
+ */
+void *work_server(void *argv)
+{
+    thread_arg_t *arg;
+    struct rusage usage;
+    struct pollfd pfd[2];
+    control_t c;
+    stats_t st;
+    batch_t *b;
+    int ctrlfd, one, stopping, n, rc;
 
-            rc = 0;
-            while (rc < PACKET_SIZE) {
-                addrlen = arg->addrlen;
-                rd = sendto(arg->sockfd, &buffer[rc], PACKET_SIZE - rc, 0,
-                        (struct sockaddr *) &clt, addrlen);
+    arg = (thread_arg_t *) argv;
 
-                if (rd < 0) {
-                    fprintf(stderr, "Could not send package!\n");
-                    free(buffer);
-                    pthread_exit(NULL);
-                }
-                
-                rc += rd;
+    one = 1;
+    rc = arg->opts->gro ? setsockopt(arg->sockfd, SOL_UDP, UDP_GRO, &one,
+            sizeof(one)) : 0;
+
+    // an in-process client waits until every server thread is set up //
+    if (arg->ready != NULL) {
+        pthread_barrier_wait(arg->ready);
+    }
+
+    if (rc < 0) {
+        fprintf(stderr, "Could not enable GRO!\n");
+        pthread_exit(NULL);
+    }
+
+    ctrlfd = accept(arg->ctrlfd, NULL, NULL);
+    if (ctrlfd < 0) {
+        fprintf(stderr, "Could not accept control connection!\n");
+        pthread_exit(NULL);
+    }
+
+    b = alloc_batch(arg->opts->batch, RECV_BUFFER);
+
+    memset(&st, 0, sizeof(st));
+    st.run = -1;
+    stopping = 0;
+    pfd[0].fd = arg->sockfd;
+    pfd[0].events = POLLIN;
+    pfd[1].fd = ctrlfd;
+    pfd[1].events = POLLIN;
+    for (;;) {
+        n = poll(pfd, 2, stopping ? DRAIN_TIMEOUT_MS : -1);
+
+        if (n < 0) {
+            fprintf(stderr, "Could not poll sockets!\n");
+            break;
+        }
+
+        if (n == 0) {
+            getrusage(RUSAGE_THREAD, &usage);
+            memset(&c, 0, sizeof(c));
+            c.type = CTRL_RESULT;
+            c.run = st.run;
+            c.received = st.received;
+            c.reordered = st.reordered;
+            c.bytes = st.bytes;
+            c.jitter = (long) st.jitter;
+            c.runtime = (st.last - st.first) / 1000;
+            c.cpu = st.received > 0 ? cpu_time(&st.usage, &usage) : 0;
+            c.syscalls = st.syscalls;
+            if (send_control(ctrlfd, &c) < 0) {
+                break;
             }
+            st.run = -1;
+            stopping = 0;
+            continue;
         }
-    } else {
-        for (i = 0; i <= arg->num_packets; ++i) {
-            memset(buffer, 1, PACKET_SIZE);
-            
-            rc = 0;
-            while (rc < PACKET_SIZE) {
-                addrlen = arg->addrlen;
-                rd = recvfrom(arg->sockfd, &buffer[rc], PACKET_SIZE - rc, 0,
-                        (struct sockaddr *) &clt, &addrlen);
-                
-                if (rd == 0) {
-                    fprintf(stdout, "Connection closed at receive!\n");
-                    break;
-                }
 
-                if (rd < 0) {
-                    fprintf(stderr, "Could not receive package!\n");
-                    free(buffer);
-                    pthread_exit(NULL);
-                }
-                
-                rc += rd;
+        if ((pfd[0].revents & POLLIN) && drain(arg, b, &st) < 0) {
+            fprintf(stderr, "Could not receive package!\n");
+            break;
+        }
 
-                if (rc > 0 && buffer[rc - 1] == 0) {
-                    terminate = 1;
-                    break;
-                }
-            }
-            
-            if (terminate) {
+        if (pfd[1].revents == 0) {
+            continue;
+        }
+        if (recv_control(ctrlfd, &c) < 0 || c.type == CTRL_DONE) {
+            break;
+        }
+        if (c.type == CTRL_START) {
+            memset(&st, 0, sizeof(st));
+            st.run = c.run;
+            c.type = CTRL_READY;
+            if (send_control(ctrlfd, &c) < 0) {
                 break;
             }
+        } else if (c.type == CTRL_STOP) {
+            stopping = 1;
         }
     }
 
-    free(buffer);
+    close(ctrlfd);
+    free_batch(b);
     pthread_exit(NULL);
 }
 
-void *work_client(void *argv)
+/* stamps the header of a datagram */
+void stamp(thread_arg_t *arg, char *buffer, long seq)
+{
+    header_t h;
+
+    h.run = arg->run;
+    h.seq = seq;
+    h.sent_at = now_ns();
+    memcpy(buffer, &h, sizeof(h));
+}
+
+/* sends count datagrams of the given size with sendmmsg, batch messages per
+ * call; with --gso every message carries up to gso_segments datagrams that
+ * the kernel splits at the size set with UDP_SEGMENT, and each of them gets
+ * its own header
+ */
+int send_batch(thread_arg_t *arg, batch_t *b, long size, long count)
 {
-    thread_arg_t *arg;
-    struct sockaddr_storage clt;
-    socklen_t addrlen;
     char *buffer;
-    int rc, rd, i;
-    struct timeval start, end;
+    long sent, seq, left, k, s;
+    int n, rc, j;
 
-    arg = (thread_arg_t *) argv;
+    for (sent = 0; sent < count; ) {
+        left = count - sent;
+        seq = sent;
+        for (n = 0; n < b->n && left > 0; ++n) {
+            k = left < arg->gso_segments ? left : arg->gso_segments;
+            buffer = (char *) b->iovs[n].iov_base;
+            for (s = 0; s < k; ++s) {
+                stamp(arg, &buffer[s * size], seq++);
+            }
+            b->iovs[n].iov_len = k * size;
+            left -= k;
+        }
 
-    buffer = (char *) malloc(PACKET_SIZE * sizeof(char));
+        rc = sendmmsg(arg->sockfd, b->msgs, n, 0);
+        if (rc < 0 && errno == ENOBUFS) {
+            continue;
+        }
+        if (rc < 0) {
+            return -1;
+        }
+        arg->syscalls++;
 
-    init_dataset(buffer, PACKET_SIZE);
-    
-    gettimeofday(&start, NULL);
-    if (arg->mode == MODE_LATENCY) {
-        for (i = 0; i < arg->num_messages; ++i) {
-            
-            rc = 0;
-            while (rc < PACKET_SIZE) {
-                rd = sendto(arg->sockfd, &buffer[rc], PACKET_SIZE - rc, 0, 
-                        (struct sockaddr *) arg->srv, arg->addrlen);
+        for (j = 0; j < rc; ++j) {
+            sent += b->iovs[j].iov_len / size;
+        }
+    }
+    return 0;
+}
 
-                if (rd < 0) {
-                    fprintf(stderr, "Could not send package!\n");
-                    printf("errno: %s\n", strerror(errno));
-                    free(buffer);
-                    pthread_exit(NULL);
-                }
-                
-                rc += rd;
-            }
+/* sends count datagrams of the given size, waiting for the echo of each one
+ * in the latency experiment; echoes of other datagrams are left over from
+ * earlier runs and are skipped, and an echo that does not arrive in time is
+ * counted as lost
+ */
+int exchange(thread_arg_t *arg, char *buffer, char *scratch, long size,
+        long count)
+{
+    header_t h;
+    long i;
+    int rd;
 
-            rc = 0;
-            while (rc < PACKET_SIZE) {
-                addrlen = arg->addrlen;
-                rd = recvfrom(arg->sockfd, &buffer[rc], PACKET_SIZE - rc, 0,
-                        (struct sockaddr *) &clt, &addrlen);
-                
-                if (rd == 0) {
-                    fprintf(stdout, "Connection closed at receive!\n");
-                    break;
-                }
+    arg->run++;
+    if (arg->batch != NULL) {
+        return send_batch(arg, arg->batch, size, count);
+    }
 
-                if (rd < 0) {
-                    fprintf(stderr, "Could not receive package!\n");
-                    free(buffer);
-                    pthread_exit(NULL);
-                }
-                
-                rc += rd;
-            }
+    for (i = 0; i < count; ++i) {
+        stamp(arg, buffer, i);
+        arg->syscalls++;
+        if (sendto(arg->sockfd, buffer, size, 0,
+                (struct sockaddr *) arg->srv, arg->addrlen) < 0) {
+            return -1;
         }
-    } else {
-        for (i = 0; i < arg->num_packets; ++i) {
-            
-            rc = 0;
-            while (rc < PACKET_SIZE) {
-                rd = sendto(arg->sockfd, &buffer[rc], PACKET_SIZE - rc, 0,
-                        (struct sockaddr *) arg->srv, arg->addrlen);
-
-                
-                if (rd == 0) {
-                    fprintf(stdout, "Connection closed at send!\n");
+
+        if (arg->mode == MODE_LATENCY) {
+            do {
+                rd = recv(arg->sockfd, scratch, MAX_DATAGRAM, 0);
+                if (rd < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                    arg->timeouts++;
                     break;
                 }
-
                 if (rd < 0) {
-                    fprintf(stderr, "Could not send package!\n");
-                    free(buffer);
-                    pthread_exit(NULL);
+                    return -1;
                 }
-                
-                rc += rd;
-            }
+                memcpy(&h, scratch, sizeof(h));
+            } while (rd != size || h.run != arg->run || h.seq != i);
         }
     }
-    gettimeofday(&end, NULL);
-
-    sleep(rand() % 4 + 1);
-    memset(buffer, 0, PACKET_SIZE);
-    for (i = 0; i < NUM_TERMINATE_MSGS; ++i) {
-    
-        rc = 0;
-        while (rc < PACKET_SIZE) {
-            rd = sendto(arg->sockfd, &buffer[rc], PACKET_SIZE - rc, 0,
-                    (struct sockaddr *) arg->srv, arg->addrlen);
-            
-            if (rd < 0) {
-                fprintf(stderr, "Could not send package!\n");
-                free(buffer);
-                pthread_exit(NULL);
-            }
-            
-            rc += rd;
-        }    
+    return 0;
+}
+
+/* picks the number of iterations that fills the time budget: the iteration
+ * count is doubled until a run takes 5% of the budget, and the measured
+ * rate is extrapolated to the whole budget
+ */
+long calibrate(thread_arg_t *arg, char *buffer, char *scratch, long size)
+{
+    long budget, count, start, elapsed;
+
+    budget = (long) (arg->opts->time * 1e9);
+    count = 1;
+    for (;;) {
+        start = now_ns();
+        if (exchange(arg, buffer, scratch, size, count) < 0) {
+            return -1;
+        }
+        elapsed = now_ns() - start;
+
+        if (elapsed >= budget / 20 || count >= (1L << 30)) {
+            break;
+        }
+        count *= 2;
     }
 
-    arg->runtime = ((long) end.tv_sec - (long) start.tv_sec) 
-            * 1000000 + (end.tv_usec - start.tv_usec);
+    count = (long) ((double) budget * count / (elapsed > 0 ? elapsed : 1));
+    return count > 0 ? count : 1;
+}
 
-    free(buffer);
-    pthread_exit(NULL);
+/* connects the control channel, retrying while the server is starting */
+int connect_control(thread_arg_t *arg)
+{
+    int i;
+
+    for (i = 0; i < CONNECT_RETRIES; ++i) {
+        arg->ctrlfd = socket(AF_INET, SOCK_STREAM, 0);
+        if (arg->ctrlfd < 0) {
+            return -1;
+        }
+        if (connect(arg->ctrlfd, (struct sockaddr *) arg->srv,
+                arg->addrlen) == 0) {
+            return 0;
+        }
+        close(arg->ctrlfd);
+        usleep(100000);
+    }
+    arg->ctrlfd = -1;
+    return -1;
 }
 
-int main(int argc, char **argv)
+/* runs one message size: the calibration runs are not announced, so the
+ * server ignores them, while the measured run is framed by START and STOP
+ * and the server answers the STOP with what it received
+ */
+int run_point(thread_arg_t *arg, char *buffer, char *scratch,
+        point_t *point)
 {
-    int num_threads, mode, type, start_port;
-    struct addrinfo hints, *res;
-    char ipaddr[INET_ADDRSTRLEN], port[10];
-    pthread_t *threads;
-    thread_arg_t *args;
-    int i, j, rc;
-    double throughput;
-    long max_runtime, latency;
+    struct rusage usage_start, usage_end;
+    control_t c;
+    long count, start, end;
 
-    // parsing arguments //
-    if (argc <= 5 || argc >= 7) {
-        fprintf(stderr, "Program usage: ./benchmark-tcp.exe "
-                "<num_threads> <mode> <type> <ip_addr> <start_port>\n"
-                "where <mode> accepts the following values:\n"
-                "\t 0 - Latency experiment\n"
-                "\t 1 - Througput experiment\n"
-                "where <type> accepts the following values:\n"
-                "\t 0 - Client\n"
-                "\t 1 - Server\n");
-        exit(-1);
+    if (arg->opts->time > 0) {
+        count = calibrate(arg, buffer, scratch, point->size);
+        if (count < 0) {
+            return -1;
+        }
+    } else if (arg->mode == MODE_LATENCY) {
+        count = scale_count(arg->num_messages, point->size);
     } else {
-        num_threads = atoi(argv[1]);
-        switch (atoi(argv[2])) {
-            case MODE_LATENCY:
-                mode = MODE_LATENCY;
-                break;
-            case MODE_THROUGHPUT:
-                mode = MODE_THROUGHPUT;
-                break;
-            default:
-                fprintf(stderr, "Unrecognized mode!\n");
-                exit(-1);
+        count = scale_count(arg->num_packets, point->size);
+    }
+
+    memset(&c, 0, sizeof(c));
+    c.type = CTRL_START;
+    c.run = arg->run + 1;
+    if (send_control(arg->ctrlfd, &c) < 0 || recv_control(arg->ctrlfd, &c) < 0
+            || c.type != CTRL_READY) {
+        return -1;
+    }
+
+    arg->syscalls = 0;
+    arg->timeouts = 0;
+    getrusage(RUSAGE_THREAD, &usage_start);
+    start = now_ns();
+    if (exchange(arg, buffer, scratch, point->size, count) < 0) {
+        return -1;
+    }
+    end = now_ns();
+    getrusage(RUSAGE_THREAD, &usage_end);
+
+    point->runtime = (end - start) / 1000;
+    point->count = count;
+    point->bytes = count * point->size;
+    point->send_cpu = cpu_time(&usage_start, &usage_end);
+    point->syscalls = arg->syscalls;
+    point->timeouts = arg->timeouts;
+
+    c.type = CTRL_STOP;
+    c.run = arg->run;
+    c.sent = count;
+    if (send_control(arg->ctrlfd, &c) < 0 || recv_control(arg->ctrlfd, &c) < 0
+            || c.type != CTRL_RESULT) {
+        return -1;
+    }
+    point->received = c.received;
+    point->reordered = c.reordered;
+    point->recv_bytes = c.bytes;
+    point->jitter = c.jitter;
+    point->recv_cpu = c.cpu;
+    point->recv_syscalls = c.syscalls;
+    point->recv_runtime = c.runtime;
+
+    return 0;
+}
+
+void *work_client(void *argv)
+{
+    thread_arg_t *arg;
+    struct timeval timeout;
+    control_t c;
+    point_t *point;
+    char *buffer, *scratch;
+    long max_size;
+    int p, size;
+
+    arg = (thread_arg_t *) argv;
+
+    buffer = (char *) malloc(MAX_DATAGRAM * sizeof(char));
+    scratch = (char *) malloc(MAX_DATAGRAM * sizeof(char));
+
+    init_dataset(buffer, MAX_DATAGRAM);
+
+    // a lost echo must not stall the latency experiment //
+    timeout.tv_sec = 0;
+    timeout.tv_usec = ECHO_TIMEOUT_MS * 1000;
+    setsockopt(arg->sockfd, SOL_SOCKET, SO_RCVTIMEO, &timeout,
+            sizeof(timeout));
+
+    if (connect_control(arg) < 0) {
+        fprintf(stderr, "Could not connect control channel!\n");
+        free(buffer);
+        free(scratch);
+        pthread_exit(NULL);
+    }
+
+    // every message of a batch has its own buffer for the headers //
+    arg->batch = NULL;
+    if (arg->opts->batch > 1 || arg->opts->gso) {
+        max_size = arg->opts->gso ? MAX_DATAGRAM
+                : arg->opts->sweep ? SWEEP_MAX : arg->opts->size;
+        arg->batch = alloc_batch(arg->opts->batch, max_size);
+        for (p = 0; p < arg->opts->batch; ++p) {
+            arg->batch->msgs[p].msg_hdr.msg_name = arg->srv;
+            arg->batch->msgs[p].msg_hdr.msg_namelen = arg->addrlen;
         }
-        switch (atoi(argv[3])) {
-            case TYPE_CLIENT:
-                type = TYPE_CLIENT;
-                break;
-            case TYPE_SERVER:
-                type = TYPE_SERVER;
+    }
+
+    for (p = 0; p < arg->num_points; ++p) {
+        point = &arg->points[p];
+
+        // the kernel splits the GSO messages into datagrams of this size //
+        arg->gso_segments = 1;
+        if (arg->opts->gso) {
+            arg->gso_segments = MAX_DATAGRAM / point->size;
+            if (arg->gso_segments > GSO_SEGMENTS) {
+                arg->gso_segments = GSO_SEGMENTS;
+            }
+            size = point->size;
+            if (setsockopt(arg->sockfd, SOL_UDP, UDP_SEGMENT, &size,
+                    sizeof(size)) < 0) {
+                fprintf(stderr, "Could not enable GSO!\n");
                 break;
-            default:
-                fprintf(stderr, "Unrecognized type!\n");
-                exit(-1);
+            }
+        }
+
+        // every thread starts a message size at the same time //
+        pthread_barrier_wait(arg->barrier);
+
+        if (run_point(arg, buffer, scratch, point) < 0) {
+            fprintf(stderr, "Could not run experiment: %s\n",
+                    strerror(errno));
         }
-        strcpy(ipaddr, argv[4]);
-        start_port = atoi(argv[5]);
     }
 
-    srand(time(NULL));
-    args = (thread_arg_t *) malloc(num_threads * sizeof(thread_arg_t));
+    if (arg->batch != NULL) {
+        free_batch(arg->batch);
+    }
+
+    memset(&c, 0, sizeof(c));
+    c.type = CTRL_DONE;
+    send_control(arg->ctrlfd, &c);
+    close(arg->ctrlfd);
+
+    free(buffer);
+    free(scratch);
+    pthread_exit(NULL);
+}
+
+/* prints the packet rate of one side, the cpu it took, in percent of one
+ * core, and the rates per busy core
+ */
+void print_rates(const char *side, long count, double throughput,
+        long runtime, long cpu, long syscalls, options_t *opts)
+{
+    double cores;
+
+    cores = (double) cpu / runtime;
+    printf("%s: %.0lf pps, CPU %.1lf%%, %.2lf Mpps and %.2lf Gbps per "
+            "core\n", side, count * 1e6 / runtime, cores * 100,
+            cores > 0 ? count / (double) cpu : 0.0,
+            cores > 0 ? throughput / 1000 / cores : 0.0);
+    if (opts->batch > 1 || opts->gso || opts->gro) {
+        printf("%s syscalls: %ld (%.1lf datagrams per syscall)\n", side,
+                syscalls, syscalls > 0 ? (double) count / syscalls : 0.0);
+    }
+}
+
+/* creates the datagram socket of every thread and, on the server side,
+ * binds it and the control socket to its port, then fills in the thread
+ * arguments
+ */
+thread_arg_t *init_args(int num_threads, int mode, int type, char *ipaddr,
+        int start_port, options_t *opts, pthread_barrier_t *barrier,
+        int *num_points)
+{
+    struct addrinfo hints, *res;
+    thread_arg_t *args;
+    char port[10];
+    int i, j, rc, one;
+
+    args = (thread_arg_t *) calloc(num_threads, sizeof(thread_arg_t));
 
-    // creating and binding (where necessary) the sockets for each thread //
     memset(&hints, 0, sizeof(hints));
     hints.ai_family = AF_INET;
     hints.ai_socktype = SOCK_DGRAM;
-    
+
     for (i = 0; i < num_threads; ++i) {
         sprintf(port, "%d", start_port + i);
-        
+
         if ((rc = getaddrinfo(ipaddr, port, &hints, &res)) != 0) {
             fprintf(stderr, "Could not get addrinfo!\n");
-            for (j = 0; j <= i; ++j) {
+            for (j = 0; j < i; ++j) {
                 close(args[j].sockfd);
                 free(args[j].srv);
             }
             free(args);
             exit(-2);
-        }    
+        }
 
-        args[i].sockfd = socket(res->ai_family, res->ai_socktype, 
+        args[i].sockfd = socket(res->ai_family, res->ai_socktype,
                 res->ai_protocol);
 
         if (args[i].sockfd < 0) {
             fprintf(stderr, "Could not create socket!\n");
-            for (j = 0; j <= i; ++j) {
+            for (j = 0; j < i; ++j) {
                 close(args[j].sockfd);
                 free(args[j].srv);
             }
@@ -334,7 +891,16 @@ int main(int argc, char **argv)
         }
 
         if (type == TYPE_SERVER) {
-            if (bind(args[i].sockfd, res->ai_addr, res->ai_addrlen) < 0) {
+            // the control channel listens on the same port number over TCP //
+            one = 1;
+            args[i].ctrlfd = socket(res->ai_family, SOCK_STREAM, 0);
+            if (bind(args[i].sockfd, res->ai_addr, res->ai_addrlen) < 0
+                    || args[i].ctrlfd < 0
+                    || setsockopt(args[i].ctrlfd, SOL_SOCKET, SO_REUSEADDR,
+                    &one, sizeof(one)) < 0
+                    || bind(args[i].ctrlfd, res->ai_addr,
+                    res->ai_addrlen) < 0
+                    || listen(args[i].ctrlfd, 1) < 0) {
                 fprintf(stderr, "Could not bind socket!\n");
                 for (j = 0; j <= i; ++j) {
                     close(args[j].sockfd);
@@ -345,31 +911,42 @@ int main(int argc, char **argv)
             }
         }
 
-        args[i].srv = (struct sockaddr_storage *) 
+        args[i].srv = (struct sockaddr_storage *)
                 malloc(sizeof(struct sockaddr_storage));
         memcpy(args[i].srv, res->ai_addr, sizeof(struct sockaddr_storage));
         args[i].addrlen = res->ai_addrlen;
         args[i].mode = mode;
         args[i].num_messages = NUM_MESSAGES / num_threads;
         args[i].num_packets = NUM_PACKETS / num_threads;
+        args[i].opts = opts;
+        args[i].barrier = barrier;
+        args[i].points = init_points(opts, num_points);
+        args[i].num_points = *num_points;
         freeaddrinfo(res);
     }
-    
-    // creating and running the threads //
+
+    return args;
+}
+
+pthread_t *start_threads(thread_arg_t *args, int num_threads, int type)
+{
+    pthread_t *threads;
+    int i, j, rc;
+
     threads = (pthread_t *) malloc(num_threads * sizeof(pthread_t));
 
     for (i = 0; i < num_threads; ++i) {
         if (type == TYPE_SERVER) {
-            rc = pthread_create(&threads[i], NULL, work_server, 
+            rc = pthread_create(&threads[i], NULL, work_server,
                     (void *) &args[i]);
         } else {
-            rc = pthread_create(&threads[i], NULL, work_client, 
+            rc = pthread_create(&threads[i], NULL, work_client,
                     (void *) &args[i]);
         }
 
         if (rc) {
             fprintf(stderr, "Could not create thread!\n");
-            for (j = 0; j <= i; ++j) {
+            for (j = 0; j < num_threads; ++j) {
                 close(args[j].sockfd);
                 free(args[j].srv);
             }
@@ -377,39 +954,274 @@ int main(int argc, char **argv)
             free(threads);
             exit(-3);
         }
-
     }
 
-    // joining the threads //
+    return threads;
+}
+
+void join_threads(thread_arg_t *args, pthread_t *threads, int num_threads,
+        int type)
+{
+    int i, rc;
+
     for (i = 0; i < num_threads; ++i) {
         rc = pthread_join(threads[i], NULL);
         if (rc) {
             fprintf(stderr, "Could not join thread!\n");
         }
         close(args[i].sockfd);
+        if (type == TYPE_SERVER) {
+            close(args[i].ctrlfd);
+        }
         free(args[i].srv);
     }
+}
+
+int main(int argc, char **argv)
+{
+    int num_threads, mode, type, start_port;
+    char ipaddr[INET_ADDRSTRLEN];
+    pthread_t *threads, *srv_threads;
+    thread_arg_t *args, *srv_args;
+    pthread_barrier_t barrier, ready;
+    int i, p, num_points, saturation;
+    double throughput, *results, peak;
+    long max_runtime, latency, bytes, count, cpu, syscalls, received,
+            reordered, recv_bytes, recv_cpu, recv_syscalls, timeouts,
+            recv_runtime;
+    double jitter;
+    options_t opts;
+    topology_t topo;
+
+    // parsing arguments //
+    if (argc <= 5) {
+        fprintf(stderr, "Program usage: ./benchmark-udp.exe "
+                "<num_threads> <mode> <type> <ip_addr> <start_port> "
+                "[options]\n"
+                "where <num_threads> 0 runs one thread per hardware thread "
+                "of the host\n"
+                "where <mode> accepts the following values:\n"
+                "\t 0 - Latency experiment\n"
+                "\t 1 - Througput experiment\n"
+                "where <type> accepts the following values:\n"
+                "\t 0 - Client\n"
+                "\t 1 - Server\n"
+                "where [options] accepts the following values, which must "
+                "be the same on both sides:\n"
+                "\t --size=<bytes>       datagram size, k suffix accepted "
+                "(default 1024, max 65507)\n"
+                "\t --sweep              measure every power of two from "
+                "64 B to 32 KB\n"
+                "\t --time=<sec>         time budget of every message size "
+                "(default 1 with --sweep)\n"
+                "\t --batch=<n>          datagrams per sendmmsg/recvmmsg "
+                "call (default 1)\n"
+                "\t --gso                segmentation offload on send "
+                "(UDP_SEGMENT)\n"
+                "\t --gro                receive offload on receive "
+                "(UDP_GRO)\n"
+                "\t --loopback           run the server threads in this "
+                "process, <type> is ignored\n");
+        exit(-1);
+    } else {
+        // describing the host, with its network interfaces //
+        topology_read(&topo, NULL);
+        topology_print(&topo);
+        num_threads = atoi(argv[1]);
+        if (num_threads <= 0) {
+            num_threads = topo.threads;
+        }
+        switch (atoi(argv[2])) {
+            case MODE_LATENCY:
+                mode = MODE_LATENCY;
+                break;
+            case MODE_THROUGHPUT:
+                mode = MODE_THROUGHPUT;
+                break;
+            default:
+                fprintf(stderr, "Unrecognized mode!\n");
+                exit(-1);
+        }
+        switch (atoi(argv[3])) {
+            case TYPE_CLIENT:
+                type = TYPE_CLIENT;
+                break;
+            case TYPE_SERVER:
+                type = TYPE_SERVER;
+                break;
+            default:
+                fprintf(stderr, "Unrecognized type!\n");
+                exit(-1);
+        }
+        strcpy(ipaddr, argv[4]);
+        start_port = atoi(argv[5]);
+
+        opts.size = PACKET_SIZE;
+        opts.sweep = 0;
+        opts.time = 0;
+        opts.batch = 1;
+        opts.gso = 0;
+        opts.gro = 0;
+        opts.loopback = 0;
+        for (i = 6; i < argc; ++i) {
+            if (parse_option(&opts, argv[i]) < 0) {
+                fprintf(stderr, "Unrecognized option %s!\n", argv[i]);
+                exit(-1);
+            }
+        }
+        if (opts.sweep && opts.time == 0) {
+            opts.time = SWEEP_TIME;
+        }
+        if (opts.size < (long) sizeof(header_t)) {
+            fprintf(stderr, "The datagrams must hold their %d byte "
+                    "header!\n", (int) sizeof(header_t));
+            exit(-1);
+        }
+        if ((opts.batch > 1 || opts.gso || opts.gro)
+                && mode != MODE_THROUGHPUT) {
+            fprintf(stderr, "Batching and offloads are only supported by "
+                    "the throughput experiment!\n");
+            exit(-1);
+        }
+    }
+
+    srand(time(NULL));
+    pthread_barrier_init(&barrier, NULL, num_threads);
+
+    srv_args = NULL;
+    srv_threads = NULL;
+
+    // in loopback mode the server threads run in this process as well //
+    if (opts.loopback) {
+        pthread_barrier_init(&ready, NULL, num_threads + 1);
+        srv_args = init_args(num_threads, mode, TYPE_SERVER, ipaddr,
+                start_port, &opts, NULL, &num_points);
+        for (i = 0; i < num_threads; ++i) {
+            srv_args[i].ready = &ready;
+        }
+        srv_threads = start_threads(srv_args, num_threads, TYPE_SERVER);
+
+        // the clients start once every server thread is set up //
+        pthread_barrier_wait(&ready);
+        type = TYPE_CLIENT;
+    }
+
+    args = init_args(num_threads, mode, type, ipaddr, start_port, &opts,
+            &barrier, &num_points);
+    threads = start_threads(args, num_threads, type);
+    join_threads(args, threads, num_threads, type);
+
+    if (opts.loopback) {
+        join_threads(srv_args, srv_threads, num_threads, TYPE_SERVER);
+        for (i = 0; i < num_threads; ++i) {
+            free(srv_args[i].points);
+        }
+        pthread_barrier_destroy(&ready);
+        free(srv_threads);
+        free(srv_args);
+    }
 
     if (type == TYPE_CLIENT) {
-        max_runtime = args[0].runtime;
-        for (i = 1; i < num_threads; ++i) {
-            if (max_runtime < args[i].runtime) {
-                max_runtime = args[i].runtime;
+        results = (double *) calloc(num_points, sizeof(double));
+        for (p = 0; p < num_points; ++p) {
+            max_runtime = 0;
+            bytes = 0;
+            count = 0;
+            cpu = 0;
+            syscalls = 0;
+            timeouts = 0;
+            received = 0;
+            reordered = 0;
+            recv_bytes = 0;
+            recv_cpu = 0;
+            recv_syscalls = 0;
+            jitter = 0;
+            recv_runtime = 0;
+            for (i = 0; i < num_threads; ++i) {
+                if (max_runtime < args[i].points[p].runtime) {
+                    max_runtime = args[i].points[p].runtime;
+                }
+                if (recv_runtime < args[i].points[p].recv_runtime) {
+                    recv_runtime = args[i].points[p].recv_runtime;
+                }
+                bytes += args[i].points[p].bytes;
+                count += args[i].points[p].count;
+                cpu += args[i].points[p].send_cpu;
+                syscalls += args[i].points[p].syscalls;
+                timeouts += args[i].points[p].timeouts;
+                received += args[i].points[p].received;
+                reordered += args[i].points[p].reordered;
+                recv_bytes += args[i].points[p].recv_bytes;
+                recv_cpu += args[i].points[p].recv_cpu;
+                recv_syscalls += args[i].points[p].recv_syscalls;
+                jitter += args[i].points[p].jitter / (double) num_threads;
+            }
+            if (max_runtime <= 0) {
+                max_runtime = 1;
+            }
+            // the server times its first to its last received datagram //
+            if (recv_runtime <= 0) {
+                recv_runtime = max_runtime;
+            }
+
+            // the throughput counts the delivered bytes only //
+            throughput = 8.0 * recv_bytes / (double) max_runtime;
+            results[p] = throughput;
+
+            if (opts.sweep) {
+                printf("Message size: %ld B\n", args[0].points[p].size);
+            }
+            printf("Elapsed time: %ld ms\n", max_runtime / 1000);
+            if (mode == MODE_LATENCY) {
+                latency = count > 0 ? max_runtime * num_threads / count : 0;
+                printf("Ping-pong message latency: %ld us\n", latency);
+                if (opts.sweep) {
+                    printf("Throughput: %lf Mbps\n", throughput);
+                }
+            } else {
+                printf("Throughput: %lf Mbps\n", throughput);
+                printf("Sent: %lf Mbps\n", 8.0 * bytes / max_runtime);
+            }
+            printf("Datagrams: %ld sent, %ld received, %ld lost (%.3lf%%), "
+                    "%ld reordered, jitter %.2lf us\n", count, received,
+                    count > received ? count - received : 0,
+                    count > received ? 100.0 * (count - received) / count
+                    : 0.0, reordered, jitter / 1000);
+            if (mode == MODE_LATENCY) {
+                printf("Echoes timed out: %ld\n", timeouts);
+            } else {
+                print_rates("Send", count, 8.0 * bytes / max_runtime,
+                        max_runtime, cpu, syscalls, &opts);
+                print_rates("Receive", received,
+                        8.0 * recv_bytes / recv_runtime, recv_runtime,
+                        recv_cpu, recv_syscalls, &opts);
             }
         }
-        
-        printf("Elapsed time: %ld ms\n", max_runtime / 1000);
-        if (mode == MODE_LATENCY) {
-            latency = NUM_MESSAGES;
-            latency = (max_runtime / latency) * num_threads;
-            printf("Ping-pong message latency: %ld us\n", latency);
-        } else {
-            throughput = (8.0 * PACKET_SIZE * NUM_PACKETS) 
-                    / (double) max_runtime;
-            printf("Throughput: %lf Mbps\n", throughput);
+
+        // the saturation point is the smallest size close to the peak //
+        if (opts.sweep) {
+            peak = 0;
+            for (p = 0; p < num_points; ++p) {
+                if (peak < results[p]) {
+                    peak = results[p];
+                }
+            }
+            saturation = 0;
+            while (results[saturation] < SATURATION * peak) {
+                saturation++;
+            }
+            printf("Saturation: %ld B reaches %.0lf%% of the peak "
+                    "throughput of %lf Mbps\n",
+                    args[0].points[saturation].size, SATURATION * 100,
+                    peak);
         }
+        free(results);
     }
 
+    for (i = 0; i < num_threads; ++i) {
+        free(args[i].points);
+    }
+    pthread_barrier_destroy(&barrier);
     free(threads);
     free(args);
 
@@ -0,0 +1,489 @@
+import json
+import math
+import os
+import platform
+import re
+import socket
+import subprocess
+import sys
+import time
+
+# Append-only store of benchmark results. Every record is one JSON line
+# holding the samples of every metric a benchmark printed over repeated
+# runs, keyed by the fingerprint of the host and the revision of the code.
+# The benchmarks print the topology of their host as a "Host:" line, whose
+# fingerprint keys the record when it is there.
+#
+#   python results.py record <name> [--repeats=<n>] [--revision=<label>]
+#                            [--store=<file>] -- <command> [args...]
+#   python results.py compare [--baseline=<label>] [--candidate=<label>]
+#                             [--host=<fingerprint>] [--alpha=<p>]
+#                             [--min-change=<pct>] [--store=<file>]
+#   python results.py list [--store=<file>]
+
+DEFAULT_STORE = os.path.join(os.path.dirname(os.path.abspath(__file__)),
+                             "results.jsonl")
+DEFAULT_REPEATS = 5
+DEFAULT_ALPHA = 0.05
+DEFAULT_MIN_CHANGE = 2.0
+
+# a metric is a "Name: value" line of the output of a benchmark, or a line
+# of several values labelled by the words next to them, as in
+# "Name: avg 1.2 us, p99 3.4 us" or "Name: 10 sent, 9 received, 1 lost"
+METRIC = re.compile(r"^([A-Za-z][A-Za-z0-9 /()%._-]*):\s*(.*)$")
+NUMBER = r"[-+]?[0-9]*\.?[0-9]+(?:[eE][-+]?[0-9]+)?"
+TOKEN = re.compile(r"(" + NUMBER + r")|([A-Za-z][A-Za-z0-9/.-]*)|([,;(])|(%)")
+
+# words that only join the label of a value to the next one
+CONNECTORS = ("and", "with", "over", "of")
+
+# lines that name the point of a sweep, which keys the metrics after them
+POINTS = ("Threads", "Message size", "Socket options", "Structure",
+          "Alignment")
+
+# lines that are neither metrics nor points: the rounds of an autotune
+# search depend on its budget, and the host line is parsed on its own
+IGNORED = ("Round", "Host")
+
+# metrics for which lower is better: latencies, costs and losses, unless
+# they are a rate such as the Gbps per core of a CPU line; the others are
+# throughputs
+LOWER_IS_BETTER = re.compile(r"latency|time|error|overhead|\bp[0-9]+|\bms\b"
+                             r"|\bus\b|cpu|fraction|temperature|throttle"
+                             r"|timed out|lost|reorder|jitter|established"
+                             r"|copied", re.I)
+HIGHER_IS_BETTER = re.compile(r"per core|pps\b|bps\b|received|achieved",
+                              re.I)
+
+# the host topology line, key=value pairs with the values in quotes when
+# they hold spaces
+HOST_FIELD = re.compile(r'([A-Za-z_][A-Za-z0-9_]*)=("[^"]*"|\S+)')
+
+
+def read_first(path, pattern):
+    try:
+        with open(path, "r") as fil:
+            for line in fil:
+                if line.startswith(pattern):
+                    return line.split(":", 1)[1].strip()
+    except IOError:
+        pass
+    return ""
+
+
+def read_number(path):
+    try:
+        with open(path, "r") as fil:
+            return int(re.match(r"-?[0-9]*", fil.readline()).group(0) or 0)
+    except (IOError, ValueError):
+        return -1
+
+
+def read_cpus():
+    """Sockets, cores and hardware threads, as read_cpus of topology.c"""
+    threads = os.sysconf("SC_NPROCESSORS_ONLN")
+    base = "/sys/devices/system/cpu/cpu%d/topology/"
+    ids = []
+    for cpu in range(4096):
+        if len(ids) >= threads:
+            break
+        package = read_number(base % cpu + "physical_package_id")
+        core = read_number(base % cpu + "core_id")
+        if package >= 0 and core >= 0:
+            ids.append((package, core))
+    if not ids:
+        return 1, threads, threads
+    return len(set(p for p, c in ids)), len(set(ids)), threads
+
+
+def read_caches():
+    """L1d, L2 and L3 sizes in bytes, as read_caches of topology.c"""
+    caches = {}
+    base = "/sys/devices/system/cpu/cpu0/cache/index%d/"
+    for i in range(16):
+        level = read_number(base % i + "level")
+        if level < 0:
+            break
+        try:
+            with open(base % i + "type") as fil:
+                kind = fil.readline().strip()
+            with open(base % i + "size") as fil:
+                size = fil.readline().strip()
+        except IOError:
+            continue
+        number = int(re.match(r"[0-9]*", size).group(0) or 0)
+        number *= 1024 if "K" in size else 1024 * 1024 if "M" in size else 1
+        if level == 1 and kind == "Instruction":
+            continue
+        caches[level] = number
+    return caches.get(1, 0), caches.get(2, 0), caches.get(3, 0)
+
+
+def read_memory_gb():
+    """Installed memory in GiB, from the SMBIOS memory devices or else
+    MemTotal rounded up, as read_memory of topology.c"""
+    total_kb = int(re.match(r"[0-9]*",
+                            read_first("/proc/meminfo", "MemTotal")).group(0)
+                   or 0)
+    installed_mb = 0
+    base = "/sys/firmware/dmi/entries"
+    try:
+        entries = os.listdir(base)
+    except OSError:
+        entries = []
+    for entry in entries:
+        if not entry.startswith("17-"):
+            continue
+        try:
+            with open(os.path.join(base, entry, "raw"), "rb") as fil:
+                raw = bytearray(fil.read(0x24))
+        except IOError:
+            continue
+        size = raw[0x0c] | raw[0x0d] << 8 if len(raw) >= 0x0e else 0
+        if size == 0x7fff and len(raw) >= 0x20:
+            size = raw[0x1c] | raw[0x1d] << 8 | raw[0x1e] << 16 | raw[0x1f] << 24
+        elif size == 0xffff:
+            size = 0
+        elif size & 0x8000:
+            size = (size & 0x7fff) // 1024
+        installed_mb += size
+    if installed_mb > 0:
+        return (installed_mb + 1023) // 1024
+    return (total_kb + 1048575) // 1048576
+
+
+def fnv1a(data):
+    value = 14695981039346656037
+    for byte in bytearray(data):
+        value = ((value ^ byte) * 1099511628211) & 0xffffffffffffffff
+    return "%016x" % value
+
+
+def host_info():
+    """Hardware identity of the host, which makes the fingerprint, and the
+    software it runs, which is recorded but may change between runs. The
+    fingerprint is the one common/topology.c prints on the Host: line"""
+    sockets, cores, threads = read_cpus()
+    l1d, l2, l3 = read_caches()
+    numa = len([n for n in range(1024)
+                if os.path.exists("/sys/devices/system/node/node%d" % n)])
+    hardware = {
+        "hostname": socket.gethostname(),
+        "cpu": read_first("/proc/cpuinfo", "model name")[:127],
+        "sockets": sockets,
+        "cores": cores,
+        "cpus": threads,
+        "numa": max(numa, 1),
+        "l1d": l1d,
+        "l2": l2,
+        "l3": l3,
+        "memory_gb": read_memory_gb(),
+    }
+    software = {
+        "kernel": platform.release(),
+        "microcode": read_first("/proc/cpuinfo", "microcode"),
+    }
+    key = "%s|%s|%d|%d|%d|%d|%d|%d|%d|%d" % (
+        hardware["hostname"], hardware["cpu"], sockets, cores, threads,
+        hardware["numa"], l1d, l2, l3, hardware["memory_gb"])
+    return fnv1a(key.encode()), hardware, software
+
+
+def git_revision():
+    root = os.path.dirname(os.path.abspath(__file__))
+    try:
+        rev = subprocess.check_output(["git", "rev-parse", "--short", "HEAD"],
+                                      cwd=root, stderr=subprocess.DEVNULL)
+        dirty = subprocess.call(["git", "diff", "--quiet", "HEAD"], cwd=root,
+                                stderr=subprocess.DEVNULL)
+    except (OSError, subprocess.CalledProcessError):
+        return "unknown"
+    return rev.decode().strip() + ("-dirty" if dirty else "")
+
+
+def parse_values(name, rest):
+    """Values of one metric line, each named after the words before it in
+    its comma separated part, or else after the words following it; the
+    first value of the line keeps the plain name, and an unlabelled
+    percentage the name of the value before it"""
+    values = []
+    words = []
+    after = False
+    for number, word, sep, percent in (m.groups()
+                                       for m in TOKEN.finditer(rest)):
+        if word:
+            words.append(word)
+            if after:
+                values[-1][2].append(word)
+        elif sep:
+            words = []
+            after = False
+        elif percent:
+            if after and not values[-1][2]:
+                values[-1][3] = True
+        else:
+            # the words between two values of a part label the first one
+            values.append([float(number), [] if after else words, [], False,
+                           not values])
+            words = []
+            after = True
+
+    found = []
+    for number, before, after, percent, first in values:
+        while after and after[-1] in CONNECTORS:
+            after.pop()
+        if before:
+            label = "%s %s" % (name, " ".join(before))
+        elif first or not (after or percent):
+            label = name
+        elif after:
+            label = "%s %s" % (name, " ".join(after))
+        else:
+            label = found[-1][0] + " %"
+        found.append((label, number))
+    return found
+
+
+def parse_metrics(output):
+    """Metrics of one run, keyed by the sweep point they belong to, e.g.
+    "[Threads=4] GFlops"; a name that still repeats gets a #2, #3, ..."""
+    metrics = {}
+    point = []
+    for line in output.splitlines():
+        match = METRIC.match(line.strip())
+        if not match:
+            continue
+        name, rest = match.group(1).strip(), match.group(2).strip()
+        if name.split()[0] in IGNORED:
+            continue
+        if name in POINTS:
+            point = [p for p in point if p[0] != name] + [(name, rest)]
+            continue
+
+        found = parse_values(name, rest)
+        prefix = ("[%s] " % ", ".join("%s=%s" % p for p in point)
+                  if point else "")
+        for metric, number in found:
+            key, n = prefix + metric, 2
+            while key in metrics:
+                key, n = "%s%s#%d" % (prefix, metric, n), n + 1
+            metrics[key] = number
+    return metrics
+
+
+def metric_name(key):
+    """The name of a metric without its sweep point"""
+    return key.split("] ", 1)[1] if key.startswith("[") else key
+
+
+def parse_host(output):
+    for line in output.splitlines():
+        if line.startswith("Host: "):
+            return dict((key, value.strip('"')) for key, value
+                        in HOST_FIELD.findall(line[len("Host: "):]))
+    return {}
+
+
+def parse_options(args, options):
+    rest = []
+    for i, arg in enumerate(args):
+        if arg == "--":
+            return rest + args[i + 1:]
+        if arg.startswith("--") and "=" in arg:
+            key, value = arg[2:].split("=", 1)
+            if key not in options:
+                sys.exit("Unknown option %s" % arg)
+            options[key] = value
+        else:
+            rest.append(arg)
+    return rest
+
+
+def load(store):
+    records = []
+    if os.path.exists(store):
+        with open(store, "r") as fil:
+            for line in fil:
+                if line.strip():
+                    records.append(json.loads(line))
+    return records
+
+
+def record(args):
+    options = {"repeats": str(DEFAULT_REPEATS), "revision": None,
+               "store": DEFAULT_STORE}
+    rest = parse_options(args, options)
+    if len(rest) < 2:
+        sys.exit("Usage: python results.py record <name> [options] -- <command>")
+    name, command = rest[0], rest[1:]
+
+    samples = {}
+    topology = {}
+    for i in range(int(options["repeats"])):
+        output = subprocess.check_output(command).decode()
+        topology = topology or parse_host(output)
+        for metric, value in parse_metrics(output).items():
+            samples.setdefault(metric, []).append(value)
+    if not samples:
+        sys.exit("The command printed no metrics")
+
+    fingerprint, hardware, software = host_info()
+    fingerprint = topology.get("fingerprint", fingerprint)
+    entry = {
+        "time": time.strftime("%Y-%m-%dT%H:%M:%S"),
+        "host": fingerprint,
+        "revision": options["revision"] or git_revision(),
+        "benchmark": name,
+        "command": command,
+        "hardware": hardware,
+        "software": software,
+        "topology": topology,
+        "samples": samples,
+    }
+    with open(options["store"], "a") as fil:
+        fil.write(json.dumps(entry, sort_keys=True) + "\n")
+    for metric, values in sorted(samples.items()):
+        print("%s %s: %s" % (name, metric, " ".join("%g" % v for v in values)))
+    print("Recorded %s on host %s at revision %s" % (name, fingerprint,
+                                                     entry["revision"]))
+
+
+def betacf(a, b, x):
+    """Continued fraction of the incomplete beta function"""
+    qab, qap, qam = a + b, a + 1.0, a - 1.0
+    c, d = 1.0, 1.0 - qab * x / qap
+    d = 1.0 / (d if abs(d) > 1e-300 else 1e-300)
+    h = d
+    for m in range(1, 300):
+        m2 = 2 * m
+        aa = m * (b - m) * x / ((qam + m2) * (a + m2))
+        d = 1.0 + aa * d
+        d = 1.0 / (d if abs(d) > 1e-300 else 1e-300)
+        c = 1.0 + aa / c
+        c = c if abs(c) > 1e-300 else 1e-300
+        h *= d * c
+        aa = -(a + m) * (qab + m) * x / ((a + m2) * (qap + m2))
+        d = 1.0 + aa * d
+        d = 1.0 / (d if abs(d) > 1e-300 else 1e-300)
+        c = 1.0 + aa / c
+        c = c if abs(c) > 1e-300 else 1e-300
+        delta = d * c
+        h *= delta
+        if abs(delta - 1.0) < 1e-12:
+            break
+    return h
+
+
+def betai(a, b, x):
+    """Regularized incomplete beta function I_x(a, b)"""
+    if x <= 0.0:
+        return 0.0
+    if x >= 1.0:
+        return 1.0
+    front = math.exp(math.lgamma(a + b) - math.lgamma(a) - math.lgamma(b)
+                     + a * math.log(x) + b * math.log(1.0 - x))
+    if x < (a + 1.0) / (a + b + 2.0):
+        return front * betacf(a, b, x) / a
+    return 1.0 - front * betacf(b, a, 1.0 - x) / b
+
+
+def welch(base, cand):
+    """Two-sided p-value of Welch's t-test of the two samples"""
+    n1, n2 = len(base), len(cand)
+    m1, m2 = sum(base) / n1, sum(cand) / n2
+    v1 = sum((x - m1) ** 2 for x in base) / (n1 - 1)
+    v2 = sum((x - m2) ** 2 for x in cand) / (n2 - 1)
+    se = v1 / n1 + v2 / n2
+    if se == 0:
+        return 0.0 if m1 != m2 else 1.0
+    t = (m2 - m1) / math.sqrt(se)
+    df = se ** 2 / ((v1 / n1) ** 2 / (n1 - 1) + (v2 / n2) ** 2 / (n2 - 1))
+    return betai(df / 2.0, 0.5, df / (df + t * t))
+
+
+def pool(records):
+    samples = {}
+    for rec in records:
+        for metric, values in rec["samples"].items():
+            samples.setdefault((rec["benchmark"], metric), []).extend(values)
+    return samples
+
+
+def compare(args):
+    options = {"baseline": None, "candidate": None, "host": None,
+               "alpha": str(DEFAULT_ALPHA),
+               "min-change": str(DEFAULT_MIN_CHANGE), "store": DEFAULT_STORE}
+    parse_options(args, options)
+    alpha = float(options["alpha"])
+    min_change = float(options["min-change"])
+
+    # by default the host of the latest record made on this machine
+    records = load(options["store"])
+    host = options["host"]
+    if host is None:
+        local = [r["host"] for r in records
+                 if r["hardware"]["hostname"] == socket.gethostname()]
+        host = local[-1] if local else host_info()[0]
+    records = [r for r in records if r["host"] == host]
+    revisions = []
+    for rec in records:
+        if rec["revision"] not in revisions:
+            revisions.append(rec["revision"])
+
+    # by default the latest revision against the one recorded before it
+    candidate = options["candidate"] or (revisions[-1] if revisions else None)
+    if candidate in revisions and options["baseline"] is None:
+        index = revisions.index(candidate)
+        baseline = revisions[index - 1] if index > 0 else None
+    else:
+        baseline = options["baseline"]
+    if candidate not in revisions or baseline not in revisions:
+        sys.exit("Need results of two revisions on host %s, found: %s"
+                 % (host, ", ".join(revisions) or "none"))
+
+    base = pool(r for r in records if r["revision"] == baseline)
+    cand = pool(r for r in records if r["revision"] == candidate)
+    print("Host %s: %s (baseline) against %s (candidate)"
+          % (host, baseline, candidate))
+
+    regressions = 0
+    for key in sorted(set(base) & set(cand)):
+        b, c = base[key], cand[key]
+        mean_b, mean_c = sum(b) / len(b), sum(c) / len(c)
+        change = (mean_c - mean_b) / abs(mean_b) * 100 if mean_b else 0.0
+        name = metric_name(key[1])
+        lower = (LOWER_IS_BETTER.search(name)
+                 and not HIGHER_IS_BETTER.search(name))
+        worse = change > 0 if lower else change < 0
+        if len(b) < 2 or len(c) < 2:
+            verdict, p = "too few samples", float("nan")
+        else:
+            p = welch(b, c)
+            if p < alpha and abs(change) >= min_change:
+                verdict = "REGRESSION" if worse else "improvement"
+            else:
+                verdict = "no change"
+        if verdict == "REGRESSION":
+            regressions += 1
+        print("%s %s: %g -> %g (%+.1f%%, p=%.3g) %s"
+              % (key[0], key[1], mean_b, mean_c, change, p, verdict))
+
+    print("%d regression(s)" % regressions)
+    return 1 if regressions else 0
+
+
+def list_records(args):
+    options = {"store": DEFAULT_STORE}
+    parse_options(args, options)
+    for rec in load(options["store"]):
+        print("%s %s %s %s %s" % (rec["time"], rec["host"], rec["revision"],
+                                  rec["benchmark"],
+                                  " ".join(sorted(rec["samples"]))))
+
+
+if __name__ == "__main__":
+    commands = {"record": record, "compare": compare, "list": list_records}
+    if len(sys.argv) < 2 or sys.argv[1] not in commands:
+        print("Program usage: python results.py <record|compare|list> [options]")
+        sys.exit(-1)
+    sys.exit(commands[sys.argv[1]](sys.argv[2:]) or 0)